@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOPlatformExpert.h>
+
+#include "Apple8259PIC.h"
+#include "PICShared.h"
+
+#define super IOInterruptController
+OSDefineMetaClassAndStructors(Apple8259PICInterruptController, IOInterruptController)
+
+// IRQs wired to motherboard devices that are always edge triggered,
+// the ELCR bits for these must stay clear.
+#define kEdgeOnlyIRQs ((1 << 0) | (1 << 1) | (1 << kPICSlaveID) | (1 << 8) | (1 << 13))
+
+// IRQ 7 and 15 are raised by each PIC when a request goes away before
+// it is acknowledged.
+#define IS_SPURIOUS_CANDIDATE(x) (((x) & 7) == 7)
+
+//---------------------------------------------------------------------------
+bool Apple8259PIC::start(IOService *provider)
+{
+    OSNumber *num;
+    const OSSymbol *sym;
+    IOInterruptAction handler;
+    int i = 0;
+
+    if (super::start(provider) == false)
+    {
+        return false;
+    }
+
+    _handleSleepWakeFunction = OSSymbol::withCString(kHandleSleepWakeFunction);
+    _setVectorTypeFunction = OSSymbol::withCString(kSetVectorTypeFunction);
+
+    if ((!_handleSleepWakeFunction) || (!_setVectorTypeFunction))
+    {
+        return false;
+    }
+
+    // IRQ 0 is delivered to the CPU as this vector, and the remaining
+    // IRQs follow it in order.
+    _vectorBase = kPICDefaultBaseVector;
+
+    num = OSDynamicCast(OSNumber, provider->getProperty(kBaseVectorNumberKey));
+    if (num)
+    {
+        _vectorBase = num->unsigned32BitValue();
+    }
+
+    if (_vectorBase & 7)
+    {
+        APIC_LOG("8259PIC: base vector %ld is not 8 aligned\n", (long)_vectorBase);
+        return false;
+    }
+
+    // Automatic EOI saves the one or two EOI port writes per interrupt,
+    // at the cost of masking level triggered IRQs around the handler.
+    num = OSDynamicCast(OSNumber, provider->getProperty(kAutoEOIKey));
+    if (0 == num)
+    {
+        num = OSDynamicCast(OSNumber, getProperty(kAutoEOIKey));
+    }
+
+    _autoEOI = (num && (num->unsigned32BitValue() != 0));
+
+    _interruptLock = IOSimpleLockAlloc();
+    if (0 == _interruptLock)
+    {
+        APIC_LOG("8259PIC: IOSimpleLockAlloc failed\n");
+        return false;
+    }
+
+    // Allocate the memory for the vectors shared with the superclass.
+    vectors = IONew(IOInterruptVector, kNumVectors);
+    if (0 == vectors)
+    {
+        APIC_LOG("8259PIC: no memory for shared vectors\n");
+        return false;
+    }
+
+    bzero(vectors, sizeof(IOInterruptVector) * kNumVectors);
+
+    // Allocate locks for the vectors.
+    for (i = 0; i < kNumVectors; i++)
+    {
+        vectors[i].interruptLock = IOLockAlloc();
+
+        if (vectors[i].interruptLock == 0)
+        {
+            APIC_LOG("8259PIC: no memory for %dth vector lock\n", i);
+            return false;
+        }
+    }
+
+    // Mask all interrupts except for the cascade line, and keep the
+    // trigger types left in the ELCR by the firmware.
+    _interruptMasks = 0xffff & ~(1 << kPICSlaveID);
+    _interruptTriggerTypes = (portRead(kPIC1TriggerTypePort) | (portRead(kPIC2TriggerTypePort) << 8));
+    _interruptTriggerTypes &= ~kEdgeOnlyIRQs;
+
+    resetPIC();
+
+    // Register the interrupt handler function so it can service interrupts.
+    handler = getInterruptHandlerAddress();
+    if (provider->registerInterrupt(0, this, handler, 0) != kIOReturnSuccess)
+    {
+        APIC_LOG("8259PIC: registerInterrupt failed\n");
+        return false;
+    }
+
+    provider->enableInterrupt(0);
+
+    setProperty(kBaseVectorNumberKey, _vectorBase, 32);
+    setProperty(kVectorCountKey, kNumVectors, 32);
+
+    // Register this interrupt controller so clients can find it.
+    sym = OSSymbol::withString((OSString *)provider->getProperty(kInterruptControllerNameKey));
+    if (0 == sym)
+    {
+        APIC_LOG("8259PIC: no interrupt controller name\n");
+        return false;
+    }
+
+    getPlatform()->registerInterruptController((OSSymbol *)sym, this);
+
+    sym->release();
+    registerService();
+
+    APIC_LOG("8259PIC: start success\n");
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void Apple8259PIC::free(void)
+{
+    int i = 0;
+
+    APIC_LOG("8259PIC: %s\n", __FUNCTION__);
+
+    if (vectors)
+    {
+        for (i = 0; i < kNumVectors; i++)
+        {
+            if (vectors[i].interruptLock)
+            {
+                IOLockFree(vectors[i].interruptLock);
+            }
+        }
+
+        IODelete(vectors, IOInterruptVector, kNumVectors);
+
+        vectors = 0;
+    }
+
+    if (_interruptLock)
+    {
+        IOSimpleLockFree(_interruptLock);
+
+        _interruptLock = 0;
+    }
+
+    if (_handleSleepWakeFunction)
+    {
+        _handleSleepWakeFunction->release();
+
+        _handleSleepWakeFunction = 0;
+    }
+
+    if (_setVectorTypeFunction)
+    {
+        _setVectorTypeFunction->release();
+
+        _setVectorTypeFunction = 0;
+    }
+
+    super::free();
+}
+
+//---------------------------------------------------------------------------
+void Apple8259PIC::initializePIC(UInt16 port, UInt8 icw1, UInt8 icw2, UInt8 icw3, UInt8 icw4)
+{
+    portWrite(kPIC_ICW1(port), kPIC_ICW1_MBO | icw1);
+    portWrite(kPIC_ICW2(port), icw2);
+    portWrite(kPIC_ICW3(port), icw3);
+    portWrite(kPIC_ICW4(port), icw4);
+}
+
+//---------------------------------------------------------------------------
+// Program both PICs from scratch, then bring the mask and trigger type
+// registers, and their shadows, in line with the software state.
+//---------------------------------------------------------------------------
+void Apple8259PIC::resetPIC(void)
+{
+    IOInterruptState state;
+    UInt8 icw4;
+
+    icw4 = kPIC_ICW4_uPM | (_autoEOI ? kPIC_ICW4_AEOI : 0);
+
+    state = IOSimpleLockLockDisableInterrupt(_interruptLock);
+
+    // Initialize master PIC.
+    initializePIC(kPIC1BasePort, kPIC_ICW1_IC4, _vectorBase, (1 << kPICSlaveID), icw4);
+
+    // Initialize slave PIC.
+    initializePIC(kPIC2BasePort, kPIC_ICW1_IC4, _vectorBase + 8, kPICSlaveID, icw4);
+
+    // Reads from the command ports return the in-service register,
+    // which is only looked at to reject spurious IRQ 7 and 15.
+    portWrite(kPIC_OCW3(kPIC1BasePort), kPIC_OCW3_MBO | kPIC_OCW3_RR | kPIC_OCW3_RIS);
+    portWrite(kPIC_OCW3(kPIC2BasePort), kPIC_OCW3_MBO | kPIC_OCW3_RR | kPIC_OCW3_RIS);
+
+    // Initialization leaves the masks in an undefined state.
+    _maskShadow = _interruptMasks;
+    portWrite(kPIC_OCW1(kPIC1BasePort), (_interruptMasks & 0xff));
+    portWrite(kPIC_OCW1(kPIC2BasePort), (_interruptMasks >> 8));
+
+    _triggerShadow = _interruptTriggerTypes;
+    portWrite(kPIC1TriggerTypePort, (_interruptTriggerTypes & 0xff));
+    portWrite(kPIC2TriggerTypePort, (_interruptTriggerTypes >> 8));
+
+    IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::getInterruptType(IOService *nub, int source, int *interruptType)
+{
+    IOInterruptSource *interruptSources;
+    OSData *vectorData;
+    UInt32 vectorNumber;
+
+    if ((0 == nub) || (0 == interruptType))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    interruptSources = nub->_interruptSources;
+    vectorData = interruptSources[source].vectorData;
+
+    if (vectorData->getLength() < sizeof(UInt32))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vectorNumber = DATA_TO_VECTOR(vectorData);
+    if (vectorNumber >= kNumVectors)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    // The ELCR is only brought in line with the interrupt flags by
+    // initVector(), so report the flags if there are any.
+    if (vectorData->getLength() >= sizeof(UInt64))
+    {
+        *interruptType = ((DATA_TO_FLAGS(vectorData) & kInterruptTriggerModeMask) == kInterruptTriggerModeLevel) ?
+                         kIOInterruptTypeLevel : kIOInterruptTypeEdge;
+    } else {
+        *interruptType = (_interruptTriggerTypes & (1 << vectorNumber)) ? kIOInterruptTypeLevel : kIOInterruptTypeEdge;
+    }
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+int Apple8259PIC::getVectorType(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    return (_interruptTriggerTypes & (1 << vectorNumber)) ? kIOInterruptTypeLevel : kIOInterruptTypeEdge;
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::setVectorType(IOInterruptVectorNumber vectorNumber, long type)
+{
+    IOInterruptState state;
+    UInt16 triggerTypes;
+
+    if ((vectorNumber < 0) || (vectorNumber >= kNumVectors))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    if ((type == kIOInterruptTypeLevel) && (kEdgeOnlyIRQs & (1 << vectorNumber)))
+    {
+        return kIOReturnUnsupported;
+    }
+
+    state = IOSimpleLockLockDisableInterrupt(_interruptLock);
+
+    triggerTypes = _interruptTriggerTypes & ~(1 << vectorNumber);
+    if (type == kIOInterruptTypeLevel)
+    {
+        triggerTypes |= (1 << vectorNumber);
+    }
+
+    _interruptTriggerTypes = triggerTypes;
+    portWriteShadowed(&_triggerShadow, _interruptTriggerTypes,
+                      kPIC1TriggerTypePort, kPIC2TriggerTypePort, vectorNumber);
+
+    IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+
+    APIC_LOG("8259PIC: %s %ld to %s trigger\n", __FUNCTION__, (long)vectorNumber,
+             (type == kIOInterruptTypeLevel) ? "level" : "edge");
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+void Apple8259PIC::initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    OSData *vectorData;
+
+    // Get the vector flags assigned by the platform driver, if any.
+    // Without flags, keep the trigger type set up by the firmware.
+    vectorData = vector->nub->_interruptSources[vector->source].vectorData;
+
+    if (vectorData->getLength() < sizeof(UInt64))
+    {
+        return;
+    }
+
+    setVectorType(vectorNumber,
+                  ((DATA_TO_FLAGS(vectorData) & kInterruptTriggerModeMask) == kInterruptTriggerModeLevel) ?
+                  kIOInterruptTypeLevel : kIOInterruptTypeEdge);
+}
+
+//---------------------------------------------------------------------------
+bool Apple8259PIC::vectorCanBeShared(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    // Only level triggered inputs can be safely wire-ORed.
+    return (getVectorType(vectorNumber, vector) == kIOInterruptTypeLevel);
+}
+
+//---------------------------------------------------------------------------
+IOInterruptAction Apple8259PIC::getInterruptHandlerAddress(void)
+{
+    return OSMemberFunctionCast(IOInterruptAction, this, &Apple8259PIC::handleInterrupt);
+}
+
+//---------------------------------------------------------------------------
+void Apple8259PIC::disableVectorHard(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    IOInterruptState state;
+
+    // The cascade input must stay unmasked for the slave to work.
+    if (vectorNumber == kPICSlaveID)
+    {
+        return;
+    }
+
+    state = IOSimpleLockLockDisableInterrupt(_interruptLock);
+    maskIRQ(vectorNumber);
+    IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+}
+
+//---------------------------------------------------------------------------
+void Apple8259PIC::enableVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    IOInterruptState state;
+
+    state = IOSimpleLockLockDisableInterrupt(_interruptLock);
+    unmaskIRQ(vectorNumber);
+    IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::handleInterrupt(void *savedState, IOService *nub, int source)
+{
+    IOInterruptVector *vector;
+    IOInterruptVectorNumber vectorNumber;
+    bool levelMasked = false;
+
+    vectorNumber = source - _vectorBase;
+    if ((vectorNumber < 0) || (vectorNumber >= kNumVectors))
+    {
+        return kIOReturnSuccess;
+    }
+
+    // The port counters and the OCW2 sequence for a slave IRQ are
+    // shared with the other CPUs.
+    IOSimpleLockLock(_interruptLock);
+
+    if (_autoEOI)
+    {
+        // The in-service bit is already clear, so a level triggered
+        // IRQ would be raised again for as long as its line stays
+        // asserted. Hold it masked until the handler has quieted the
+        // device. Spurious IRQs cannot be told apart in this mode,
+        // and go to the handler.
+        if ((_interruptTriggerTypes & ~_interruptMasks) & (1 << vectorNumber))
+        {
+            maskIRQ(vectorNumber);
+            levelMasked = true;
+        }
+    } else {
+        // A request withdrawn before it was acknowledged shows up as the
+        // lowest priority IRQ of a PIC, without its in-service bit set.
+        // It must not be acknowledged, except for the master cascade
+        // input that did see a real request from the slave.
+        if ((IS_SPURIOUS_CANDIDATE(vectorNumber)) &&
+            ((portRead(kPIC_OCW3(IS_SLAVE_VECTOR(vectorNumber) ? kPIC2BasePort : kPIC1BasePort)) & 0x80) == 0))
+        {
+            if (IS_SLAVE_VECTOR(vectorNumber))
+            {
+                portWrite(kPIC_OCW2(kPIC1BasePort), kPIC_OCW2_SL | kPIC_OCW2_EOI | kPIC_OCW2_LEVEL(kPICSlaveID));
+            }
+
+            IOSimpleLockUnlock(_interruptLock);
+            return kIOReturnSuccess;
+        }
+
+        ackInterrupt(vectorNumber);
+    }
+
+    IOSimpleLockUnlock(_interruptLock);
+
+    vector = &vectors[vectorNumber];
+
+    vector->interruptActive = 1;
+
+    if ((!vector->interruptDisabledSoft) && (vector->interruptRegistered))
+    {
+        vector->handler(vector->target, vector->refCon, vector->nub, vector->source);
+
+        // interruptDisabledSoft flag may be set by the
+        // handler to indicate that the interrupt should
+        // be disabled.
+        if ((vector->interruptDisabledSoft) && (vector->interruptDisabledHard == 0))
+        {
+            vector->interruptDisabledHard = 1;
+            disableVectorHard(vectorNumber, vector);
+        }
+    } else {
+        vector->interruptDisabledHard = 1;
+        disableVectorHard(vectorNumber, vector);
+    }
+
+    if ((levelMasked) && (!vector->interruptDisabledHard))
+    {
+        IOSimpleLockLock(_interruptLock);
+        unmaskIRQ(vectorNumber);
+        IOSimpleLockUnlock(_interruptLock);
+    }
+
+    vector->interruptActive = 0;
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::prepareForSleep(void)
+{
+    IOInterruptState state;
+
+    // Mask everything but the cascade, leaving the software masks
+    // intact for the restore on wake.
+    state = IOSimpleLockLockDisableInterrupt(_interruptLock);
+    portWriteShadowed(&_maskShadow, 0xffff & ~(1 << kPICSlaveID),
+                      kPIC_OCW1(kPIC1BasePort), kPIC_OCW1(kPIC2BasePort), 0);
+    portWriteShadowed(&_maskShadow, 0xffff & ~(1 << kPICSlaveID),
+                      kPIC_OCW1(kPIC1BasePort), kPIC_OCW1(kPIC2BasePort), 8);
+    IOSimpleLockUnlockEnableInterrupt(_interruptLock, state);
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::resumeFromSleep(void)
+{
+    // The PICs have lost their initialization, and the ELCR may have
+    // been reprogrammed by the firmware, so the shadows are stale.
+    resetPIC();
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+bool Apple8259PIC::serializeProperties(OSSerialize *s) const
+{
+    Apple8259PIC *self = (Apple8259PIC *)this;
+
+    self->setProperty(kPortReadCountKey, _portReads, 32);
+    self->setProperty(kPortWriteCountKey, _portWrites, 32);
+    self->setProperty(kPortWritesSavedKey, _portWritesSaved, 32);
+
+    return super::serializeProperties(s);
+}
+
+//---------------------------------------------------------------------------
+IOReturn Apple8259PIC::callPlatformFunction(const OSSymbol *function,
+                                            bool waitForFunction,
+                                            void *param1, void *param2,
+                                            void *param3, void *param4)
+{
+    UInt64 sleepWakeFunction = (UInt64)param1;
+
+    if (function == _handleSleepWakeFunction)
+    {
+        if (sleepWakeFunction == 2)
+        {
+            return kIOReturnSuccess;  /* deep idle, nothing to do */
+        } else if (sleepWakeFunction == 1) {
+            return prepareForSleep(); /* prior to system sleep */
+        }
+
+        return resumeFromSleep();   /* after system wake */
+    } else if (function == _setVectorTypeFunction) {
+        // param1 - IRQ number
+        // param2 - kIOInterruptTypeEdge or kIOInterruptTypeLevel
+        return setVectorType((uintptr_t)param1, (uintptr_t)param2);
+    }
+
+    return super::callPlatformFunction(function, waitForFunction, param1, param2, param3, param4);
+}
@@ -103,6 +103,20 @@
 #define kPIC_OCW3_RIS 0x01
 
 
+/*
+ * Keys for properties in the registry.
+ */
+#define kPortReadCountKey    "Port Reads"
+#define kPortWriteCountKey   "Port Writes"
+#define kPortWritesSavedKey  "Port Writes Saved"
+
+/*
+ * Tunables, from the provider or the personality.
+ */
+#define kAutoEOIKey          "Auto EOI"
+
+#define kPICDefaultBaseVector 0x20
+
 #define Apple8259PIC Apple8259PICInterruptController
 
 class Apple8259PIC : public IOInterruptController
@@ -116,45 +130,97 @@ protected:
     const OSSymbol *_handleSleepWakeFunction;
     const OSSymbol *_setVectorTypeFunction;
 
-    inline void writeInterruptMask(long irq)
+    // System vector number of IRQ 0, programmed through ICW2.
+    UInt32 _vectorBase;
+
+    // Both PICs are initialized in automatic EOI mode, and clear the
+    // in-service bit themselves when the CPU takes the interrupt.
+    bool _autoEOI;
+
+    // Last values written to the OCW1 and ELCR ports. Every legacy
+    // port access costs about a microsecond, so bytes that would not
+    // change are never written again.
+    UInt16 _maskShadow;
+    UInt16 _triggerShadow;
+
+    // Port access counters, published in the registry.
+    volatile UInt32 _portReads;
+    volatile UInt32 _portWrites;
+    volatile UInt32 _portWritesSaved;
+
+    inline UInt8 portRead(UInt16 port)
+    {
+        _portReads++;
+        return inb(port);
+    }
+
+    inline void portWrite(UInt16 port, UInt8 value)
     {
+        _portWrites++;
+        outb(port, value);
+    }
+
+    // Write one byte of a shadowed 16-bit register pair, low byte to
+    // the master port and high byte to the slave port.
+    inline void portWriteShadowed(UInt16 *shadow, UInt16 value, UInt16 port1, UInt16 port2, long irq)
+    {
+        UInt16 byteMask = IS_SLAVE_VECTOR(irq) ? 0xff00 : 0x00ff;
+
+        if (((*shadow ^ value) & byteMask) == 0)
+        {
+            _portWritesSaved++;
+            return;
+        }
+
+        *shadow = (*shadow & ~byteMask) | (value & byteMask);
+
         if (IS_SLAVE_VECTOR(irq))
         {
-            outb(kPIC_OCW1(kPIC2BasePort), (_interruptMasks >> 8));
+            portWrite(port2, (value >> 8));
         } else {
-            outb(kPIC_OCW1(kPIC1BasePort), (_interruptMasks & 0xff));
+            portWrite(port1, (value & 0xff));
         }
     }
 
-    inline void disableInterrupt(long irq)
+    inline void writeInterruptMask(long irq)
+    {
+        portWriteShadowed(&_maskShadow, _interruptMasks, kPIC_OCW1(kPIC1BasePort), kPIC_OCW1(kPIC2BasePort), irq);
+    }
+
+    inline void maskIRQ(long irq)
     {
         _interruptMasks |= (1 << irq);
         writeInterruptMask(irq);
     }
 
-    inline void enableInterrupt(long irq)
+    inline void unmaskIRQ(long irq)
     {
         _interruptMasks &= ~(1 << irq);
         writeInterruptMask(irq);
     }
 
+    // Issue a specific EOI for the in-service IRQ, and for the cascade
+    // input on the master only when the IRQ came through the slave.
     inline void ackInterrupt(long irq)
     {
         if (IS_SLAVE_VECTOR(irq))
         {
-            outb(kPIC_OCW2(kPIC2BasePort), kEOICommand);
+            portWrite(kPIC_OCW2(kPIC2BasePort), kPIC_OCW2_SL | kPIC_OCW2_EOI | kPIC_OCW2_LEVEL(irq));
+            portWrite(kPIC_OCW2(kPIC1BasePort), kPIC_OCW2_SL | kPIC_OCW2_EOI | kPIC_OCW2_LEVEL(kPICSlaveID));
+        } else {
+            portWrite(kPIC_OCW2(kPIC1BasePort), kPIC_OCW2_SL | kPIC_OCW2_EOI | kPIC_OCW2_LEVEL(irq));
         }
-
-        outb(kPIC_OCW2(kPIC1BasePort), kEOICommand);
     }
 
     virtual void initializePIC(UInt16 port, UInt8 icw1, UInt8 icw2, UInt8 icw3, UInt8 icw4);
 
+    virtual void resetPIC(void);
+
     virtual IOReturn prepareForSleep(void);
 
     virtual IOReturn resumeFromSleep(void);
 
-    virtual IOReturn setVectorType(long vectorNumber, long type);
+    virtual IOReturn setVectorType(IOInterruptVectorNumber vectorNumber, long type);
 
     virtual void free(void);
 
@@ -162,16 +228,17 @@ public:
     virtual bool start(IOService * provider);
 
     virtual IOReturn getInterruptType(IOService *nub, int source, int *interruptType);
-    virtual int getVectorType(long vectorNumber, IOInterruptVector * vector);
+    virtual int getVectorType(IOInterruptVectorNumber vectorNumber, IOInterruptVector * vector);
     virtual IOInterruptAction getInterruptHandlerAddress(void);
     virtual IOReturn handleInterrupt(void *refCon, IOService *nub, int source);
-    virtual bool vectorCanBeShared(long vectorNumber, IOInterruptVector * vector);
+    virtual bool vectorCanBeShared(IOInterruptVectorNumber vectorNumber, IOInterruptVector * vector);
 
-    virtual IOReturn initVector(long vectorNumber, IOInterruptVector *vector);
-    virtual IOReturn disableVectorHard(long vectorNumber, IOInterruptVector *vector);
-    virtual IOReturn enableVector(long vectorNumber, IOInterruptVector *vector);
+    virtual void initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector);
+    virtual void disableVectorHard(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector);
+    virtual void enableVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector);
     virtual IOReturn callPlatformFunction(const OSSymbol *function, bool waitForFunction,
                                            void *param1, void *param2, void *param3, void *param4);
+    virtual bool serializeProperties(OSSerialize *s) const;
 };
 
 #endif /* !_IOKIT_APPLE8259PIC_H */
@@ -22,6 +22,7 @@
 
 #include <IOKit/IOLib.h>
 #include <IOKit/IOPlatformExpert.h>
+#include <kern/thread.h>
 
 #include "AppleAPIC.h"
 #include "Apple8259PIC.h"
@@ -34,17 +35,47 @@ OSDefineMetaClassAndStructors(AppleAPICInterruptController, IOInterruptControlle
 #define PIC_TO_SYS_VECTOR(pv) ((pv) + _vectorBase)
 #define SYS_TO_PIC_VECTOR(sv) ((sv) - _vectorBase);
 
+// Two level map from global system interrupt to controller and pin,
+// shared by every I/O APIC. Readers walk it without a lock, so pages
+// are published once and never freed, there are at most kGSIPageCount
+// of them. Updates are serialized by gGSILock.
+static GSIEntry * volatile gGSITable[kGSIPageCount];
+static IOLock * volatile gGSILock;
+
+//---------------------------------------------------------------------------
+extern "C"
+{
+    extern void lapic_end_of_interrupt(void);
+    extern int cpu_number(void);
+    extern unsigned int ml_get_max_cpus(void);
+}
+
 //---------------------------------------------------------------------------
 bool AppleAPIC::start(IOService *provider)
 {
     OSNumber *num;
     const OSSymbol *sym;
-    int i = 0;
+    UInt32 num32;
+    UInt64 startTime = mach_absolute_time();
+    UInt64 mmioWrites;
+    UInt64 ns;
 
     _handleSleepWakeFunction = OSSymbol::withCString(kHandleSleepWakeFunction);
 	_setVectorPhysicalDestination = OSSymbol::withCString(kSetVectorPhysicalDestination);
-
-    if ((!_handleSleepWakeFunction) || (!_setVectorPhysicalDestination))
+    _setVectorLogicalDestination = OSSymbol::withCString(kSetVectorLogicalDestination);
+    _getInterruptRemapTable = OSSymbol::withCString(kGetInterruptRemapTable);
+    _lookupGlobalSystemInterrupt = OSSymbol::withCString(kLookupGlobalSystemInterrupt);
+    _setGlobalSystemInterruptDestination = OSSymbol::withCString(kSetGlobalSystemInterruptDestination);
+    _setInterruptTrace = OSSymbol::withCString(kSetInterruptTrace);
+    _drainInterruptTrace = OSSymbol::withCString(kDrainInterruptTrace);
+    _resetInterruptLatency = OSSymbol::withCString(kResetInterruptLatency);
+    _getRegisterSnapshot = OSSymbol::withCString(kGetRegisterSnapshot);
+    _compareRegisterSnapshot = OSSymbol::withCString(kCompareRegisterSnapshot);
+
+    if ((!_handleSleepWakeFunction) || (!_setVectorPhysicalDestination) || (!_setVectorLogicalDestination) ||
+        (!_getInterruptRemapTable) || (!_lookupGlobalSystemInterrupt) || (!_setGlobalSystemInterruptDestination) ||
+        (!_setInterruptTrace) || (!_drainInterruptTrace) || (!_resetInterruptLatency) ||
+        (!_getRegisterSnapshot) || (!_compareRegisterSnapshot))
     {
         return false;
     }
@@ -73,6 +104,30 @@ bool AppleAPIC::start(IOService *provider)
     }
 
     _destinationAddress = num->unsigned32BitValue();
+    _deliveryMode = kRTLODeliveryModeFixed;
+    _destinationMode = kRTLODestinationModePhysical;
+
+    // The platform may instead ask for every vector to be sent to a
+    // logical destination, and optionally delivered to the lowest
+    // priority CPU within it, so that the hardware spreads the load.
+    num = OSDynamicCast(OSNumber, provider->getProperty(kLogicalDestinationKey));
+    if (num)
+    {
+        _destinationAddress = num->unsigned32BitValue();
+        _destinationMode = kRTLODestinationModeLogical;
+    }
+
+    if (getTunable(provider, kLowestPriorityDeliveryKey, 0))
+    {
+        _deliveryMode = kRTLODeliveryModeLowestPriority;
+    }
+
+    _registerLock = IOLockAlloc();
+    if (0 == _registerLock)
+    {
+        APIC_LOG("IOAPIC-%ld: IOLockAlloc failed\n", _vectorBase);
+        return false;
+    }
 
     // Protect access to the indirect APIC registers.
     _apicLock = IOSimpleLockAlloc();
@@ -108,6 +163,7 @@ bool AppleAPIC::start(IOService *provider)
     }
 
     _apicBaseAddr = _apicMemoryMap->getVirtualAddress();
+    _indexShadow = kIndexShadowInvalid;
     APIC_LOG("IOAPIC-%ld: phys = %lx virt = %lx\n", _vectorBase, num->unsigned32BitValue(), _apicBaseAddr);
 
     // Cache the ID register, restored on system wake. We trust the BIOS
@@ -116,7 +172,9 @@ bool AppleAPIC::start(IOService *provider)
 
     // With the registers mapped in, find out how many interrupt table
     // entries are supported.
-    _vectorCount = GET_FIELD(indexRead(kIndexVER), kVERMaxEntries);
+    num32 = indexRead(kIndexVER);
+    _apicVersion = GET_FIELD(num32, kVERVersion);
+    _vectorCount = GET_FIELD(num32, kVERMaxEntries);
     if (_vectorCount >= 0xFF)
     {
         APIC_LOG("IOAPIC-%ld: excessive vector count (%ld)\n", _vectorBase, _vectorCount);
@@ -134,20 +192,10 @@ bool AppleAPIC::start(IOService *provider)
         return false;
     }
 
+    // Vector locks are allocated by registerInterrupt(), since most
+    // pins are never registered.
     bzero(vectors, sizeof(IOInterruptVector) * _vectorCount);
 
-    // Allocate locks for the vectors.
-    for (i = 0; i < _vectorCount; i++)
-    {
-        vectors[i].interruptLock = IOLockAlloc();
-
-        if (vectors[i].interruptLock == 0)
-        {
-            APIC_LOG("IOAPIC-%ld: no memory for %dth vector lock\n", _vectorBase, i);
-            return false;
-        }
-    }
-
     // Allocate memory for the vector entry table.
     _vectorTable = IONew(VectorEntry, _vectorCount);
     if (0 == _vectorTable)
@@ -156,7 +204,120 @@ bool AppleAPIC::start(IOService *provider)
         return false;
     }
 
+    // Allocate memory for the hardware shadow of the vector table.
+    _vectorShadow = IONew(VectorEntry, _vectorCount);
+    _vectorDirty = IONew(UInt8, _vectorCount);
+    _vectorScratch = IONew(VectorEntry, _vectorCount);
+    _vectorList = IONew(IOInterruptVectorNumber, _vectorCount);
+    if ((0 == _vectorShadow) || (0 == _vectorDirty) || (0 == _vectorScratch) || (0 == _vectorList))
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for vector shadow\n", _vectorBase);
+        return false;
+    }
+
+    _vectorMapWords = (_vectorCount + 31) / 32;
+    _vectorEnabledMap = IONew(UInt32, _vectorMapWords);
+    _vectorModifiedMap = IONew(UInt32, _vectorMapWords);
+    if ((0 == _vectorEnabledMap) || (0 == _vectorModifiedMap))
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for vector maps\n", _vectorBase);
+        return false;
+    }
+
+    bzero((void *)_vectorEnabledMap, sizeof(UInt32) * _vectorMapWords);
+    bzero((void *)_vectorModifiedMap, sizeof(UInt32) * _vectorMapWords);
+
+    invalidateRegisterShadow();
+
+    // Allocate and clear the software state for each vector.
+    _vectorState = IONew(VectorState, _vectorCount);
+    if (0 == _vectorState)
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for vector state\n", _vectorBase);
+        return false;
+    }
+
+    bzero(_vectorState, sizeof(VectorState) * _vectorCount);
+
+    _extendedDestinationID = (0 != getTunable(provider, kExtendedDestinationIDKey, 0));
+
+    if (!startInterruptRemapping(provider))
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for interrupt remapping table\n", _vectorBase);
+        return false;
+    }
+
+    // Allocate the index of the per-CPU interrupt counters, and the
+    // first slab, which holds the slot shared by unregistered vectors.
+    // The counters of the rest are allocated by registerInterrupt().
+    _cpuCount = ml_get_max_cpus();
+    _cpuCounterStride = ((sizeof(VectorCounters) * kCounterSlabVectors) + (kCacheLineSize - 1)) & ~(kCacheLineSize - 1);
+    _counterSlabCount = (_vectorCount + kCounterSlabVectors) >> kCounterSlabShift;
+    _counterSlabs = IONew(UInt8 *, _counterSlabCount);
+    _counterSlot = IONew(UInt16, _vectorCount);
+    if ((0 == _counterSlabs) || (0 == _counterSlot))
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for interrupt counters\n", _vectorBase);
+        return false;
+    }
+
+    bzero((void *)_counterSlabs, sizeof(UInt8 *) * _counterSlabCount);
+    bzero((void *)_counterSlot, sizeof(UInt16) * _vectorCount);
+
+    _counterSlabs[0] = (UInt8 *)IOMallocAligned(_cpuCount * _cpuCounterStride, kCacheLineSize);
+    if (0 == _counterSlabs[0])
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for interrupt counters\n", _vectorBase);
+        return false;
+    }
+
+    bzero(_counterSlabs[0], _cpuCount * _cpuCounterStride);
+    _counterSlotsUsed = 1;
+
+    _deferredProgramming = (0 != getTunable(provider, kDeferredProgrammingKey, 0));
+
+    mmioWrites = _mmioWrites;
     resetVectorTable();
+    setProperty(kResetMMIOWritesKey, _mmioWrites - mmioWrites, 64);
+
+    if (!startBalancer(provider))
+    {
+        APIC_LOG("IOAPIC-%ld: balancer start failed\n", _vectorBase);
+        return false;
+    }
+
+    // Directed EOI is only needed when the platform has turned off
+    // EOI broadcasts from the local APICs, and tells us so.
+    _directedEOI = (0 != getTunable(provider, kDirectedEOIKey, 0));
+
+    if (!startStormDetector(provider))
+    {
+        APIC_LOG("IOAPIC-%ld: storm detector start failed\n", _vectorBase);
+        return false;
+    }
+
+    if (!startStatisticsExport(provider))
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for shared statistics\n", _vectorBase);
+        return false;
+    }
+
+    if (getTunable(provider, kInterruptTraceKey, 0))
+    {
+        setInterruptTrace(true);
+    }
+
+    _latencyEnabled = (0 != getTunable(provider, kLatencyHistogramKey, 1));
+    if (_latencyEnabled)
+    {
+        measureLatencyRecording();
+    }
+
+    if (!registerGlobalSystemInterrupts())
+    {
+        APIC_LOG("IOAPIC-%ld: global system interrupt registration failed\n", _vectorBase);
+        return false;
+    }
 
     // Register our vectors with the top-level interrupt dispatcher.
     setProperty(kBaseVectorNumberKey, _vectorBase, 32);
@@ -174,12 +335,17 @@ bool AppleAPIC::start(IOService *provider)
         return false;
     }
 
-    IOLog("IOAPIC: Version 0x%02x Vectors %d:%d\n", (uint32_t)GET_FIELD(indexRead(kIndexVER), kVERVersion),
-          (uint32_t)_vectorBase, (uint32_t)((_vectorBase + _vectorCount) - 1));
+    IOLog("IOAPIC: Version 0x%02x Vectors %d:%d%s\n", (uint32_t)_apicVersion,
+          (uint32_t)_vectorBase, (uint32_t)((_vectorBase + _vectorCount) - 1),
+          _directedEOI ? " Directed EOI" : "");
 
     getPlatform()->registerInterruptController((OSSymbol *)sym, this);
 
     sym->release();
+
+    absolutetime_to_nanoseconds(mach_absolute_time() - startTime, &ns);
+    setProperty(kStartMicrosecondsKey, ns / 1000, 64);
+
     registerService();
 
     APIC_LOG("IOAPIC-%ld: start success\n", _vectorBase);
@@ -187,6 +353,20 @@ bool AppleAPIC::start(IOService *provider)
     return true;
 }
 
+//---------------------------------------------------------------------------
+// Leave the global system interrupt map while still retained, so that
+// a lookup that retains the controller never races its final release.
+//---------------------------------------------------------------------------
+void AppleAPIC::stop(IOService *provider)
+{
+    if (_gsiRegistered)
+    {
+        unregisterGlobalSystemInterrupts();
+    }
+
+    super::stop(provider);
+}
+
 //---------------------------------------------------------------------------
 
 void AppleAPIC::free(void)
@@ -195,6 +375,75 @@ void AppleAPIC::free(void)
 
     APIC_LOG("IOAPIC-%ld: %s\n", _vectorBase, __FUNCTION__);
 
+    // Only if never stopped.
+    if (_gsiRegistered)
+    {
+        unregisterGlobalSystemInterrupts();
+    }
+
+    if (_balancerCall)
+    {
+        // A running balancer may re-arm itself before it sees the zero
+        // interval, so cancel a second time once it has returned.
+        _balancerInterval = 0;
+        thread_call_cancel_wait(_balancerCall);
+        thread_call_cancel_wait(_balancerCall);
+        thread_call_free(_balancerCall);
+
+        _balancerCall = 0;
+    }
+
+    if (_statsCall)
+    {
+        // As for the balancer, the timer re-arms while clients remain.
+        _statsClients = 0;
+        thread_call_cancel_wait(_statsCall);
+        thread_call_cancel_wait(_statsCall);
+        thread_call_free(_statsCall);
+
+        _statsCall = 0;
+    }
+
+    if (_statsLock)
+    {
+        IOLockFree(_statsLock);
+
+        _statsLock = 0;
+    }
+
+    if (_statsMemory)
+    {
+        _statsMemory->release();
+
+        _statsMemory = 0;
+        _stats = 0;
+    }
+
+    if (_stormCall)
+    {
+        // Stop the storm timer from re-arming before cancelling it.
+        _stormThreshold = 0;
+        _stormCallArmed = 1;
+        thread_call_cancel_wait(_stormCall);
+        thread_call_free(_stormCall);
+
+        _stormCall = 0;
+    }
+
+    if (_balancerAPICIDs)
+    {
+        IODelete(_balancerAPICIDs, UInt32, _balancerCPUCount);
+
+        _balancerAPICIDs = 0;
+    }
+
+    if (_balancerLoad)
+    {
+        IODelete(_balancerLoad, UInt64, _balancerCPUCount);
+
+        _balancerLoad = 0;
+    }
+
     if (_handleSleepWakeFunction)
     {
         _handleSleepWakeFunction->release();
@@ -207,6 +456,60 @@ void AppleAPIC::free(void)
         _setVectorPhysicalDestination = 0;
     }
 
+    if (_setVectorLogicalDestination)
+    {
+        _setVectorLogicalDestination->release();
+        _setVectorLogicalDestination = 0;
+    }
+
+    if (_getInterruptRemapTable)
+    {
+        _getInterruptRemapTable->release();
+        _getInterruptRemapTable = 0;
+    }
+
+    if (_lookupGlobalSystemInterrupt)
+    {
+        _lookupGlobalSystemInterrupt->release();
+        _lookupGlobalSystemInterrupt = 0;
+    }
+
+    if (_setGlobalSystemInterruptDestination)
+    {
+        _setGlobalSystemInterruptDestination->release();
+        _setGlobalSystemInterruptDestination = 0;
+    }
+
+    if (_setInterruptTrace)
+    {
+        _setInterruptTrace->release();
+        _setInterruptTrace = 0;
+    }
+
+    if (_drainInterruptTrace)
+    {
+        _drainInterruptTrace->release();
+        _drainInterruptTrace = 0;
+    }
+
+    if (_resetInterruptLatency)
+    {
+        _resetInterruptLatency->release();
+        _resetInterruptLatency = 0;
+    }
+
+    if (_getRegisterSnapshot)
+    {
+        _getRegisterSnapshot->release();
+        _getRegisterSnapshot = 0;
+    }
+
+    if (_compareRegisterSnapshot)
+    {
+        _compareRegisterSnapshot->release();
+        _compareRegisterSnapshot = 0;
+    }
+
     if (vectors)
     {
         for (i = 0; i < _vectorCount; i++)
@@ -229,6 +532,121 @@ void AppleAPIC::free(void)
         _vectorTable = 0;
     }
 
+    if (_vectorState)
+    {
+        SharedHandler *handler;
+
+        for (i = 0; i < _vectorCount; i++)
+        {
+            stopThreadedVector(i);
+
+            while ((handler = _vectorState[i].sharedHandlers))
+            {
+                _vectorState[i].sharedHandlers = handler->next;
+                IODelete(handler, SharedHandler, 1);
+            }
+
+            if (_vectorState[i].specifierData)
+            {
+                _vectorState[i].specifierData->release();
+                _vectorState[i].specifierData = 0;
+            }
+
+            if (_vectorState[i].latency)
+            {
+                IODelete(_vectorState[i].latency, LatencyHistogram, 1);
+                _vectorState[i].latency = 0;
+            }
+        }
+    }
+
+    if (_counterSlabs)
+    {
+        for (i = 0; i < (int)_counterSlabCount; i++)
+        {
+            if (_counterSlabs[i])
+            {
+                IOFreeAligned(_counterSlabs[i], _cpuCount * _cpuCounterStride);
+            }
+        }
+
+        IODelete((void *)_counterSlabs, UInt8 *, _counterSlabCount);
+
+        _counterSlabs = 0;
+    }
+
+    if (_counterSlot)
+    {
+        IODelete((void *)_counterSlot, UInt16, _vectorCount);
+
+        _counterSlot = 0;
+    }
+
+    if (_traceRings)
+    {
+        _traceEnabled = 0;
+        IOFreeAligned(_traceRings, _cpuCount * sizeof(TraceRing));
+
+        _traceRings = 0;
+    }
+
+    if (_vectorState)
+    {
+        IODelete(_vectorState, VectorState, _vectorCount);
+
+        _vectorState = 0;
+    }
+
+    if (_vectorShadow)
+    {
+        IODelete(_vectorShadow, VectorEntry, _vectorCount);
+
+        _vectorShadow = 0;
+    }
+
+    if (_vectorDirty)
+    {
+        IODelete(_vectorDirty, UInt8, _vectorCount);
+
+        _vectorDirty = 0;
+    }
+
+    if (_vectorScratch)
+    {
+        IODelete(_vectorScratch, VectorEntry, _vectorCount);
+
+        _vectorScratch = 0;
+    }
+
+    if (_vectorList)
+    {
+        IODelete(_vectorList, IOInterruptVectorNumber, _vectorCount);
+
+        _vectorList = 0;
+    }
+
+    if (_vectorEnabledMap)
+    {
+        IODelete((UInt32 *)_vectorEnabledMap, UInt32, _vectorMapWords);
+
+        _vectorEnabledMap = 0;
+    }
+
+    if (_vectorModifiedMap)
+    {
+        IODelete((UInt32 *)_vectorModifiedMap, UInt32, _vectorMapWords);
+
+        _vectorModifiedMap = 0;
+    }
+
+    if (_remapTable)
+    {
+        _remapTable->release();
+
+        _remapTable = 0;
+        _remapEntries = 0;
+    }
+
     if (_apicMemoryMap)
     {
         _apicMemoryMap->release();
@@ -251,66 +669,253 @@ void AppleAPIC::free(void)
         _apicLock = 0;
     }
 
+    if (_registerLock)
+    {
+        IOLockFree(_registerLock);
+
+        _registerLock = 0;
+    }
+
     super::free();
 }
 
+//---------------------------------------------------------------------------
+// Print the registers from a snapshot, so the controller is read in one
+// go and the slow console output happens outside the lock. Entries that
+// no longer hold what we wrote are marked.
 //---------------------------------------------------------------------------
 IOReturn AppleAPIC::dumpRegisters(void)
 {
-    int i = 0;
-    IOReturn result = kIOReturnError;
+    APICRegisterSnapshot *snapshot;
+    UInt32 driftMap[kAPICSnapshotMapWords];
+    UInt32 drift;
+    UInt32 i;
 
-    for (i = 0x0; i < 0x10; i++)
+    snapshot = IONew(APICRegisterSnapshot, 1);
+    if (0 == snapshot)
     {
-        printf("IOAPIC-%d: reg %02x = %08x\n", (uint32_t)_vectorBase, i, (uint32_t)indexRead(i));
+        return kIOReturnNoMemory;
     }
 
-    for (i = 0x10; i < 0x40; i += 2)
+    snapshotRegisters(snapshot);
+    drift = compareRegisterSnapshot(snapshot, driftMap);
+
+    printf("IOAPIC-%d: id %08x ver %08x arb %08x boot %08x, %u entries drifted\n",
+           (uint32_t)_vectorBase, (uint32_t)snapshot->id, (uint32_t)snapshot->ver,
+           (uint32_t)snapshot->arb, (uint32_t)snapshot->boot, (uint32_t)drift);
+
+    for (i = 0; i < snapshot->vectorCount; i++)
     {
-        result = printf("IOAPIC-%d: reg %02x = %08x %08x\n", (uint32_t)_vectorBase, i, (uint32_t)indexRead(i + 1), (uint32_t)indexRead(i));
+        printf("IOAPIC-%d: reg %02x = %08x %08x%s\n", (uint32_t)_vectorBase, (uint32_t)(kIndexRTLO + (i * 2)),
+               (uint32_t)snapshot->entries[i].h32, (uint32_t)snapshot->entries[i].l32,
+               (driftMap[i >> 5] & (1 << (i & 31))) ? " *" : "");
     }
 
-    return result;
+    IODelete(snapshot, APICRegisterSnapshot, 1);
+
+    return kIOReturnSuccess;
 }
 
 //---------------------------------------------------------------------------
-
-IOReturn AppleAPIC::resetVectorTable(void)
+// Read the ID, VER, ARB and BOOT registers and every redirection table
+// entry under a single hold of the lock, so the snapshot is consistent.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::snapshotRegisters(APICRegisterSnapshot *snapshot)
 {
-    VectorEntry *entry;
-    int vectorNumber = 0;
-    IOReturn result = kIOReturnError;
+    IOInterruptState state;
+    UInt32 count;
+    UInt32 i;
 
-    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
-    {
-        entry = &_vectorTable[vectorNumber];
+    count = ((UInt32)_vectorCount < (UInt32)kAPICSnapshotMaxEntries) ? _vectorCount : kAPICSnapshotMaxEntries;
 
-        // A vector number can be easily mapped to an input pin number, and
-        // vice-versa. Is this an issue for P6 platforms? There is a note in
-        // the PPro manual about a 2 interrupt per priority level limitation.
-        // Need to investigate more...
-        entry->l32 = ((PIC_TO_SYS_VECTOR(vectorNumber) & kRTLOVectorNumberMask) |
-                      (kRTLODeliveryModeFixed | kRTLODestinationModePhysical | kRTLOMaskDisabled));
-        entry->h32 = ((_destinationAddress << kRTHIDestinationShift) & kRTHIDestinationMask);
+    bzero(snapshot, sizeof(APICRegisterSnapshot));
+    snapshot->version = kAPICRegisterSnapshotVersion;
+    snapshot->vectorBase = _vectorBase;
+    snapshot->vectorCount = count;
+
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+
+    snapshot->timestamp = mach_absolute_time();
+    snapshot->id = indexRead(kIndexID);
+    snapshot->ver = indexRead(kIndexVER);
+    snapshot->arb = indexRead(kIndexARBID);
+    snapshot->boot = indexRead(kIndexBOOT);
 
-        result = writeVectorEntry(vectorNumber);
+    for (i = 0; i < count; i++)
+    {
+        snapshot->entries[i].l32 = indexRead(kIndexRTLO + (i * 2));
+        snapshot->entries[i].h32 = indexRead(kIndexRTHI + (i * 2));
     }
 
-    return result;
+    IOSimpleLockUnlockEnableInterrupt(_apicLock, state);
+
+    return kIOReturnSuccess;
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::writeVectorEntry(IOInterruptVectorNumber vectorNumber)
+// Compare a snapshot against what we last wrote, to find entries changed
+// behind our back, by SMM code or firmware for instance. The delivery
+// status and remote IRR bits belong to the hardware and are ignored.
+// Halves written since the hardware was last reset are compared with the
+// register shadow. Halves not written since can hold anything masked, so
+// only the mask bit is compared with the vector table, along with the
+// vector and delivery mode if either side is unmasked. Returns the number
+// of entries that differ, and sets their bits in driftMap.
+//---------------------------------------------------------------------------
+UInt32 AppleAPIC::compareRegisterSnapshot(const APICRegisterSnapshot *snapshot, UInt32 *driftMap)
 {
     IOInterruptState state;
+    UInt32 ignore = kRTLODeliveryStatusMask | kRTLORemoteIRRMask;
+    UInt32 routing = kRTLOMaskMask | kRTLOVectorNumberMask | kRTLODeliveryModeMask;
+    UInt32 drift = 0;
+    UInt32 count;
+    UInt32 l32;
+    UInt32 i;
+
+    if (driftMap)
+    {
+        bzero(driftMap, kAPICSnapshotMapWords * sizeof(UInt32));
+    }
 
-    APIC_LOG("IOAPIC-%ld: %s %02ld = %08lx %08lx\n", _vectorBase, __FUNCTION__, vectorNumber,
-             _vectorTable[vectorNumber].h32, _vectorTable[vectorNumber].l32);
+    if ((snapshot->version != kAPICRegisterSnapshotVersion) || (snapshot->vectorBase != (UInt32)_vectorBase))
+    {
+        return 0;
+    }
 
+    count = (snapshot->vectorCount < (UInt32)_vectorCount) ? snapshot->vectorCount : _vectorCount;
+    if (count > kAPICSnapshotMaxEntries)
+    {
+        count = kAPICSnapshotMaxEntries;
+    }
+
+    // The lock keeps entries from being rewritten while we compare.
     state = IOSimpleLockLockDisableInterrupt(_apicLock);
 
-    indexWrite(kIndexRTLO + (vectorNumber * 2), _vectorTable[vectorNumber].l32);
-    indexWrite(kIndexRTHI + (vectorNumber * 2), _vectorTable[vectorNumber].h32);
+    for (i = 0; i < count; i++)
+    {
+        l32 = snapshot->entries[i].l32;
+
+        if (_vectorDirty[i] & kVectorDirtyLow)
+        {
+            if (((l32 & kRTLOMaskMask) == kRTLOMaskDisabled) &&
+                ((_vectorTable[i].l32 & kRTLOMaskMask) == kRTLOMaskDisabled))
+            {
+                l32 = 0;
+            } else {
+                l32 = ((l32 ^ _vectorTable[i].l32) & routing);
+            }
+        } else {
+            l32 = ((l32 ^ _vectorShadow[i].l32) & ~ignore);
+        }
+
+        if ((0 == l32) &&
+            ((_vectorDirty[i] & kVectorDirtyHigh) || (snapshot->entries[i].h32 == _vectorShadow[i].h32)))
+        {
+            continue;
+        }
+
+        drift++;
+        if (driftMap)
+        {
+            driftMap[i >> 5] |= (1 << (i & 31));
+        }
+    }
+
+    IOSimpleLockUnlockEnableInterrupt(_apicLock, state);
+
+    return drift;
+}
+
+//---------------------------------------------------------------------------
+// Forget what the hardware is known to contain, so that the next write
+// to every register is issued. Used when the contents of the registers
+// may have been lost or changed behind our back, such as across sleep.
+//---------------------------------------------------------------------------
+void AppleAPIC::invalidateRegisterShadow(void)
+{
+    int vectorNumber = 0;
+
+    _indexShadow = kIndexShadowInvalid;
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        _vectorDirty[vectorNumber] = kVectorDirtyAll;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Write the halves of a vector entry that differ from the hardware. The
+// half that masks the entry is written first, and the half that unmasks
+// it last, so the entry is never live with a partial update. Call with
+// _apicLock held.
+//---------------------------------------------------------------------------
+void AppleAPIC::writeVectorEntryLocked(IOInterruptVectorNumber vectorNumber, VectorEntry entry)
+{
+    if (entry.l32 & kRTLOMaskDisabled)
+    {
+        writeVectorLowLocked(vectorNumber, entry.l32);
+        writeVectorHighLocked(vectorNumber, entry.h32);
+    } else {
+        writeVectorHighLocked(vectorNumber, entry.h32);
+        writeVectorLowLocked(vectorNumber, entry.l32);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+IOReturn AppleAPIC::resetVectorTable(void)
+{
+    IOInterruptState state;
+    VectorEntry *entry;
+    int vectorNumber = 0;
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        entry = &_vectorTable[vectorNumber];
+
+        // A vector number can be easily mapped to an input pin number, and
+        // vice-versa. Is this an issue for P6 platforms? There is a note in
+        // the PPro manual about a 2 interrupt per priority level limitation.
+        // Need to investigate more...
+        entry->l32 = ((PIC_TO_SYS_VECTOR(vectorNumber) & kRTLOVectorNumberMask) | kRTLOMaskDisabled);
+        setVectorRouting(vectorNumber, _destinationAddress, _deliveryMode | _destinationMode);
+    }
+
+    // Every vector is now masked and in its default state.
+    bzero((void *)_vectorEnabledMap, sizeof(UInt32) * _vectorMapWords);
+    bzero((void *)_vectorModifiedMap, sizeof(UInt32) * _vectorMapWords);
+
+    if (!_deferredProgramming)
+    {
+        return writeVectorEntries(_vectorTable, 0, _vectorCount);
+    }
+
+    // A masked entry cannot deliver whatever its upper half says, so
+    // only the lower half is written. The upper half stays dirty, and
+    // is written with the rest of the entry when a vector is first
+    // used, by initVector() or writeVectorEntryLow().
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        writeVectorLowLocked(vectorNumber, _vectorTable[vectorNumber].l32);
+    }
+
+    return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::writeVectorEntry(IOInterruptVectorNumber vectorNumber)
+{
+    IOInterruptState state;
+
+    APIC_LOG("IOAPIC-%ld: %s %02ld = %08lx %08lx\n", _vectorBase, __FUNCTION__, vectorNumber,
+             _vectorTable[vectorNumber].h32, _vectorTable[vectorNumber].l32);
+
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+
+    updateRemapEntry(vectorNumber);
+    writeVectorEntryLocked(vectorNumber, _vectorTable[vectorNumber]);
 
     return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
 }
@@ -324,8 +929,52 @@ IOReturn AppleAPIC::writeVectorEntry(IOInterruptVectorNumber vectorNumber, Vecto
 
     state = IOSimpleLockLockDisableInterrupt(_apicLock);
 
-    indexWrite(kIndexRTLO + (vectorNumber * 2), entry.l32);
-    indexWrite(kIndexRTHI + (vectorNumber * 2), entry.h32);
+    writeVectorEntryLocked(vectorNumber, entry);
+
+    return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
+}
+
+//---------------------------------------------------------------------------
+// Program a set of vector entries under a single hold of _apicLock. The
+// entry at entries[i] is written to vectorNumbers[i], or to vector i if
+// vectorNumbers is null. Every entry that changes is masked first, then
+// all entries are programmed, and finally the unmasked ones are enabled,
+// so no entry is ever live while another is half written.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::writeVectorEntries(const VectorEntry *entries,
+                                       const IOInterruptVectorNumber *vectorNumbers,
+                                       IOInterruptVectorNumber count)
+{
+    IOInterruptState state;
+    IOInterruptVectorNumber vectorNumber;
+    IOInterruptVectorNumber i;
+
+    APIC_LOG("IOAPIC-%ld: %s %ld entries\n", _vectorBase, __FUNCTION__, count);
+
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+
+    for (i = 0; i < count; i++)
+    {
+        vectorNumber = vectorNumbers ? vectorNumbers[i] : i;
+
+        if (!vectorEntryCurrent(vectorNumber, entries[i]))
+        {
+            writeVectorLowLocked(vectorNumber, entries[i].l32 | kRTLOMaskDisabled);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        vectorNumber = vectorNumbers ? vectorNumbers[i] : i;
+        updateRemapEntry(vectorNumber);
+        writeVectorHighLocked(vectorNumber, entries[i].h32);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        vectorNumber = vectorNumbers ? vectorNumbers[i] : i;
+        writeVectorLowLocked(vectorNumber, entries[i].l32);
+    }
 
     return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
 }
@@ -336,298 +985,2608 @@ IOReturn AppleAPIC::writeVectorEntry(IOInterruptVectorNumber vectorNumber, Vecto
 IOReturn AppleAPIC::getInterruptType(IOService *nub,
                                      int source,
                                      int *interruptType)
+{
+    UInt32 decoded;
+  
+    if ((0 == nub) || (0 == interruptType))
+    {
+        return kIOReturnBadArgument;
+    }
+  
+    decoded = lookupSpecifier(nub, source);
+    if ((decoded & kSpecifierValid) == 0)
+    {
+        return kIOReturnNotFound;
+    }
+
+    if ((decoded & kRTLOTriggerModeMask) == kRTLOTriggerModeEdge)
+    {
+        *interruptType = kIOInterruptTypeEdge;
+    } else {
+        *interruptType = kIOInterruptTypeLevel;
+    }
+
+    APIC_LOG("IOAPIC-%ld: %s( %s, %d ) = %s (vector %ld)\n", _vectorBase, __FUNCTION__, nub->getName(), source,
+             *interruptType == kIOInterruptTypeLevel ? "level" : "edge",
+             DATA_TO_VECTOR(nub->_interruptSources[source].vectorData));
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::registerInterrupt(IOService *nub,
+                                      int source,
+                                      void *target,
+                                      IOInterruptHandler handler,
+                                      void *refCon )
 {
     IOInterruptSource *interruptSources;
+    IOInterruptVector *vector;
+    SharedHandler *shared;
+    UInt32 vectorNumber;
     OSData *vectorData;
-    UInt32 vectorFlags;
+    IOReturn result;
   
-    if ((0 == nub) || (0 == interruptType))
+    interruptSources = nub->_interruptSources;
+    vectorData = interruptSources[source].vectorData;
+    vectorNumber = DATA_TO_VECTOR(vectorData);
+
+    // Check that the vectorNumber is within bounds.
+    // Proceed to the superclass method if valid.
+    if (vectorNumber >= (UInt32)_vectorCount)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vector = &vectors[vectorNumber];
+
+    IOLockLock(_registerLock);
+
+    // The first handler on a vector is registered by the superclass.
+    // Its nub also decides whether the vector runs threaded.
+    if (!vector->interruptRegistered)
+    {
+        // The lock is kept once allocated, as the superclass reads it
+        // outside of _registerLock.
+        if (0 == vector->interruptLock)
+        {
+            vector->interruptLock = IOLockAlloc();
+            if (0 == vector->interruptLock)
+            {
+                IOLockUnlock(_registerLock);
+                return kIOReturnNoMemory;
+            }
+
+            _vectorLocksAllocated++;
+        }
+
+        if (!allocateVectorCounters(vectorNumber))
+        {
+            IOLockUnlock(_registerLock);
+            return kIOReturnNoMemory;
+        }
+
+        cacheSpecifier(nub, source);
+
+        result = super::registerInterrupt(nub, source, target, handler, refCon);
+        if ((kIOReturnSuccess == result) && (!startThreadedVector(vectorNumber, nub)))
+        {
+            _vectorState[vectorNumber].lockHolder = current_thread();
+            super::unregisterInterrupt(nub, source);
+            _vectorState[vectorNumber].lockHolder = 0;
+            result = kIOReturnNoMemory;
+        }
+
+        if (kIOReturnSuccess == result)
+        {
+            allocateLatencyHistogram(vectorNumber);
+        }
+
+        IOLockUnlock(_registerLock);
+        return result;
+    }
+
+    // Later handlers are chained behind it, if both the registered
+    // interrupt and the new one are marked shareable.
+    if ((!vectorCanBeShared(vectorNumber, vector)) || (!vectorIsShareable(nub, source)))
+    {
+        IOLockUnlock(_registerLock);
+        return kIOReturnNoResources;
+    }
+
+    shared = IONew(SharedHandler, 1);
+    if (0 == shared)
+    {
+        IOLockUnlock(_registerLock);
+        return kIOReturnNoMemory;
+    }
+
+    // New handlers start out disabled, like the primary handler, and
+    // are published at the head of the chain with a single store.
+    bzero(shared, sizeof(SharedHandler));
+    shared->nub = nub;
+    shared->source = source;
+    shared->target = target;
+    shared->handler = handler;
+    shared->refCon = refCon;
+    shared->next = _vectorState[vectorNumber].sharedHandlers;
+    OSCompareAndSwapPtr((void *)shared->next, (void *)shared,
+                        (void * volatile *)&_vectorState[vectorNumber].sharedHandlers);
+
+    IOLockUnlock(_registerLock);
+
+    APIC_LOG("IOAPIC-%ld: %s shared vector %d with %s\n", _vectorBase, __FUNCTION__, vectorNumber, nub->getName());
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::unregisterInterrupt(IOService *nub, int source)
+{
+    SharedHandler * volatile *link;
+    SharedHandler *shared;
+    IOInterruptVector *vector;
+    UInt32 vectorNumber;
+    IOReturn result;
+
+    vectorNumber = DATA_TO_VECTOR(nub->_interruptSources[source].vectorData);
+    if (vectorNumber >= (UInt32)_vectorCount)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vector = &vectors[vectorNumber];
+
+    IOLockLock(_registerLock);
+
+    // A vector without a lock was never registered.
+    if (0 == vector->interruptLock)
+    {
+        IOLockUnlock(_registerLock);
+        return kIOReturnSuccess;
+    }
+
+    // Unlink a chained handler, and free it once no CPU can still be
+    // walking past it.
+    for (link = &_vectorState[vectorNumber].sharedHandlers; (shared = *link); link = &shared->next)
+    {
+        if ((shared->nub == nub) && (shared->source == source))
+        {
+            *link = shared->next;
+            waitForSharedReaders(vectorNumber);
+            IODelete(shared, SharedHandler, 1);
+            IOLockUnlock(_registerLock);
+            return kIOReturnSuccess;
+        }
+    }
+
+    // The primary handler is going away, hand its place to the first
+    // chained handler instead of tearing down the whole vector.
+    if ((vector->interruptRegistered) && (vector->nub == nub) && (vector->source == source) &&
+        (_vectorState[vectorNumber].sharedHandlers))
+    {
+        result = promoteSharedHandler(vectorNumber);
+    } else {
+        // The superclass calls disableInterrupt() with the vector lock held.
+        _vectorState[vectorNumber].lockHolder = current_thread();
+        result = super::unregisterInterrupt(nub, source);
+        _vectorState[vectorNumber].lockHolder = 0;
+        stopThreadedVector(vectorNumber);
+    }
+
+    IOLockUnlock(_registerLock);
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+// Replace the primary handler of a vector with the first chained handler.
+// The vector is masked and drained first, since handleInterrupt() reads
+// the primary handler fields without a lock. Call with _registerLock held.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::promoteSharedHandler(IOInterruptVectorNumber vectorNumber)
+{
+    IOInterruptVector *vector = &vectors[vectorNumber];
+    SharedHandler *shared = _vectorState[vectorNumber].sharedHandlers;
+
+    IOLockLock(vector->interruptLock);
+
+    vector->interruptDisabledSoft = 1;
+    vector->interruptDisabledHard = 1;
+    disableVectorEntry(vectorNumber);
+
+    while (vector->interruptActive)
+    {
+        IODelay(1);
+    }
+
+    waitForThreadedInterrupt(vectorNumber);
+
+    vector->nub = shared->nub;
+    vector->source = shared->source;
+    vector->target = shared->target;
+    vector->handler = shared->handler;
+    vector->refCon = shared->refCon;
+
+    _vectorState[vectorNumber].sharedHandlers = shared->next;
+    waitForSharedReaders(vectorNumber);
+
+    if ((shared->enabled) || (sharedHandlersEnabled(vectorNumber)))
+    {
+        vector->interruptDisabledSoft = !shared->enabled;
+        vector->interruptDisabledHard = 0;
+        enableVector(vectorNumber, vector);
+    }
+
+    IOLockUnlock(vector->interruptLock);
+
+    IODelete(shared, SharedHandler, 1);
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Chained handler state is changed under the vector lock, which
+// promoteSharedHandler() holds while it reads and rewrites the same
+// fields. Not from a handler of the vector itself, at interrupt level or
+// on its worker, which promoteSharedHandler() drains before it looks, nor
+// from the superclass unregisterInterrupt(), which already holds it.
+// The lock is taken before the chain is entered, as promotion waits for
+// chain readers with the lock held.
+//---------------------------------------------------------------------------
+bool AppleAPIC::lockSharedVector(IOInterruptVectorNumber vectorNumber)
+{
+    IOInterruptVector *vector = &vectors[vectorNumber];
+
+    if ((0 == vector->interruptLock) || (getPlatform()->atInterruptLevel()) ||
+        (_vectorState[vectorNumber].threadActive == current_thread()) ||
+        (_vectorState[vectorNumber].lockHolder == current_thread()))
+    {
+        return false;
+    }
+
+    IOLockLock(vector->interruptLock);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::enableInterrupt(IOService *nub, int source)
+{
+    IOInterruptVector *vector;
+    SharedHandler *shared;
+    UInt32 vectorNumber;
+    UInt32 readerSlot;
+    bool locked;
+
+    vectorNumber = DATA_TO_VECTOR(nub->_interruptSources[source].vectorData);
+    if (vectorNumber >= (UInt32)_vectorCount)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vector = &vectors[vectorNumber];
+    locked = lockSharedVector(vectorNumber);
+
+    shared = findSharedHandler(vectorNumber, nub, source, &readerSlot);
+    if (0 == shared)
+    {
+        if (locked)
+        {
+            IOLockUnlock(vector->interruptLock);
+        }
+        return super::enableInterrupt(nub, source);
+    }
+
+    shared->enabled = 1;
+
+    // The vector may have been masked while no handler wanted it.
+    if (vector->interruptDisabledHard)
+    {
+        vector->interruptDisabledHard = 0;
+        enableVector(vectorNumber, vector);
+    }
+
+    exitSharedReaders(vectorNumber, readerSlot);
+
+    if (locked)
+    {
+        IOLockUnlock(vector->interruptLock);
+    }
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Disabling a chained handler is lazy, like the superclass soft disable.
+// The vector is only masked by handleInterrupt() once nobody wants it.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::disableInterrupt(IOService *nub, int source)
+{
+    IOInterruptVector *vector;
+    SharedHandler *shared;
+    UInt32 vectorNumber;
+    UInt32 readerSlot;
+    IOReturn result;
+    bool locked;
+
+    vectorNumber = DATA_TO_VECTOR(nub->_interruptSources[source].vectorData);
+    if (vectorNumber >= (UInt32)_vectorCount)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vector = &vectors[vectorNumber];
+    locked = lockSharedVector(vectorNumber);
+
+    shared = findSharedHandler(vectorNumber, nub, source, &readerSlot);
+    if (0 == shared)
+    {
+        if (locked)
+        {
+            IOLockUnlock(vector->interruptLock);
+        }
+
+        // The superclass only waits for handlers run by the top half.
+        result = super::disableInterrupt(nub, source);
+        waitForThreadedInterrupt(vectorNumber);
+        return result;
+    }
+
+    shared->enabled = 0;
+
+    exitSharedReaders(vectorNumber, readerSlot);
+
+    if (locked)
+    {
+        IOLockUnlock(vector->interruptLock);
+    }
+
+    // Like the superclass, make sure the handler is not running on
+    // another CPU once we return, unless called from its own handler.
+    if (!getPlatform()->atInterruptLevel())
+    {
+        while (vector->interruptActive)
+        {
+        }
+    }
+
+    waitForThreadedInterrupt(vectorNumber);
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Check the shareable flag in an interrupt specifier.
+//---------------------------------------------------------------------------
+bool AppleAPIC::vectorIsShareable(IOService *nub, int source)
+{
+    return ((lookupSpecifier(nub, source) & kSpecifierShareable) != 0);
+}
+
+//---------------------------------------------------------------------------
+// Decode the flags of an interrupt specifier into the vector table fields
+// they select, plus our own valid and shareable bits.
+//---------------------------------------------------------------------------
+UInt32 AppleAPIC::decodeSpecifier(OSData *vectorData)
+{
+    UInt32 vectorFlags;
+    UInt32 decoded = kSpecifierValid;
+
+    if (vectorData->getLength() < sizeof(UInt64))
+    {
+        return 0;
+    }
+
+    vectorFlags = DATA_TO_FLAGS(vectorData);
+
+    // Set trigger mode
+    if ((vectorFlags & kInterruptTriggerModeMask) == kInterruptTriggerModeEdge)
+    {
+        decoded |= kRTLOTriggerModeEdge;
+    } else {
+        decoded |= kRTLOTriggerModeLevel;
+    }
+
+    // Set input pin polarity
+    if ((vectorFlags & kInterruptPolarityMask) == kInterruptPolarityHigh)
+    {
+        decoded |= kRTLOInputPolarityHigh;
+    } else {
+        decoded |= kRTLOInputPolarityLow;
+    }
+
+    if ((vectorFlags & kInterruptShareableMask) == kInterruptIsShareable)
+    {
+        decoded |= kSpecifierShareable;
+    }
+
+    return decoded;
+}
+
+//---------------------------------------------------------------------------
+// Each pin remembers the decode of the specifier it was last registered
+// with, keyed by the specifier data itself, which is retained so that its
+// address cannot be reused. A specifier with a different key is decoded
+// on the spot. Lock free: the key is checked again after the decode is
+// read, and is cleared by cacheSpecifier() while the decode changes.
+//---------------------------------------------------------------------------
+UInt32 AppleAPIC::lookupSpecifier(IOService *nub, int source)
+{
+    OSData *vectorData = nub->_interruptSources[source].vectorData;
+    VectorState *state;
+    UInt32 vectorNumber;
+    UInt32 decoded;
+
+    vectorNumber = DATA_TO_VECTOR(vectorData);
+    if (vectorNumber < (UInt32)_vectorCount)
+    {
+        state = &_vectorState[vectorNumber];
+
+        if (state->specifierData == vectorData)
+        {
+            OSMemoryBarrier();
+            decoded = state->specifierDecoded;
+            OSMemoryBarrier();
+
+            if (state->specifierData == vectorData)
+            {
+                return decoded;
+            }
+        }
+    }
+
+    return decodeSpecifier(vectorData);
+}
+
+//---------------------------------------------------------------------------
+// Decode the specifier of the first handler registered on a pin, unless
+// it is the one already cached. Call with _registerLock held.
+//---------------------------------------------------------------------------
+void AppleAPIC::cacheSpecifier(IOService *nub, int source)
+{
+    OSData *vectorData = nub->_interruptSources[source].vectorData;
+    VectorState *state = &_vectorState[DATA_TO_VECTOR(vectorData)];
+    OSData *oldData;
+
+    if (state->specifierData == vectorData)
+    {
+        return;
+    }
+
+    oldData = state->specifierData;
+    state->specifierData = 0;
+    OSMemoryBarrier();
+
+    vectorData->retain();
+    state->specifierDecoded = decodeSpecifier(vectorData);
+    OSMemoryBarrier();
+    state->specifierData = vectorData;
+
+    if (oldData)
+    {
+        oldData->release();
+    }
+}
+
+//---------------------------------------------------------------------------
+// Look up the chained handler for a nub and source. On success the chain
+// walk is left announced in *readerSlot, and the caller must end it with
+// exitSharedReaders() when done with the handler.
+//---------------------------------------------------------------------------
+SharedHandler *AppleAPIC::findSharedHandler(IOInterruptVectorNumber vectorNumber, IOService *nub, int source,
+                                            UInt32 *readerSlot)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    SharedHandler *shared;
+    UInt32 slot;
+
+    if (0 == state->sharedHandlers)
+    {
+        return 0;
+    }
+
+    slot = enterSharedReaders(vectorNumber);
+
+    for (shared = state->sharedHandlers; shared; shared = shared->next)
+    {
+        if ((shared->nub == nub) && (shared->source == source))
+        {
+            *readerSlot = slot;
+            return shared;
+        }
+    }
+
+    exitSharedReaders(vectorNumber, slot);
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Call every enabled chained handler of a vector. Returns true if any of
+// them is enabled, meaning the vector must stay unmasked.
+//---------------------------------------------------------------------------
+bool AppleAPIC::dispatchSharedHandlers(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    SharedHandler *shared;
+    bool enabled = false;
+    UInt32 slot;
+
+    slot = enterSharedReaders(vectorNumber);
+
+    for (shared = state->sharedHandlers; shared; shared = shared->next)
+    {
+        if (shared->enabled)
+        {
+            enabled = true;
+            shared->handler(shared->target, shared->refCon, shared->nub, shared->source);
+        }
+    }
+
+    exitSharedReaders(vectorNumber, slot);
+
+    return enabled;
+}
+
+//---------------------------------------------------------------------------
+bool AppleAPIC::sharedHandlersEnabled(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    SharedHandler *shared;
+    bool enabled = false;
+    UInt32 slot;
+
+    slot = enterSharedReaders(vectorNumber);
+
+    for (shared = state->sharedHandlers; shared; shared = shared->next)
+    {
+        if (shared->enabled)
+        {
+            enabled = true;
+            break;
+        }
+    }
+
+    exitSharedReaders(vectorNumber, slot);
+
+    return enabled;
+}
+
+//---------------------------------------------------------------------------
+// Wait for every CPU walking the chain of a vector to leave it. Any walk
+// that starts later can no longer reach an unlinked handler, so only the
+// walks already counted in the current epoch are waited for. New ones are
+// counted in the other slot, and cannot keep the wait going on a busy
+// vector. Call with _registerLock held, after unlinking.
+//---------------------------------------------------------------------------
+void AppleAPIC::waitForSharedReaders(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    UInt32 slot = state->sharedEpoch & 1;
+
+    OSMemoryBarrier();
+    state->sharedEpoch = slot ^ 1;
+    OSMemoryBarrier();
+
+    while (state->sharedReaders[slot])
+    {
+        IODelay(1);
+    }
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    UInt32 decoded;
+
+    // Get the vector flags assigned by the platform driver, decoded
+    // when the interrupt was registered.
+    decoded = lookupSpecifier(vector->nub, vector->source);
+    if ((decoded & kSpecifierValid) == 0)
+    {
+        return;  // expect trouble soon...
+    }
+
+    // This interrupt vector should be disabled, but the mask bit may
+    // still be flipped by a stray interrupt, so merge the new fields
+    // into the table entry atomically rather than taking the lock.
+    modifyVectorEntryLow(vectorNumber, kSpecifierRTLOMask, decoded & kSpecifierRTLOMask);
+    setVectorMapBit(_vectorModifiedMap, vectorNumber);
+
+    writeVectorEntry(vectorNumber);
+
+    APIC_LOG("IOAPIC-%ld: %s %ld to %s trigger, active %s\n", _vectorBase, __FUNCTION__, vectorNumber,
+             (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel) ? "level" : "edge",
+             (_vectorTable[vectorNumber].l32 & kRTLOInputPolarityLow) ? "low" : "high");
+}
+
+//---------------------------------------------------------------------------
+bool AppleAPIC::vectorCanBeShared(IOInterruptVectorNumber vectorNumber,
+                                  IOInterruptVector *vector)
+{
+    APIC_LOG("IOAPIC-%ld: %s( %ld )\n", _vectorBase, __FUNCTION__, vectorNumber);
+
+    // The interrupt being added is checked by registerInterrupt(),
+    // which knows its nub and source. Check the registered one here.
+    return vectorIsShareable(vector->nub, vector->source);
+}
+
+//---------------------------------------------------------------------------
+IOInterruptAction AppleAPIC::getInterruptHandlerAddress(void)
+{
+    return OSMemberFunctionCast(IOInterruptAction, this, &AppleAPIC::handleInterrupt);
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::disableVectorHard(IOInterruptVectorNumber vectorNumber,
+                                      IOInterruptVector *vector)
+{
+    bool enabled;
+
+    APIC_LOG("IOAPIC-%ld: %s %ld\n", _vectorBase, __FUNCTION__, vectorNumber);
+
+    // The counters are per-CPU, so stay on this CPU while updating.
+    enabled = ml_set_interrupts_enabled(FALSE);
+    getVectorCounters(cpu_number(), vectorNumber)->hardDisabled++;
+    ml_set_interrupts_enabled(enabled);
+
+    disableVectorEntry(vectorNumber);
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::enableVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+{
+    APIC_LOG("IOAPIC-%ld: %s %ld%s\n", _vectorBase, __FUNCTION__, vectorNumber,
+             _vectorState[vectorNumber].stormThrottled ? " (throttled)" : "");
+
+    // A throttled vector is unmasked by the storm timer instead.
+    if (_vectorState[vectorNumber].stormThrottled)
+    {
+        return;
+    }
+
+    enableVectorEntry(vectorNumber);
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::handleInterrupt(void *savedState, IOService *nub, int source)
+{
+    IOInterruptVector *vector;
+    IOInterruptVectorNumber vectorNumber;
+    VectorCounters *counters;
+    LatencyHistogram *latency;
+    UInt64 timestamp;
+    UInt64 entryTime = 0;
+    bool sharedEnabled;
+
+    // Convert the system interrupt to a vector table entry offset.
+    vectorNumber = SYS_TO_PIC_VECTOR(source);
+
+    assert(vectorNumber >= 0);
+    assert(vectorNumber < _vectorCount);
+
+    vector = &vectors[vectorNumber];
+    counters = getVectorCounters(cpu_number(), vectorNumber);
+
+    if (__builtin_expect(_traceEnabled, 0))
+    {
+        entryTime = readTimestamp();
+    }
+
+    vector->interruptActive = 1;
+
+    if ((vector->interruptRegistered) &&
+        ((!vector->interruptDisabledSoft) || (_vectorState[vectorNumber].sharedHandlers)))
+    {
+        counters->delivered++;
+
+        if (_vectorState[vectorNumber].threadCall)
+        {
+            deferInterrupt(vectorNumber);
+        } else {
+            timestamp = readTimestamp();
+            if (!vector->interruptDisabledSoft)
+            {
+                vector->handler(vector->target, vector->refCon, vector->nub, vector->source );
+            }
+
+            sharedEnabled = ((_vectorState[vectorNumber].sharedHandlers) && (dispatchSharedHandlers(vectorNumber)));
+            timestamp = readTimestamp() - timestamp;
+            counters->handlerCycles += timestamp;
+
+            latency = _vectorState[vectorNumber].latency;
+            if (latency)
+            {
+                recordLatency(latency, timestamp);
+            }
+
+            // interruptDisabledSoft flag may be set by the
+            // vector handler to indicate that the interrupt
+            // should now be disabled. Might as well do it
+            // now rather than take another interrupt. Unless
+            // a chained handler still wants the vector.
+            if ((vector->interruptDisabledSoft) && (!sharedEnabled))
+            {
+                vector->interruptDisabledHard = 1;
+
+                counters->softDisabled++;
+                counters->hardDisabled++;
+                disableVectorEntry(vectorNumber);
+            }
+        }
+
+        if (_stormThreshold)
+        {
+            countInterruptStorm(vectorNumber);
+        }
+    } else {
+        vector->interruptDisabledHard = 1;
+
+        // Unregistered vectors mostly share the counters of slot 0,
+        // so their rare hits are counted apart.
+        if (vector->interruptRegistered)
+        {
+            counters->softDisabled++;
+        } else {
+            OSIncrementAtomic((volatile SInt32 *)&_vectorState[vectorNumber].spurious);
+        }
+
+        // The table may already say masked for an entry that was not
+        // restored on wake, so make sure the hardware agrees.
+        counters->hardDisabled++;
+        disableVectorEntry(vectorNumber);
+        writeVectorEntryLow(vectorNumber);
+    }
+
+    if ((_directedEOI) && (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel))
+    {
+        directedEndOfInterrupt(vectorNumber);
+    }
+
+    if (__builtin_expect(entryTime != 0, 0))
+    {
+        traceEvent(kTraceEventInterrupt, vectorNumber, 0, entryTime, readTimestamp());
+    }
+
+    vector->interruptActive = 0;
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Nubs can ask for their interrupt handler to run in a thread instead of
+// in primary interrupt context, so long handlers do not delay every other
+// vector on the CPU. Call with _registerLock held.
+//---------------------------------------------------------------------------
+bool AppleAPIC::startThreadedVector(IOInterruptVectorNumber vectorNumber, IOService *nub)
+{
+    OSObject *obj = nub->getProperty(kThreadedInterruptKey);
+    OSNumber *num = OSDynamicCast(OSNumber, obj);
+
+    if ((obj != kOSBooleanTrue) && ((0 == num) || (0 == num->unsigned32BitValue())))
+    {
+        return true;
+    }
+
+    _vectorState[vectorNumber].threadPending = 0;
+    _vectorState[vectorNumber].threadCall = thread_call_allocate_with_priority(&AppleAPIC::threadedInterruptCall,
+                                                                               this, THREAD_CALL_PRIORITY_HIGH);
+
+    APIC_LOG("IOAPIC-%ld: vector %ld threaded for %s\n", _vectorBase, vectorNumber, nub->getName());
+
+    return (0 != _vectorState[vectorNumber].threadCall);
+}
+
+//---------------------------------------------------------------------------
+// Called once the vector is unregistered and masked, so the worker can no
+// longer be queued. Call with _registerLock held.
+//---------------------------------------------------------------------------
+void AppleAPIC::stopThreadedVector(IOInterruptVectorNumber vectorNumber)
+{
+    thread_call_t call = _vectorState[vectorNumber].threadCall;
+
+    if (call)
+    {
+        _vectorState[vectorNumber].threadCall = 0;
+        thread_call_cancel_wait(call);
+        thread_call_free(call);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Top half of threaded dispatch. A level triggered entry is masked until
+// the worker has run, since the line stays asserted until the device is
+// serviced. Edge triggered entries stay unmasked, and further edges are
+// counted so the worker runs the handlers again.
+//---------------------------------------------------------------------------
+void AppleAPIC::deferInterrupt(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+
+    if (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel)
+    {
+        disableVectorEntry(vectorNumber);
+    }
+
+    if (OSIncrementAtomic(&state->threadPending) == 0)
+    {
+        thread_call_enter1(state->threadCall, (thread_call_param_t)(uintptr_t)vectorNumber);
+    }
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::threadedInterruptCall(thread_call_param_t param0, thread_call_param_t param1)
+{
+    ((AppleAPIC *)param0)->threadedInterrupt((IOInterruptVectorNumber)(uintptr_t)param1);
+}
+
+//---------------------------------------------------------------------------
+// Bottom half of threaded dispatch. Run the handlers until no more
+// interrupts were queued, then unmask a level triggered entry if the
+// vector is still wanted.
+//---------------------------------------------------------------------------
+void AppleAPIC::threadedInterrupt(IOInterruptVectorNumber vectorNumber)
+{
+    IOInterruptVector *vector = &vectors[vectorNumber];
+    VectorState *state = &_vectorState[vectorNumber];
+    SInt32 pending;
+    UInt64 timestamp;
+    bool sharedEnabled;
+    bool enabled;
+
+    do {
+        pending = state->threadPending;
+
+        // The top half owns interruptActive, and may clear it while
+        // the handlers run here.
+        state->threadActive = current_thread();
+        OSMemoryBarrier();
+
+        timestamp = readTimestamp();
+        if ((vector->interruptRegistered) && (!vector->interruptDisabledSoft))
+        {
+            vector->handler(vector->target, vector->refCon, vector->nub, vector->source);
+        }
+
+        sharedEnabled = ((state->sharedHandlers) && (dispatchSharedHandlers(vectorNumber)));
+        timestamp = readTimestamp() - timestamp;
+
+        OSMemoryBarrier();
+        state->threadActive = 0;
+
+        if (state->latency)
+        {
+            recordLatency(state->latency, timestamp);
+        }
+
+        // The counters are per-CPU, so stay on this CPU while updating.
+        enabled = ml_set_interrupts_enabled(FALSE);
+        getVectorCounters(cpu_number(), vectorNumber)->handlerCycles += timestamp;
+        ml_set_interrupts_enabled(enabled);
+    } while (!OSCompareAndSwap(pending, 0, (volatile UInt32 *)&state->threadPending));
+
+    if (0 == (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel))
+    {
+        return;
+    }
+
+    if ((vector->interruptRegistered) && ((!vector->interruptDisabledSoft) || (sharedEnabled)))
+    {
+        if (!state->stormThrottled)
+        {
+            enableVectorEntry(vectorNumber);
+        }
+    } else {
+        // Left masked. Mark it so that enableInterrupt() unmasks it.
+        vector->interruptDisabledHard = 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Wait for the worker of a threaded vector to leave its handlers, like
+// interruptActive is waited on for the top half. Unless called from a
+// handler on the worker itself.
+//---------------------------------------------------------------------------
+void AppleAPIC::waitForThreadedInterrupt(IOInterruptVectorNumber vectorNumber)
+{
+    thread_t worker;
+
+    OSMemoryBarrier();
+
+    while ((worker = _vectorState[vectorNumber].threadActive) && (worker != current_thread()))
+    {
+        IODelay(1);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Clear the Remote IRR bit of a level triggered entry. Writing the vector
+// number to the EOI register does this directly. Older I/O APICs clear it
+// when the entry is switched to edge trigger mode, so briefly do that
+// with the entry masked, then restore the entry from the vector table.
+//---------------------------------------------------------------------------
+void AppleAPIC::directedEndOfInterrupt(IOInterruptVectorNumber vectorNumber)
+{
+    IOInterruptState state;
+    UInt32 l32;
+
+    // The EOI register needs no index, so no lock.
+    if (_apicVersion >= kDirectedEOIMinVersion)
+    {
+        OSIncrementAtomic64(&_eoiWrites);
+        IOAPIC_REG(EOIR) = _vectorTable[vectorNumber].l32 & kRTLOVectorNumberMask;
+        return;
+    }
+
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+
+    l32 = _vectorTable[vectorNumber].l32;
+    writeVectorLowLocked(vectorNumber, (l32 & ~kRTLOTriggerModeMask) | kRTLOTriggerModeEdge | kRTLOMaskDisabled);
+    writeVectorLowLocked(vectorNumber, l32);
+    IOSimpleLockUnlockEnableInterrupt(_apicLock, state);
+}
+
+//---------------------------------------------------------------------------
+// Fill _vectorList with the vectors set in either map, in order.
+//---------------------------------------------------------------------------
+IOInterruptVectorNumber AppleAPIC::collectVectors(const volatile UInt32 *map1, const volatile UInt32 *map2)
+{
+    IOInterruptVectorNumber count = 0;
+    UInt32 bits;
+    UInt32 word = 0;
+
+    for (word = 0; word < _vectorMapWords; word++)
+    {
+        bits = map1[word] | (map2 ? map2[word] : 0);
+
+        while (bits)
+        {
+            _vectorList[count++] = (word * 32) + __builtin_ctz(bits);
+            bits &= (bits - 1);
+        }
+    }
+
+    return count;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::resumeFromSleep(void)
+{
+    SleepWakeRecord *record;
+    IOInterruptVectorNumber count;
+    IOInterruptVectorNumber i;
+    UInt64 accesses = _mmioReads + _mmioWrites;
+    UInt64 time = mach_absolute_time();
+    UInt64 now;
+    UInt64 ns;
+    IOReturn result;
+
+    // A wake without a recorded sleep starts a fresh record.
+    record = &_sleepWakeHistory[_sleepWakeCycles % kSleepWakeHistoryCount];
+    if (!_sleepWakePending)
+    {
+        bzero(record, sizeof(SleepWakeRecord));
+        _sleepWakeAccesses = 0;
+        _sleepWakeAccessesSaved = 0;
+    }
+
+    // [3550539]
+    // Some systems wake up with the PIC interrupt line asserted.
+    // This is bad since we program the LINT0 input on the Local
+    // APIC to ExtINT mode, and unmask the LINT0 vector. And any
+    // unexpected PIC interrupt requests will be serviced. Result
+    // is a hard hang the moment the platform driver enables CPU
+    // interrupt on wake. Avoid this by masking all PIC vectors.
+    outb(kPIC_OCW1(kPIC2BasePort), 0xFF);
+    outb(kPIC_OCW1(kPIC1BasePort), 0xFF);
+
+    now = mach_absolute_time();
+    record->wakePICMask = now - time;
+    time = now;
+
+    // Register contents, and the IND selection, were lost during sleep.
+    invalidateRegisterShadow();
+
+    // Update the identification register containing our APIC ID
+    indexWrite(kIndexID, _apicIDRegister);
+
+    now = mach_absolute_time();
+    record->wakeIDRestore = now - time;
+    time = now;
+
+    // Restore vector entries to their pre-sleep state. With the shadow
+    // invalidated, every entry is first masked to force a de-assertion
+    // on the interrupt line, and only then programmed and unmasked.
+    // Entries that were never modified come out of reset masked, and
+    // stay dirty until they are first written.
+    count = collectVectors(_vectorEnabledMap, _vectorModifiedMap);
+    for (i = 0; i < count; i++)
+    {
+        _vectorScratch[i] = _vectorTable[_vectorList[i]];
+    }
+
+    result = writeVectorEntries(_vectorScratch, _vectorList, count);
+
+    record->wakeEntries = mach_absolute_time() - time;
+    record->wakeEntryCount = count;
+
+    // Each entry skipped would have cost three IND/DAT write pairs.
+    _sleepWakeAccesses += (_mmioReads + _mmioWrites) - accesses;
+    _sleepWakeAccessesSaved += (_vectorCount - count) * 6;
+
+    _lastSleepWakeAccesses = _sleepWakeAccesses;
+    _lastSleepWakeAccessesSaved = _sleepWakeAccessesSaved;
+    _lastSleepWakeMicrosecondsSaved = 0;
+
+    if (_sleepWakeAccesses)
+    {
+        absolutetime_to_nanoseconds(record->sleepMask + record->wakePICMask +
+                                    record->wakeIDRestore + record->wakeEntries, &ns);
+        _lastSleepWakeMicrosecondsSaved = (ns * _sleepWakeAccessesSaved) / (_sleepWakeAccesses * 1000);
+    }
+
+    _sleepWakePending = false;
+    _sleepWakeCycles++;
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::prepareForSleep(void)
+{
+    SleepWakeRecord *record;
+    IOInterruptVectorNumber count;
+    IOInterruptVectorNumber i;
+    UInt64 accesses = _mmioReads + _mmioWrites;
+    UInt64 time = mach_absolute_time();
+    IOReturn result;
+
+    record = &_sleepWakeHistory[_sleepWakeCycles % kSleepWakeHistoryCount];
+    bzero(record, sizeof(SleepWakeRecord));
+    record->sleepStart = time;
+    _sleepWakePending = true;
+
+    // Mask all interrupts before platform sleep. Only the unmasked
+    // entries need to be written.
+    count = collectVectors(_vectorEnabledMap, 0);
+    for (i = 0; i < count; i++)
+    {
+        _vectorScratch[i] = _vectorTable[_vectorList[i]];
+        _vectorScratch[i].l32 |= kRTLOMaskDisabled;
+    }
+
+    result = writeVectorEntries(_vectorScratch, _vectorList, count);
+
+    record->sleepMask = mach_absolute_time() - time;
+    record->sleepEntryCount = count;
+
+    // Each entry skipped would have cost a masking IND/DAT write pair.
+    _sleepWakeAccesses = (_mmioReads + _mmioWrites) - accesses;
+    _sleepWakeAccessesSaved = (_vectorCount - count) * 2;
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::prepareForDeepIdle(UInt32 vectorNumber)
+{
+    IOReturn result = kIOReturnBadArgument;
+
+    SleepWakeRecord *record;
+    UInt64 time = mach_absolute_time();
+
+    // Unmask through the vector table so that it keeps matching the
+    // hardware, and a later disable is not skipped as redundant.
+    if ((_vectorTable) && (vectorNumber < (UInt32)_vectorCount))
+    {
+        result = enableVectorEntry(vectorNumber);
+    }
+
+    if (_sleepWakePending)
+    {
+        record = &_sleepWakeHistory[_sleepWakeCycles % kSleepWakeHistoryCount];
+        record->deepIdle += mach_absolute_time() - time;
+        record->deepIdleCount++;
+    }
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::setVectorPhysicalDestination(UInt32 vectorNumber,
+												 UInt32 apicID)
+{
+	IOInterruptVectorNumber target = vectorNumber;
+	UInt32 maxAPICID;
+
+    APIC_LOG("IOAPIC-%d: %s( %d, %d )\n", (uint32_t) _vectorBase, __FUNCTION__, (uint32_t) vectorNumber, (uint32_t) apicID);
+
+	maxAPICID = maxDestination(true);
+
+	if ((vectorNumber >= (UInt32)_vectorCount) || (apicID > maxAPICID))
+    {
+		return kIOReturnBadArgument;
+    }
+
+	if (__builtin_expect(_traceEnabled, 0))
+	{
+		traceEvent(kTraceEventRetarget, vectorNumber, apicID, readTimestamp(), 0);
+	}
+
+	// Only the destination changes, the vector keeps its delivery mode.
+	setVectorRouting(vectorNumber, apicID,
+	                 (_vectorState[vectorNumber].routingModes & kRTLODeliveryModeMask) |
+	                 kRTLODestinationModePhysical);
+
+	// The batch write masks the entry while the destination changes,
+	// and restores the mask state it had before the call.
+	return writeVectorEntries(&_vectorTable[vectorNumber], &target, 1);
+}
+
+//---------------------------------------------------------------------------
+// Route a vector to a logical destination, a flat model bit mask or a
+// cluster model ID and mask depending on how the local APICs are set up.
+// With lowest priority delivery, the hardware arbitrates between the
+// CPUs in the destination instead of interrupting all of them.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::setVectorLogicalDestination(UInt32 vectorNumber,
+                                                UInt32 destination,
+                                                bool lowestPriority)
+{
+    IOInterruptVectorNumber target = vectorNumber;
+
+    APIC_LOG("IOAPIC-%d: %s( %d, %02x, %d )\n", (uint32_t)_vectorBase, __FUNCTION__, (uint32_t)vectorNumber,
+             (uint32_t)destination, lowestPriority);
+
+    if ((vectorNumber >= (UInt32)_vectorCount) || (destination > maxDestination(false)))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    setVectorRouting(vectorNumber, destination,
+                     (lowestPriority ? kRTLODeliveryModeLowestPriority : kRTLODeliveryModeFixed) |
+                     kRTLODestinationModeLogical);
+
+    return writeVectorEntries(&_vectorTable[vectorNumber], &target, 1);
+}
+
+//---------------------------------------------------------------------------
+// The largest destination a vector can be routed to. Only x2APIC mode
+// remapping takes a full 32-bit destination, xAPIC mode remapping and
+// logical destinations in compatibility format are limited to 8 bits.
+//---------------------------------------------------------------------------
+UInt32 AppleAPIC::maxDestination(bool physical)
+{
+    if (_remapEntries)
+    {
+        return _remapX2APIC ? 0xFFFFFFFF : (UInt32)kMaxAPICID;
+    }
+
+    if ((physical) && (_extendedDestinationID))
+    {
+        return kMaxExtendedAPICID;
+    }
+
+    return kMaxAPICID;
+}
+
+//---------------------------------------------------------------------------
+// Record the routing of a vector, and encode it in the vector table entry.
+// In compatibility format the destination and modes go in the entry, with
+// APIC ID bits 14:8 in the extended destination ID field if supported. In
+// remappable format the entry only holds the interrupt index, and the
+// routing is written to the remapping table by updateRemapEntry().
+//---------------------------------------------------------------------------
+void AppleAPIC::setVectorRouting(IOInterruptVectorNumber vectorNumber, UInt32 destination, UInt32 routingModes)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    UInt32 index;
+    UInt32 h32;
+
+    state->destination = destination;
+    state->routingModes = routingModes;
+    setVectorMapBit(_vectorModifiedMap, vectorNumber);
+
+    if (_remapEntries)
+    {
+        index = _remapIndexBase + vectorNumber;
+        h32 = (kRTHIInterruptFormatRemappable |
+               ((index << kRTHIInterruptIndexShift) & kRTHIInterruptIndexMask));
+        modifyVectorEntryLow(vectorNumber, kRTLODeliveryModeMask | kRTLODestinationModeMask,
+                             (index & 0x8000) ? (UInt32)kRTLOInterruptIndex15Mask : 0);
+    } else {
+        h32 = ((destination << kRTHIDestinationShift) & kRTHIDestinationMask);
+        if (_extendedDestinationID)
+        {
+            h32 |= (((destination >> 8) << kRTHIExtendedAPICIDShift) & kRTHIExtendedAPICIDMask);
+        }
+        modifyVectorEntryLow(vectorNumber, kRTLODeliveryModeMask | kRTLODestinationModeMask, routingModes);
+    }
+
+    _vectorTable[vectorNumber].h32 = h32;
+}
+
+//---------------------------------------------------------------------------
+// Bring the remapping table entry of a vector up to date with its routing
+// and the trigger mode and vector in the vector table. Called with the
+// redirection entry masked, and _apicLock held. The remapping hardware
+// may hold a cached copy of the entry, so every change is followed by a
+// call to the invalidation function of the remapping hardware driver.
+//---------------------------------------------------------------------------
+void AppleAPIC::updateRemapEntry(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    RemapEntry *entry;
+    UInt32 destination;
+    UInt32 l32;
+
+    if (0 == _remapEntries)
+    {
+        return;
+    }
+
+    entry = &_remapEntries[vectorNumber];
+
+    l32 = (kIRTEPresent |
+           ((_vectorTable[vectorNumber].l32 & kRTLOVectorNumberMask) << kIRTEVectorShift) |
+           (GET_FIELD(state->routingModes, kRTLODeliveryMode) << kIRTEDeliveryModeShift));
+
+    if ((state->routingModes & kRTLODestinationModeMask) == kRTLODestinationModeLogical)
+    {
+        l32 |= kIRTEDestinationModeLogical;
+    }
+
+    if ((state->routingModes & kRTLODeliveryModeMask) == kRTLODeliveryModeLowestPriority)
+    {
+        l32 |= kIRTERedirectionHint;
+    }
+
+    if (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel)
+    {
+        l32 |= kIRTETriggerModeLevel;
+    }
+
+    destination = state->destination;
+    if (!_remapX2APIC)
+    {
+        destination <<= kIRTEDestinationXAPICShift;
+    }
+
+    if ((entry->l32 == l32) && (entry->destination == destination))
+    {
+        return;
+    }
+
+    entry->destination = destination;
+    entry->sourceID = 0;
+    OSMemoryBarrier();
+    entry->l32 = l32;
+
+    if (_remapInvalidate)
+    {
+        _remapInvalidate(_remapInvalidateRefCon, _remapIndexBase + vectorNumber);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Interrupt remapping is used when the platform assigns this I/O APIC a
+// range of indices in the system remapping table. The entries for our
+// pins are kept in a physically contiguous table that the platform gets
+// through the GetInterruptRemapTable platform function.
+//---------------------------------------------------------------------------
+bool AppleAPIC::startInterruptRemapping(IOService *provider)
+{
+    OSNumber *num;
+
+    num = OSDynamicCast(OSNumber, provider->getProperty(kInterruptRemapIndexKey));
+    if (0 == num)
+    {
+        return true;
+    }
+
+    _remapIndexBase = num->unsigned32BitValue();
+    if ((_remapIndexBase + _vectorCount - 1) > kMaxRemapIndex)
+    {
+        return false;
+    }
+
+    _remapTable = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryPhysicallyContiguous,
+                                                        sizeof(RemapEntry) * _vectorCount, PAGE_SIZE);
+    if (0 == _remapTable)
+    {
+        return false;
+    }
+
+    _remapEntries = (RemapEntry *)_remapTable->getBytesNoCopy();
+    bzero(_remapEntries, sizeof(RemapEntry) * _vectorCount);
+
+    // The remapping hardware decodes destinations the way the local
+    // APICs are addressed, which only the platform knows.
+    _remapX2APIC = (0 != getTunable(provider, kInterruptRemapX2APICKey, 0));
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Hand the remapping table to the remapping hardware driver, and take its
+// interrupt entry cache invalidation function in return. The function is
+// swapped under _apicLock, so no update sees half of it.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::getInterruptRemapTable(IOBufferMemoryDescriptor **table, UInt32 *indexBase,
+                                           APICRemapInvalidateFunction invalidate, void *refCon)
+{
+    IOInterruptState state;
+
+    if ((0 == _remapTable) || (0 == table) || (0 == indexBase))
+    {
+        return kIOReturnUnsupported;
+    }
+
+    state = IOSimpleLockLockDisableInterrupt(_apicLock);
+    _remapInvalidate = invalidate;
+    _remapInvalidateRefCon = refCon;
+    IOSimpleLockUnlockEnableInterrupt(_apicLock, state);
+
+    _remapTable->retain();
+    *table = _remapTable;
+    *indexBase = _remapIndexBase;
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Read a tunable, giving the provider precedence over the personality.
+//---------------------------------------------------------------------------
+UInt32 AppleAPIC::getTunable(IOService *provider, const char *key, UInt32 defaultValue)
+{
+    OSNumber *num;
+
+    num = OSDynamicCast(OSNumber, provider->getProperty(key));
+    if (0 == num)
+    {
+        num = OSDynamicCast(OSNumber, getProperty(key));
+    }
+
+    return num ? num->unsigned32BitValue() : defaultValue;
+}
+
+//---------------------------------------------------------------------------
+// The balancer is only started when the platform supplies the list of
+// destination APIC IDs, and a non-zero interval is configured.
+//---------------------------------------------------------------------------
+bool AppleAPIC::startBalancer(IOService *provider)
+{
+    OSArray *array;
+    OSNumber *num;
+    UInt32 i = 0;
+
+    _balancerInterval = getTunable(provider, kBalancerIntervalKey, kDefaultBalancerInterval);
+    _balancerThreshold = getTunable(provider, kBalancerThresholdKey, kDefaultBalancerThreshold);
+    _balancerHoldOff = getTunable(provider, kBalancerHoldOffKey, kDefaultBalancerHoldOff);
+
+    array = OSDynamicCast(OSArray, provider->getProperty(kBalancerAPICIDsKey));
+    if ((0 == _balancerInterval) || (0 == array) || (array->getCount() < 2))
+    {
+        return true;
+    }
+
+    _balancerCPUCount = array->getCount();
+    _balancerAPICIDs = IONew(UInt32, _balancerCPUCount);
+    _balancerLoad = IONew(UInt64, _balancerCPUCount);
+    if ((0 == _balancerAPICIDs) || (0 == _balancerLoad))
+    {
+        return false;
+    }
+
+    for (i = 0; i < _balancerCPUCount; i++)
+    {
+        num = OSDynamicCast(OSNumber, array->getObject(i));
+        if (0 == num)
+        {
+            return false;
+        }
+
+        _balancerAPICIDs[i] = num->unsigned32BitValue();
+    }
+
+    _balancerCall = thread_call_allocate(&AppleAPIC::balancerTimer, this);
+    if (0 == _balancerCall)
+    {
+        return false;
+    }
+
+    APIC_LOG("IOAPIC-%ld: balancing across %d CPUs every %d ms\n", _vectorBase,
+             (uint32_t)_balancerCPUCount, (uint32_t)_balancerInterval);
+
+    balancerTimer(this, 0);
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::balancerTimer(thread_call_param_t param0, thread_call_param_t param1)
+{
+    AppleAPIC *apic = (AppleAPIC *)param0;
+    UInt64 deadline;
+
+    if (param1)
+    {
+        apic->sampleVectorRates();
+        apic->balanceVectors();
+    }
+
+    if (0 == apic->_balancerInterval)
+    {
+        return;
+    }
+
+    clock_interval_to_deadline(apic->_balancerInterval, kMillisecondScale, &deadline);
+    thread_call_enter1_delayed(apic->_balancerCall, (thread_call_param_t)1, deadline);
+}
+
+//---------------------------------------------------------------------------
+// The storm detector is disabled unless the platform configures a
+// threshold.
+//---------------------------------------------------------------------------
+bool AppleAPIC::startStormDetector(IOService *provider)
+{
+    _stormThreshold = getTunable(provider, kStormThresholdKey, kDefaultStormThreshold);
+    if (0 == _stormThreshold)
+    {
+        return true;
+    }
+
+    nanoseconds_to_absolutetime((UInt64)getTunable(provider, kStormWindowKey, kDefaultStormWindow) * kMillisecondScale,
+                                &_stormWindow);
+    nanoseconds_to_absolutetime((UInt64)getTunable(provider, kStormBackoffKey, kDefaultStormBackoff) * kMillisecondScale,
+                                &_stormBackoff);
+
+    _stormCall = thread_call_allocate(&AppleAPIC::stormTimer, this);
+
+    return (0 != _stormCall);
+}
+
+//---------------------------------------------------------------------------
+// Count an interrupt towards the storm threshold. The vector may fire on
+// several CPUs at once, so the count is atomic, and only the CPU that
+// takes it from the threshold back to zero checks for a storm. If a later
+// interrupt got in first, its CPU does instead.
+//---------------------------------------------------------------------------
+void AppleAPIC::countInterruptStorm(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    UInt32 count;
+
+    count = OSIncrementAtomic((volatile SInt32 *)&state->stormCount) + 1;
+    if ((count >= _stormThreshold) && (OSCompareAndSwap(count, 0, &state->stormCount)))
+    {
+        checkInterruptStorm(vectorNumber);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Called from handleInterrupt() each time a vector reaches the threshold
+// count. If that took less than the storm window, mask the vector until
+// the backoff time expires, doubling the backoff for repeat offenders.
+//---------------------------------------------------------------------------
+void AppleAPIC::checkInterruptStorm(IOInterruptVectorNumber vectorNumber)
+{
+    VectorState *state = &_vectorState[vectorNumber];
+    UInt64 now = mach_absolute_time();
+
+    if ((now - state->stormWindowStart) >= _stormWindow)
+    {
+        state->stormWindowStart = now;
+        state->stormBackoffShift = 0;
+        return;
+    }
+
+    state->stormWindowStart = now;
+    state->stormReleaseTime = now + (_stormBackoff << state->stormBackoffShift);
+    if (state->stormBackoffShift < kMaxStormBackoffShift)
+    {
+        state->stormBackoffShift++;
+    }
+
+    state->stormThrottled = 1;
+    getVectorCounters(cpu_number(), vectorNumber)->hardDisabled++;
+    disableVectorEntry(vectorNumber);
+
+    armStormTimer(state->stormReleaseTime);
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::armStormTimer(UInt64 deadline)
+{
+    if (OSCompareAndSwap(0, 1, &_stormCallArmed))
+    {
+        thread_call_enter_delayed(_stormCall, deadline);
+    }
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::stormTimer(thread_call_param_t param0, thread_call_param_t param1)
+{
+    ((AppleAPIC *)param0)->releaseStormVectors();
+}
+
+//---------------------------------------------------------------------------
+// Unmask the throttled vectors whose backoff expired, if their drivers
+// still want them enabled, and log each offender once.
+//---------------------------------------------------------------------------
+void AppleAPIC::releaseStormVectors(void)
+{
+    IOInterruptVector *vector;
+    VectorState *state;
+    UInt64 now = mach_absolute_time();
+    UInt64 deadline = 0;
+    int vectorNumber = 0;
+
+    _stormCallArmed = 0;
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        state = &_vectorState[vectorNumber];
+        vector = &vectors[vectorNumber];
+
+        if (!state->stormThrottled)
+        {
+            continue;
+        }
+
+        if (!state->stormReported)
+        {
+            state->stormReported = 1;
+
+            if (vector->interruptLock)
+            {
+                IOLockLock(vector->interruptLock);
+                IOLog("IOAPIC-%d: interrupt storm on vector %d (%s), throttling\n",
+                      (uint32_t)_vectorBase, (uint32_t)PIC_TO_SYS_VECTOR(vectorNumber),
+                      ((vector->interruptRegistered) && (vector->nub)) ? vector->nub->getName() : "unregistered");
+                IOLockUnlock(vector->interruptLock);
+            } else {
+                IOLog("IOAPIC-%d: interrupt storm on vector %d (unregistered), throttling\n",
+                      (uint32_t)_vectorBase, (uint32_t)PIC_TO_SYS_VECTOR(vectorNumber));
+            }
+        }
+
+        if (now < state->stormReleaseTime)
+        {
+            if ((0 == deadline) || (state->stormReleaseTime < deadline))
+            {
+                deadline = state->stormReleaseTime;
+            }
+            continue;
+        }
+
+        state->stormThrottled = 0;
+
+        if ((vector->interruptRegistered) && (!vector->interruptDisabledHard) &&
+            ((!vector->interruptDisabledSoft) || (sharedHandlersEnabled(vectorNumber))))
+        {
+            enableVectorEntry(vectorNumber);
+        }
+    }
+
+    if ((deadline) && (_stormThreshold))
+    {
+        armStormTimer(deadline);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Give a vector its own counters, from the next free slot, allocating a
+// slab when the last one is full. Call with _registerLock held. The
+// slab is published before the slot, so that the interrupt path, which
+// reads them without a lock, never sees a slot without its slab.
+//---------------------------------------------------------------------------
+bool AppleAPIC::allocateVectorCounters(IOInterruptVectorNumber vectorNumber)
+{
+    UInt32 slot = _counterSlotsUsed;
+    UInt8 *slab;
+
+    if (_counterSlot[vectorNumber])
+    {
+        return true;
+    }
+
+    if (0 == _counterSlabs[slot >> kCounterSlabShift])
+    {
+        slab = (UInt8 *)IOMallocAligned(_cpuCount * _cpuCounterStride, kCacheLineSize);
+        if (0 == slab)
+        {
+            return false;
+        }
+
+        bzero(slab, _cpuCount * _cpuCounterStride);
+        OSMemoryBarrier();
+        _counterSlabs[slot >> kCounterSlabShift] = slab;
+    }
+
+    OSMemoryBarrier();
+    _counterSlot[vectorNumber] = slot;
+    _counterSlotsUsed++;
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Total the counters of a vector across all CPUs. Counters are read
+// without synchronization, so the totals may lag by a few interrupts.
+// The counters of slot 0 are shared, and not the vector's.
+//---------------------------------------------------------------------------
+void AppleAPIC::sumVectorCounters(IOInterruptVectorNumber vectorNumber, VectorCounters *total)
+{
+    VectorCounters *counters;
+    UInt32 cpu = 0;
+
+    bzero(total, sizeof(VectorCounters));
+    total->spurious = _vectorState[vectorNumber].spurious;
+
+    if (0 == _counterSlot[vectorNumber])
+    {
+        return;
+    }
+
+    for (cpu = 0; cpu < _cpuCount; cpu++)
+    {
+        counters = getVectorCounters(cpu, vectorNumber);
+        total->delivered += counters->delivered;
+        total->softDisabled += counters->softDisabled;
+        total->hardDisabled += counters->hardDisabled;
+        total->handlerCycles += counters->handlerCycles;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Convert the interrupt counts since the previous sample into rates.
+//---------------------------------------------------------------------------
+void AppleAPIC::sampleVectorRates(void)
+{
+    VectorState *state;
+    VectorCounters total;
+    int vectorNumber = 0;
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        state = &_vectorState[vectorNumber];
+        sumVectorCounters(vectorNumber, &total);
+        state->rate = (UInt32)(total.delivered - state->sampledCount);
+        state->sampledCount = total.delivered;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Make one balancing decision from the sampled rates. At most a single
+// vector is moved per period, and only if doing so reduces the imbalance
+// between the busiest and least busy destinations. A moved vector is then
+// pinned for a number of periods, so vectors do not bounce between CPUs.
+//---------------------------------------------------------------------------
+void AppleAPIC::balanceVectors(void)
+{
+    VectorState *state;
+    UInt32 destination;
+    UInt32 busiest = 0;
+    UInt32 idlest = 0;
+    UInt64 imbalance;
+    UInt32 i = 0;
+    int vectorNumber = 0;
+    int candidate = -1;
+
+    for (i = 0; i < _balancerCPUCount; i++)
+    {
+        _balancerLoad[i] = 0;
+    }
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        state = &_vectorState[vectorNumber];
+        if (state->holdOff)
+        {
+            state->holdOff--;
+        }
+
+        // Logical destinations are spread by the hardware.
+        if ((state->routingModes & kRTLODestinationModeMask) == kRTLODestinationModeLogical)
+        {
+            continue;
+        }
+
+        destination = state->destination;
+        for (i = 0; i < _balancerCPUCount; i++)
+        {
+            if (_balancerAPICIDs[i] == destination)
+            {
+                _balancerLoad[i] += state->rate;
+                break;
+            }
+        }
+    }
+
+    for (i = 1; i < _balancerCPUCount; i++)
+    {
+        if (_balancerLoad[i] > _balancerLoad[busiest])
+        {
+            busiest = i;
+        }
+        if (_balancerLoad[i] < _balancerLoad[idlest])
+        {
+            idlest = i;
+        }
+    }
+
+    // Hysteresis, leave small imbalances alone.
+    imbalance = _balancerLoad[busiest] - _balancerLoad[idlest];
+    if ((imbalance == 0) || ((imbalance * 100) <= (_balancerLoad[busiest] * _balancerThreshold)))
+    {
+        return;
+    }
+
+    // Pick the hottest vector on the busiest CPU that is not pinned,
+    // and whose move would not simply swap the two CPUs' roles.
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        state = &_vectorState[vectorNumber];
+        destination = state->destination;
+
+        if ((destination != _balancerAPICIDs[busiest]) || (state->holdOff) ||
+            ((state->routingModes & kRTLODestinationModeMask) == kRTLODestinationModeLogical) ||
+            (!vectors[vectorNumber].interruptRegistered) ||
+            (state->rate == 0) || (state->rate >= imbalance))
+        {
+            continue;
+        }
+
+        if ((candidate < 0) || (state->rate > _vectorState[candidate].rate))
+        {
+            candidate = vectorNumber;
+        }
+    }
+
+    if (candidate >= 0)
+    {
+        APIC_LOG("IOAPIC-%ld: balancer moving vector %d (rate %d) to APIC %d\n", _vectorBase,
+                 candidate, (uint32_t)_vectorState[candidate].rate, (uint32_t)_balancerAPICIDs[idlest]);
+
+        _vectorState[candidate].holdOff = _balancerHoldOff;
+        setVectorPhysicalDestination(candidate, _balancerAPICIDs[idlest]);
+    }
+}
+
+//---------------------------------------------------------------------------
+void AppleAPIC::publishStatistics(void)
+{
+    IOInterruptVector *vector;
+    VectorCounters total;
+    OSArray *statistics;
+    OSArray *perCPU;
+    OSDictionary *dict;
+    OSNumber *num;
+    UInt32 cpu = 0;
+    int vectorNumber = 0;
+
+    setProperty(kMMIOReadCountKey, _mmioReads, 64);
+    setProperty(kMMIOWriteCountKey, _mmioWrites + _eoiWrites, 64);
+    setProperty(kMMIOWritesSavedKey, _mmioWritesSaved, 64);
+    setProperty(kSleepWakeMMIOAccessesKey, _lastSleepWakeAccesses, 64);
+    setProperty(kSleepWakeMMIOSavedKey, _lastSleepWakeAccessesSaved, 64);
+    setProperty(kSleepWakeMicrosecondsSavedKey, _lastSleepWakeMicrosecondsSaved, 64);
+    setProperty(kLatencyRecordCyclesKey, _latencyRecordCycles, 64);
+    setProperty(kVectorLocksAllocatedKey, _vectorLocksAllocated, 32);
+
+    statistics = OSArray::withCapacity(_vectorCount);
+    if (0 == statistics)
+    {
+        return;
+    }
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        vector = &vectors[vectorNumber];
+        sumVectorCounters(vectorNumber, &total);
+
+        if ((!vector->interruptRegistered) && (total.spurious == 0))
+        {
+            continue;
+        }
+
+        dict = OSDictionary::withCapacity(8);
+        perCPU = OSArray::withCapacity(_cpuCount);
+        if ((0 == dict) || (0 == perCPU))
+        {
+            if (dict) dict->release();
+            if (perCPU) perCPU->release();
+            break;
+        }
+
+        // The lock keeps the nub from being unregistered while we
+        // look up its name. Vectors never registered have no lock.
+        if (vector->interruptLock)
+        {
+            IOLockLock(vector->interruptLock);
+            if ((vector->interruptRegistered) && (vector->nub))
+            {
+                OSString *name = OSString::withCString(vector->nub->getName());
+                if (name)
+                {
+                    dict->setObject(kStatisticsNubKey, name);
+                    name->release();
+                }
+            }
+            IOLockUnlock(vector->interruptLock);
+        }
+
+#define SET_STATISTIC(key, value)                       \
+        num = OSNumber::withNumber((value), 64);        \
+        if (num)                                        \
+        {                                               \
+            dict->setObject(key, num);                  \
+            num->release();                             \
+        }
+
+        SET_STATISTIC(kStatisticsVectorKey, PIC_TO_SYS_VECTOR(vectorNumber));
+        SET_STATISTIC(kStatisticsDeliveredKey, total.delivered);
+        SET_STATISTIC(kStatisticsSpuriousKey, total.spurious);
+        SET_STATISTIC(kStatisticsSoftDisabledKey, total.softDisabled);
+        SET_STATISTIC(kStatisticsHardDisabledKey, total.hardDisabled);
+        SET_STATISTIC(kStatisticsHandlerCyclesKey, total.handlerCycles);
+#undef SET_STATISTIC
+
+        publishLatency(vectorNumber, dict);
+
+        for (cpu = 0; cpu < _cpuCount; cpu++)
+        {
+            num = OSNumber::withNumber(getVectorCounters(cpu, vectorNumber)->delivered, 64);
+            if (num)
+            {
+                perCPU->setObject(num);
+                num->release();
+            }
+        }
+
+        dict->setObject(kStatisticsPerCPUDeliveredKey, perCPU);
+        perCPU->release();
+
+        statistics->setObject(dict);
+        dict->release();
+    }
+
+    setProperty(kInterruptStatisticsKey, statistics);
+    statistics->release();
+}
+
+//---------------------------------------------------------------------------
+// Give a newly registered vector a handler time histogram. A vector that
+// is registered again keeps its histogram. Call with _registerLock held.
+//---------------------------------------------------------------------------
+void AppleAPIC::allocateLatencyHistogram(IOInterruptVectorNumber vectorNumber)
+{
+    LatencyHistogram *histogram;
+
+    if ((!_latencyEnabled) || (_vectorState[vectorNumber].latency))
+    {
+        return;
+    }
+
+    // Without memory the vector simply goes unmeasured.
+    histogram = IONew(LatencyHistogram, 1);
+    if (0 == histogram)
+    {
+        APIC_LOG("IOAPIC-%ld: no memory for vector %ld latency\n", _vectorBase, vectorNumber);
+        return;
+    }
+
+    bzero(histogram, sizeof(LatencyHistogram));
+    OSMemoryBarrier();
+    _vectorState[vectorNumber].latency = histogram;
+}
+
+//---------------------------------------------------------------------------
+// Measure what recordLatency() adds to an interrupt, by recording into a
+// scratch histogram with spread out times, so the cost is published next
+// to the histograms it applies to.
+//---------------------------------------------------------------------------
+void AppleAPIC::measureLatencyRecording(void)
+{
+    LatencyHistogram *histogram;
+    UInt64 timestamp;
+    UInt32 i;
+    enum { kRecordCount = 1024 };
+
+    histogram = IONew(LatencyHistogram, 1);
+    if (0 == histogram)
+    {
+        return;
+    }
+
+    bzero(histogram, sizeof(LatencyHistogram));
+
+    timestamp = readTimestamp();
+    for (i = 0; i < kRecordCount; i++)
+    {
+        recordLatency(histogram, ((UInt64)i * 2654435761U) >> (i & 31));
+    }
+    timestamp = readTimestamp() - timestamp;
+
+    _latencyRecordCycles = timestamp / kRecordCount;
+
+    IODelete(histogram, LatencyHistogram, 1);
+}
+
+//---------------------------------------------------------------------------
+// Empty every histogram. Handlers recording at the same time may have
+// their time counted either side of the reset.
+//---------------------------------------------------------------------------
+void AppleAPIC::resetLatencyHistograms(void)
+{
+    LatencyHistogram *histogram;
+    IOInterruptVectorNumber vectorNumber;
+    UInt32 bucket;
+
+    for (vectorNumber = 0; vectorNumber < (IOInterruptVectorNumber)_vectorCount; vectorNumber++)
+    {
+        histogram = _vectorState[vectorNumber].latency;
+        if (0 == histogram)
+        {
+            continue;
+        }
+
+        for (bucket = 0; bucket < kLatencyBucketCount; bucket++)
+        {
+            histogram->buckets[bucket] = 0;
+        }
+
+        histogram->maximum = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Add the handler time percentiles of a vector to its statistics. Each
+// percentile is the largest time in the bucket it falls into, so it is
+// never under the true value by more than the bucket width.
+//---------------------------------------------------------------------------
+void AppleAPIC::publishLatency(IOInterruptVectorNumber vectorNumber, OSDictionary *dict)
+{
+    LatencyHistogram *histogram = _vectorState[vectorNumber].latency;
+    OSDictionary *latency;
+    OSNumber *num;
+    UInt64 count = 0;
+    UInt64 seen = 0;
+    UInt64 maximum;
+    UInt64 percentiles[3];
+    UInt64 targets[3];
+    UInt32 bucket;
+    UInt32 next = 0;
+    static const char *keys[3] = { kLatencyP50Key, kLatencyP99Key, kLatencyP999Key };
+    static const UInt32 permille[3] = { 500, 990, 999 };
+
+    if (0 == histogram)
+    {
+        return;
+    }
+
+    for (bucket = 0; bucket < kLatencyBucketCount; bucket++)
+    {
+        count += histogram->buckets[bucket];
+    }
+
+    if (0 == count)
+    {
+        return;
+    }
+
+    // Buckets keep counting while we walk them, so percentiles not
+    // reached by the end fall back to the maximum.
+    maximum = histogram->maximum;
+    for (next = 0; next < 3; next++)
+    {
+        targets[next] = ((count * permille[next]) + 999) / 1000;
+        percentiles[next] = maximum;
+    }
+
+    for (bucket = 0, next = 0; (bucket < kLatencyBucketCount) && (next < 3); bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        while ((next < 3) && (seen >= targets[next]))
+        {
+            percentiles[next++] = latencyBucketLimit(bucket);
+        }
+    }
+
+    latency = OSDictionary::withCapacity(5);
+    if (0 == latency)
+    {
+        return;
+    }
+
+#define SET_LATENCY(key, value)                         \
+    num = OSNumber::withNumber((value), 64);            \
+    if (num)                                            \
+    {                                                   \
+        latency->setObject(key, num);                   \
+        num->release();                                 \
+    }
+
+    SET_LATENCY(kLatencyCountKey, count);
+    for (next = 0; next < 3; next++)
+    {
+        SET_LATENCY(keys[next], (percentiles[next] < maximum) ? percentiles[next] : maximum);
+    }
+    SET_LATENCY(kLatencyMaxKey, maximum);
+#undef SET_LATENCY
+
+    dict->setObject(kStatisticsLatencyKey, latency);
+    latency->release();
+}
+
+//---------------------------------------------------------------------------
+// Allocate the statistics region shared with user clients. It holds a
+// header, the statistics of every vector, and the number of interrupts
+// delivered to each CPU, each part cache line aligned.
+//---------------------------------------------------------------------------
+bool AppleAPIC::startStatisticsExport(IOService *provider)
+{
+    UInt32 vectorOffset;
+    UInt32 cpuOffset;
+    UInt32 size;
+
+    // Monitoring tools must not be able to keep a CPU busy updating.
+    _statsInterval = getTunable(provider, kStatisticsIntervalKey, kDefaultStatisticsInterval);
+    if (_statsInterval < kMinStatisticsInterval)
     {
-        return kIOReturnBadArgument;
+        _statsInterval = kMinStatisticsInterval;
     }
-  
-    interruptSources = nub->_interruptSources;
-    vectorData = interruptSources[source].vectorData;
 
-    if (vectorData->getLength() < sizeof(UInt64))
+    vectorOffset = (sizeof(APICStatistics) + (kCacheLineSize - 1)) & ~(kCacheLineSize - 1);
+    cpuOffset = (vectorOffset + (sizeof(APICVectorStatistics) * _vectorCount) + (kCacheLineSize - 1)) &
+                ~(kCacheLineSize - 1);
+    size = cpuOffset + (sizeof(UInt64) * _cpuCount);
+
+    _statsMemory = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryKernelUserShared,
+                                                         size, PAGE_SIZE);
+    if (0 == _statsMemory)
     {
-        return kIOReturnNotFound;
+        return false;
     }
 
-    vectorFlags = DATA_TO_FLAGS(vectorData);
+    _stats = (APICStatistics *)_statsMemory->getBytesNoCopy();
+    bzero(_stats, size);
 
-    if ((vectorFlags & kInterruptTriggerModeMask) == kInterruptTriggerModeEdge)
+    _stats->version = kAPICStatisticsVersion;
+    _stats->vectorBase = _vectorBase;
+    _stats->vectorCount = _vectorCount;
+    _stats->vectorOffset = vectorOffset;
+    _stats->cpuCount = _cpuCount;
+    _stats->cpuOffset = cpuOffset;
+    _stats->updateInterval = _statsInterval;
+
+    _statsLock = IOLockAlloc();
+    if (0 == _statsLock)
     {
-        *interruptType = kIOInterruptTypeEdge;
-    } else {
-        *interruptType = kIOInterruptTypeLevel;
+        return false;
     }
 
-    APIC_LOG("IOAPIC-%ld: %s( %s, %d ) = %s (vector %ld)\n", _vectorBase, __FUNCTION__, nub->getName(), source,
-             *interruptType == kIOInterruptTypeLevel ? "level" : "edge", DATA_TO_VECTOR(vectorData));
+    _statsCall = thread_call_allocate(&AppleAPIC::statisticsTimer, this);
 
-    return kIOReturnSuccess;
+    return (0 != _statsCall);
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::registerInterrupt(IOService *nub,
-                                      int source,
-                                      void *target,
-                                      IOInterruptHandler handler,
-                                      void *refCon )
+// Copy the counters and routing of every vector into the shared region,
+// bracketed by sequence updates for lock-free readers. The counters are
+// read without any lock, so handleInterrupt() is never held up.
+//---------------------------------------------------------------------------
+void AppleAPIC::updateStatisticsExport(void)
 {
-    IOInterruptSource *interruptSources;
-    UInt32 vectorNumber;
-    OSData *vectorData;
-  
-    interruptSources = nub->_interruptSources;
-    vectorData = interruptSources[source].vectorData;
-    vectorNumber = DATA_TO_VECTOR(vectorData);
+    APICVectorStatistics *vectorStats;
+    VectorCounters total;
+    UInt64 *cpuDelivered;
+    UInt64 timestamp = readTimestamp();
+    UInt32 l32;
+    UInt32 flags;
+    UInt32 cpu = 0;
+    int vectorNumber = 0;
 
-    // Check that the vectorNumber is within bounds.
-    // Proceed to the superclass method if valid.
-    if (vectorNumber >= (UInt32)_vectorCount)
+    vectorStats = (APICVectorStatistics *)((UInt8 *)_stats + _stats->vectorOffset);
+    cpuDelivered = (UInt64 *)((UInt8 *)_stats + _stats->cpuOffset);
+
+    _stats->sequence++;
+    OSMemoryBarrier();
+
+    for (cpu = 0; cpu < _cpuCount; cpu++)
     {
-        return kIOReturnBadArgument;
+        cpuDelivered[cpu] = 0;
+    }
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        sumVectorCounters(vectorNumber, &total);
+
+        for (cpu = 0; cpu < _cpuCount; cpu++)
+        {
+            cpuDelivered[cpu] += getVectorCounters(cpu, vectorNumber)->delivered;
+        }
+
+        l32 = _vectorTable[vectorNumber].l32;
+        flags = 0;
+
+        if (vectors[vectorNumber].interruptRegistered)
+        {
+            flags |= kAPICVectorRegistered;
+        }
+
+        if (l32 & kRTLOMaskDisabled)
+        {
+            flags |= kAPICVectorMasked;
+        }
+
+        if (l32 & kRTLOTriggerModeLevel)
+        {
+            flags |= kAPICVectorLevel;
+        }
+
+        if ((_vectorState[vectorNumber].routingModes & kRTLODestinationModeMask) == kRTLODestinationModeLogical)
+        {
+            flags |= kAPICVectorLogical;
+        }
+
+        if (_vectorState[vectorNumber].stormThrottled)
+        {
+            flags |= kAPICVectorThrottled;
+        }
+
+        vectorStats[vectorNumber].delivered = total.delivered;
+        vectorStats[vectorNumber].spurious = total.spurious;
+        vectorStats[vectorNumber].softDisabled = total.softDisabled;
+        vectorStats[vectorNumber].hardDisabled = total.hardDisabled;
+        vectorStats[vectorNumber].handlerCycles = total.handlerCycles;
+        vectorStats[vectorNumber].vector = PIC_TO_SYS_VECTOR(vectorNumber);
+        vectorStats[vectorNumber].destination = _vectorState[vectorNumber].destination;
+        vectorStats[vectorNumber].flags = flags;
     }
 
-    return super::registerInterrupt(nub, source, target, handler, refCon);
+    _stats->updateTime = mach_absolute_time();
+    _stats->updateCount++;
+    _stats->updateCycles = readTimestamp() - timestamp;
+
+    OSMemoryBarrier();
+    _stats->sequence++;
 }
 
 //---------------------------------------------------------------------------
-void AppleAPIC::initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
+void AppleAPIC::statisticsTimer(thread_call_param_t param0, thread_call_param_t param1)
 {
-    IOInterruptSource *interruptSources;
-    UInt32 vectorFlags;
-    OSData *vectorData;
-    IOReturn result = kIOReturnError;
+    AppleAPIC *apic = (AppleAPIC *)param0;
+    UInt64 deadline;
 
-    // Get the vector flags assigned by the platform driver
-    interruptSources = vector->nub->_interruptSources;
-    vectorData = interruptSources[vector->source].vectorData;
+    IOLockLock(apic->_statsLock);
 
-    if (vectorData->getLength() < sizeof(UInt64))
+    if (apic->_statsClients <= 0)
     {
-        return;  // expect trouble soon...
+        IOLockUnlock(apic->_statsLock);
+        return;
     }
 
-    vectorFlags = DATA_TO_FLAGS(vectorData);
+    apic->updateStatisticsExport();
 
-    // This interrupt vector should be disabled, so no locking is needed
-    // while modifying the table entry for this particular vector.
+    clock_interval_to_deadline(apic->_statsInterval, kMicrosecondScale, &deadline);
+    thread_call_enter_delayed(apic->_statsCall, deadline);
 
-    // Set trigger mode
-    _vectorTable[vectorNumber].l32 &= ~kRTLOTriggerModeMask;
+    IOLockUnlock(apic->_statsLock);
+}
 
-    if ((vectorFlags & kInterruptTriggerModeMask) == kInterruptTriggerModeEdge)
+//---------------------------------------------------------------------------
+// Called by AppleAPICUserClient. The shared region is only kept up to
+// date while at least one client has it open.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::openStatistics(void)
+{
+    if (0 == _statsCall)
     {
-        _vectorTable[vectorNumber].l32 |= kRTLOTriggerModeEdge;
-    } else {
-        _vectorTable[vectorNumber].l32 |= kRTLOTriggerModeLevel;
+        return kIOReturnNotReady;
     }
 
-    // Set input pin polarity
-    _vectorTable[vectorNumber].l32 &= ~kRTLOInputPolarityMask;
-
-    if ((vectorFlags & kInterruptPolarityMask) == kInterruptPolarityHigh)
+    if (OSIncrementAtomic(&_statsClients) == 0)
     {
-        _vectorTable[vectorNumber].l32 |= kRTLOInputPolarityHigh;
-    } else {
-        _vectorTable[vectorNumber].l32 |= kRTLOInputPolarityLow;
+        thread_call_enter(_statsCall);
     }
 
-    result = writeVectorEntry(vectorNumber);
-
-    APIC_LOG("IOAPIC-%ld: %s %ld to %s trigger, active %s (result = %d)\n", _vectorBase, __FUNCTION__, vectorNumber,
-             (_vectorTable[vectorNumber].l32 & kRTLOTriggerModeLevel) ? "level" : "edge",
-             (_vectorTable[vectorNumber].l32 & kRTLOInputPolarityLow) ? "low" : "high",
-             result);
+    return kIOReturnSuccess;
 }
 
 //---------------------------------------------------------------------------
-bool AppleAPIC::vectorCanBeShared(IOInterruptVectorNumber vectorNumber,
-                                  IOInterruptVector *vector)
+void AppleAPIC::closeStatistics(void)
 {
-    APIC_LOG("IOAPIC-%ld: %s( %ld )\n", _vectorBase, __FUNCTION__, vectorNumber);
-
-    // Trust the ACPI platform driver to manage interrupt allocations
-    // and not assign unshareable interrupts to multiple devices.
-    // Drivers must never bypass the platform and wire up interrupts.
-    //
-    // - FIXME -
-    // If access to the 'nub' and 'source' were provided, then we
-    // could be extra safe and check the shareable interrupt flag.
-    return true;
+    OSDecrementAtomic(&_statsClients);
 }
 
 //---------------------------------------------------------------------------
-IOInterruptAction AppleAPIC::getInterruptHandlerAddress(void)
+IOMemoryDescriptor *AppleAPIC::getStatisticsMemory(void)
 {
-    return OSMemberFunctionCast(IOInterruptAction, this, &AppleAPIC::handleInterrupt);
+    return _statsMemory;
 }
 
 //---------------------------------------------------------------------------
-void AppleAPIC::disableVectorHard(IOInterruptVectorNumber vectorNumber,
-                                      IOInterruptVector *vector)
+// Turn interrupt tracing on or off. The rings are allocated the first
+// time tracing is turned on, so call from thread context.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::setInterruptTrace(bool enable)
 {
-    IOReturn result;
+    TraceRing *rings;
 
-    APIC_LOG("IOAPIC-%ld: %s %ld ", _vectorBase, __FUNCTION__, vectorNumber);
+    if (!enable)
+    {
+        _traceEnabled = 0;
+        return kIOReturnSuccess;
+    }
 
-    result = disableVectorEntry(vectorNumber);
+    IOLockLock(_registerLock);
 
-    APIC_LOG("(result = %d)\n", result);
-}
+    if (0 == _traceRings)
+    {
+        rings = (TraceRing *)IOMallocAligned(_cpuCount * sizeof(TraceRing), kCacheLineSize);
+        if (0 == rings)
+        {
+            IOLockUnlock(_registerLock);
+            return kIOReturnNoMemory;
+        }
 
-//---------------------------------------------------------------------------
-void AppleAPIC::enableVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector)
-{
-    IOReturn result;
+        bzero(rings, _cpuCount * sizeof(TraceRing));
+        _traceRings = rings;
+        OSMemoryBarrier();
+    }
 
-    APIC_LOG("IOAPIC-%ld: %s %ld ", _vectorBase, __FUNCTION__, vectorNumber);
+    _traceEnabled = 1;
 
-    result = enableVectorEntry(vectorNumber);
+    IOLockUnlock(_registerLock);
 
-    APIC_LOG("(result = %d)\n", result);
+    return kIOReturnSuccess;
 }
 
 //---------------------------------------------------------------------------
-extern "C"
+// Append a record to the ring of the current CPU, overwriting the oldest
+// record if the reader has fallen behind. Each ring has a single writer,
+// its CPU with interrupts disabled, so no atomics are needed. The record
+// sequence is cleared while it is written, so that a reader copying it
+// at the same time can tell it was torn.
+//---------------------------------------------------------------------------
+void AppleAPIC::traceEvent(UInt8 event, IOInterruptVectorNumber vectorNumber, UInt32 argument,
+                           UInt64 entryTime, UInt64 exitTime)
 {
-    extern void lapic_end_of_interrupt(void);
+    TraceRecord *record;
+    TraceRing *ring;
+    UInt32 head;
+    bool enabled;
+
+    enabled = ml_set_interrupts_enabled(FALSE);
+
+    ring = &_traceRings[cpu_number()];
+    head = ring->head;
+    record = &ring->records[head & (kTraceRingSize - 1)];
+
+    record->sequence = 0;
+    OSMemoryBarrier();
+
+    record->entryTime = entryTime;
+    record->exitTime = exitTime;
+    record->argument = argument;
+    record->vector = PIC_TO_SYS_VECTOR(vectorNumber);
+    record->cpu = cpu_number();
+    record->event = event;
+
+    OSMemoryBarrier();
+    record->sequence = head + 1;
+    ring->head = head + 1;
+
+    ml_set_interrupts_enabled(enabled);
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::handleInterrupt(void *savedState, IOService *nub, int source)
+// Copy out up to *count trace records from every CPU ring, and return the
+// number copied in *count, and the number overwritten or torn before
+// they could be read in *lost. Writers are never held off. Readers are
+// serialized by _registerLock.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::drainInterruptTrace(TraceRecord *records, UInt32 *count, UInt32 *lost)
 {
-    IOInterruptVector *vector;
-    IOInterruptVectorNumber vectorNumber;
+    TraceRecord *record;
+    TraceRing *ring;
+    UInt32 capacity;
+    UInt32 copied = 0;
+    UInt32 dropped = 0;
+    UInt32 head;
+    UInt32 cpu = 0;
+
+    if ((0 == records) || (0 == count))
+    {
+        return kIOReturnBadArgument;
+    }
 
-    // Convert the system interrupt to a vector table entry offset.
-    vectorNumber = SYS_TO_PIC_VECTOR(source);
+    capacity = *count;
 
-    assert(vectorNumber >= 0);
-    assert(vectorNumber < _vectorCount);
+    IOLockLock(_registerLock);
 
-    vector = &vectors[vectorNumber];
+    for (cpu = 0; (_traceRings) && (cpu < _cpuCount); cpu++)
+    {
+        ring = &_traceRings[cpu];
+        head = ring->head;
+        OSMemoryBarrier();
 
-    vector->interruptActive = 1;
+        if ((head - ring->tail) > kTraceRingSize)
+        {
+            dropped += (head - ring->tail) - kTraceRingSize;
+            ring->tail = head - kTraceRingSize;
+        }
+
+        for (; (ring->tail != head) && (copied < capacity); ring->tail++)
+        {
+            record = &ring->records[ring->tail & (kTraceRingSize - 1)];
+            records[copied] = *record;
+            OSMemoryBarrier();
+
+            // Keep the copy only if the writer has not since lapped us.
+            if ((records[copied].sequence == (ring->tail + 1)) && (record->sequence == (ring->tail + 1)))
+            {
+                copied++;
+            } else {
+                dropped++;
+            }
+        }
+    }
+
+    IOLockUnlock(_registerLock);
+
+    *count = copied;
+    if (lost)
+    {
+        *lost = dropped;
+    }
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// Publish the phase timings of the completed sleep/wake cycles, oldest
+// first, so they can be lined up with platform wake times.
+//---------------------------------------------------------------------------
+void AppleAPIC::publishSleepWakeHistory(void)
+{
+    SleepWakeRecord record;
+    OSArray *history;
+    OSDictionary *dict;
+    OSNumber *num;
+    UInt64 ns;
+    UInt32 cycles = _sleepWakeCycles;
+    UInt32 cycle;
+
+    history = OSArray::withCapacity(kSleepWakeHistoryCount);
+    if (0 == history)
+    {
+        return;
+    }
 
-    if ((!vector->interruptDisabledSoft) && (vector->interruptRegistered))
+    cycle = (cycles > kSleepWakeHistoryCount) ? (cycles - kSleepWakeHistoryCount) : 0;
+    for (; cycle < cycles; cycle++)
     {
-        vector->handler(vector->target, vector->refCon, vector->nub, vector->source );
+        record = _sleepWakeHistory[cycle % kSleepWakeHistoryCount];
 
-        // interruptDisabledSoft flag may be set by the
-        // vector handler to indicate that the interrupt
-        // should now be disabled. Might as well do it
-        // now rather than take another interrupt.
-        if (vector->interruptDisabledSoft)
+        dict = OSDictionary::withCapacity(9);
+        if (0 == dict)
         {
-            vector->interruptDisabledHard = 1;
+            break;
+        }
+
+#define SET_TIME(key, value)                            \
+        absolutetime_to_nanoseconds((value), &ns);      \
+        SET_COUNT(key, ns)
 
-            disableVectorEntry(vectorNumber);
+#define SET_COUNT(key, value)                           \
+        num = OSNumber::withNumber((value), 64);        \
+        if (num)                                        \
+        {                                               \
+            dict->setObject(key, num);                  \
+            num->release();                             \
         }
-    } else {
-        vector->interruptDisabledHard = 1;
 
-        disableVectorEntry(vectorNumber);
+        SET_TIME(kSleepWakeSleepStartKey, record.sleepStart);
+        SET_TIME(kSleepWakeSleepMaskKey, record.sleepMask);
+        SET_COUNT(kSleepWakeSleepEntriesKey, record.sleepEntryCount);
+        SET_TIME(kSleepWakeDeepIdleKey, record.deepIdle);
+        SET_COUNT(kSleepWakeDeepIdleCountKey, record.deepIdleCount);
+        SET_TIME(kSleepWakePICMaskKey, record.wakePICMask);
+        SET_TIME(kSleepWakeIDRestoreKey, record.wakeIDRestore);
+        SET_TIME(kSleepWakeWakeEntriesKey, record.wakeEntries);
+        SET_COUNT(kSleepWakeWakeEntryCountKey, record.wakeEntryCount);
+#undef SET_COUNT
+#undef SET_TIME
+
+        history->setObject(dict);
+        dict->release();
     }
 
-    vector->interruptActive = 0;
-
-    return kIOReturnSuccess;
+    setProperty(kSleepWakeHistoryKey, history);
+    history->release();
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::resumeFromSleep(void)
+// Enter our vectors in the global system interrupt map, so that they can
+// be resolved without walking the registered interrupt controllers. The
+// range must not overlap the range of another I/O APIC.
+//---------------------------------------------------------------------------
+bool AppleAPIC::registerGlobalSystemInterrupts(void)
 {
+    IOLock *lock;
+    GSIEntry *page;
+    UInt32 gsi;
     int vectorNumber = 0;
-    VectorEntry entry;
-    IOReturn result = kIOReturnError;
 
-    // [3550539]
-    // Some systems wake up with the PIC interrupt line asserted.
-    // This is bad since we program the LINT0 input on the Local
-    // APIC to ExtINT mode, and unmask the LINT0 vector. And any
-    // unexpected PIC interrupt requests will be serviced. Result
-    // is a hard hang the moment the platform driver enables CPU
-    // interrupt on wake. Avoid this by masking all PIC vectors.
-    outb(kPIC_OCW1(kPIC2BasePort), 0xFF);
-    outb(kPIC_OCW1(kPIC1BasePort), 0xFF);
+    if ((_vectorBase + _vectorCount) > (kGSIPageCount * kGSIPageSize))
+    {
+        return false;
+    }
 
-    // Update the identification register containing our APIC ID
-    indexWrite(kIndexID, _apicIDRegister);
+    if (0 == gGSILock)
+    {
+        lock = IOLockAlloc();
+        if (0 == lock)
+        {
+            return false;
+        }
+
+        if (!OSCompareAndSwapPtr(0, lock, (void * volatile *)&gGSILock))
+        {
+            IOLockFree(lock);
+        }
+    }
+
+    IOLockLock(gGSILock);
+
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        gsi = PIC_TO_SYS_VECTOR(vectorNumber);
+        page = gGSITable[gsi >> kGSIPageShift];
 
+        if ((page) && (page[gsi & (kGSIPageSize - 1)].controller))
+        {
+            IOLockUnlock(gGSILock);
+            IOLog("IOAPIC: Vector %d already belongs to another I/O APIC\n", (uint32_t)gsi);
+            return false;
+        }
+    }
+
+    // Pages are allocated before any entry is filled in, so that a
+    // failure leaves nothing behind to undo. Empty pages are reused.
     for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
     {
-        // Force a de-assertion on the interrupt line.
+        gsi = PIC_TO_SYS_VECTOR(vectorNumber);
+
+        if (0 == gGSITable[gsi >> kGSIPageShift])
+        {
+            page = IONew(GSIEntry, kGSIPageSize);
+            if (0 == page)
+            {
+                IOLockUnlock(gGSILock);
+                return false;
+            }
 
-        entry = _vectorTable[vectorNumber];
-        entry.l32 |= kRTLOMaskDisabled;
-        writeVectorEntry(vectorNumber, entry);
+            bzero(page, sizeof(GSIEntry) * kGSIPageSize);
+            OSMemoryBarrier();
+            gGSITable[gsi >> kGSIPageShift] = page;
+        }
+    }
 
-        // Restore vector entry to its pre-sleep state.
-        result = writeVectorEntry(vectorNumber);
+    for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
+    {
+        gsi = PIC_TO_SYS_VECTOR(vectorNumber);
+        page = gGSITable[gsi >> kGSIPageShift];
+        page[gsi & (kGSIPageSize - 1)].controller = this;
     }
 
-    return result;
+    _gsiRegistered = true;
+
+    IOLockUnlock(gGSILock);
+
+    return true;
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::prepareForSleep(void)
+void AppleAPIC::unregisterGlobalSystemInterrupts(void)
 {
-    VectorEntry entry;
+    GSIEntry *page;
+    UInt32 gsi;
     int vectorNumber = 0;
-    IOReturn result = kIOReturnError;
 
-    // Mask all interrupts before platform sleep
+    IOLockLock(gGSILock);
+
     for (vectorNumber = 0; vectorNumber < _vectorCount; vectorNumber++)
     {
-        entry = _vectorTable[vectorNumber];
-        entry.l32 |= kRTLOMaskDisabled;
-        result = writeVectorEntry(vectorNumber, entry);
+        gsi = PIC_TO_SYS_VECTOR(vectorNumber);
+        page = gGSITable[gsi >> kGSIPageShift];
+
+        if ((page) && (page[gsi & (kGSIPageSize - 1)].controller == this))
+        {
+            page[gsi & (kGSIPageSize - 1)].controller = 0;
+        }
     }
 
-    return result;
+    _gsiRegistered = false;
+
+    IOLockUnlock(gGSILock);
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::prepareForDeepIdle(UInt32 vectorNumber)
+// Resolve a global system interrupt to the I/O APIC that owns it, and
+// the pin on that I/O APIC. Lock free, and safe at interrupt level. The
+// pin follows from the base vector of the controller, so a single read
+// of the entry is all there is to get right, with no barrier. The
+// controller is not retained, the caller must otherwise know it stays,
+// or hold gGSILock.
+//---------------------------------------------------------------------------
+AppleAPIC *AppleAPIC::lookupGlobalSystemInterrupt(UInt32 gsi, IOInterruptVectorNumber *pin)
 {
-    VectorEntry entry;
-    IOReturn result = kIOReturnBadArgument;
+    AppleAPIC *controller;
+    GSIEntry *page;
 
-    if ((_vectorTable) && (vectorNumber < _vectorCount))
+    if ((gsi >> kGSIPageShift) >= kGSIPageCount)
     {
-        entry = _vectorTable[vectorNumber];
-        entry.l32 &= ~kRTLOMaskMask;
-        result = writeVectorEntry(vectorNumber, entry);
+        return 0;
     }
 
-    return result;
+    page = gGSITable[gsi >> kGSIPageShift];
+    if (0 == page)
+    {
+        return 0;
+    }
+
+    controller = page[gsi & (kGSIPageSize - 1)].controller;
+    if ((controller) && (pin))
+    {
+        *pin = gsi - controller->_vectorBase;
+    }
+
+    return controller;
 }
 
 //---------------------------------------------------------------------------
-IOReturn AppleAPIC::setVectorPhysicalDestination(UInt32 vectorNumber,
-												 UInt32 apicID)
+// Route a global system interrupt to a CPU, on whichever I/O APIC owns
+// it. The owner may be another controller, which is kept from going away
+// by holding gGSILock, as it has to take the lock to unregister.
+//---------------------------------------------------------------------------
+IOReturn AppleAPIC::setGlobalSystemInterruptDestination(UInt32 gsi, UInt32 apicID)
 {
-	VectorEntry * entry;
+    AppleAPIC *controller;
+    IOInterruptVectorNumber pin;
+    IOReturn result = kIOReturnNotFound;
+
+    if (0 == gGSILock)
+    {
+        return kIOReturnNotFound;
+    }
 
-    IOLog("IOAPIC-%d: %s( %d, %d )\n", (uint32_t) _vectorBase, __FUNCTION__, (uint32_t) vectorNumber, (uint32_t) apicID);
+    IOLockLock(gGSILock);
 
-	if ((vectorNumber >= (UInt32)_vectorCount) || (apicID > 255))
+    controller = lookupGlobalSystemInterrupt(gsi, &pin);
+    if (controller)
     {
-		return kIOReturnBadArgument;
+        result = controller->setVectorPhysicalDestination(pin, apicID);
     }
 
-	disableVectorEntry(vectorNumber);
+    IOLockUnlock(gGSILock);
+
+    return result;
+}
 
-	entry = &_vectorTable[vectorNumber];
-	entry->h32 = ((apicID << kRTHIDestinationShift) & kRTHIDestinationMask);
+//---------------------------------------------------------------------------
+// Refresh the statistics on every registry read, so clients always see
+// current values without a polling timer in the driver.
+//---------------------------------------------------------------------------
+bool AppleAPIC::serializeProperties(OSSerialize *s) const
+{
+    ((AppleAPIC *)this)->publishStatistics();
+    ((AppleAPIC *)this)->publishSleepWakeHistory();
 
-	writeVectorEntry(vectorNumber);
-	
-	return kIOReturnSuccess;
+    return super::serializeProperties(s);
 }
 
 //---------------------------------------------------------------------------
@@ -652,7 +3611,83 @@ IOReturn AppleAPIC::callPlatformFunction(const OSSymbol *function,
 		// param1 - vector number
 		// param2 - APIC ID
 		return setVectorPhysicalDestination((uintptr_t)param1, (uintptr_t)param2);
-	}
+	} else if (function == _setVectorLogicalDestination) {
+        // param1 - vector number
+        // param2 - logical destination
+        // param3 - non-zero for lowest priority delivery
+        return setVectorLogicalDestination((uintptr_t)param1, (uintptr_t)param2, (0 != param3));
+    } else if (function == _getInterruptRemapTable) {
+        // param1 - returns the retained remapping table
+        // param2 - returns the index of its first entry
+        // param3 - APICRemapInvalidateFunction, optional
+        // param4 - refCon for the invalidation function
+        return getInterruptRemapTable((IOBufferMemoryDescriptor **)param1, (UInt32 *)param2,
+                                      (APICRemapInvalidateFunction)param3, param4);
+    } else if (function == _setInterruptTrace) {
+        // param1 - non-zero to turn tracing on
+        return setInterruptTrace(0 != param1);
+    } else if (function == _drainInterruptTrace) {
+        // param1 - TraceRecord buffer
+        // param2 - in: buffer capacity in records, out: records copied
+        // param3 - returns the number of records lost, optional
+        return drainInterruptTrace((TraceRecord *)param1, (UInt32 *)param2, (UInt32 *)param3);
+    } else if (function == _resetInterruptLatency) {
+        resetLatencyHistograms();
+        return kIOReturnSuccess;
+    } else if (function == _getRegisterSnapshot) {
+        // param1 - APICRegisterSnapshot to fill
+        if (0 == param1)
+        {
+            return kIOReturnBadArgument;
+        }
+        return snapshotRegisters((APICRegisterSnapshot *)param1);
+    } else if (function == _compareRegisterSnapshot) {
+        // param1 - APICRegisterSnapshot to compare with the vector table
+        // param2 - returns the number of entries that drifted
+        // param3 - returns a map of the entries that drifted, optional
+        if ((0 == param1) || (0 == param2))
+        {
+            return kIOReturnBadArgument;
+        }
+        *(UInt32 *)param2 = compareRegisterSnapshot((const APICRegisterSnapshot *)param1, (UInt32 *)param3);
+        return kIOReturnSuccess;
+    } else if (function == _lookupGlobalSystemInterrupt) {
+        // param1 - global system interrupt
+        // param2 - returns the interrupt controller, retained, the
+        //          caller must release it
+        // param3 - returns the pin number, optional
+        AppleAPIC *controller = 0;
+        IOInterruptVectorNumber pin;
+
+        // A controller leaves the map under gGSILock before its last
+        // release, so it can be retained while the lock is held.
+        if ((gGSILock) && (param2))
+        {
+            IOLockLock(gGSILock);
+            controller = lookupGlobalSystemInterrupt((uintptr_t)param1, &pin);
+            if (controller)
+            {
+                controller->retain();
+            }
+            IOLockUnlock(gGSILock);
+        }
+
+        if (0 == controller)
+        {
+            return kIOReturnNotFound;
+        }
+
+        *(IOInterruptController **)param2 = controller;
+        if (param3)
+        {
+            *(UInt32 *)param3 = pin;
+        }
+        return kIOReturnSuccess;
+    } else if (function == _setGlobalSystemInterruptDestination) {
+        // param1 - global system interrupt
+        // param2 - APIC ID
+        return setGlobalSystemInterruptDestination((uintptr_t)param1, (uintptr_t)param2);
+    }
 
     return super::callPlatformFunction(function, waitForFunction, param1, param2, param3, param4);
 }
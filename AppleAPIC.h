@@ -25,6 +25,11 @@
 
 #include <IOKit/IOInterrupts.h>
 #include <IOKit/IOInterruptController.h>
+#include <libkern/OSAtomic.h>
+#include <kern/thread_call.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+
+#include "PICShared.h"
 
 #if OSTYPES_K64_REV < 1
 typedef long IOInterruptVectorNumber;
@@ -39,7 +44,75 @@ enum {
     kOffsetEOIR   = 0x40   /* 32-bits WO  EOI               */
 };
 
+#ifndef IOAPIC_REG
 #define IOAPIC_REG(reg) (*((volatile UInt32 *)(_apicBaseAddr + kOffset##reg)))
+#endif
+
+/* Keys for statistics published in the I/O Registry */
+
+#define kMMIOReadCountKey             "MMIO Reads"
+#define kMMIOWriteCountKey            "MMIO Writes"
+#define kMMIOWritesSavedKey           "MMIO Writes Saved"
+#define kSleepWakeMMIOAccessesKey     "Sleep Wake MMIO Accesses"
+#define kSleepWakeMMIOSavedKey        "Sleep Wake MMIO Accesses Saved"
+#define kSleepWakeMicrosecondsSavedKey "Sleep Wake Microseconds Saved"
+#define kSleepWakeHistoryKey          "Sleep Wake History"
+#define kSleepWakeSleepStartKey       "Sleep Start ns"
+#define kSleepWakeSleepMaskKey        "Sleep Mask ns"
+#define kSleepWakeSleepEntriesKey     "Sleep Entries"
+#define kSleepWakeDeepIdleKey         "Deep Idle ns"
+#define kSleepWakeDeepIdleCountKey    "Deep Idle Count"
+#define kSleepWakePICMaskKey          "Wake PIC Mask ns"
+#define kSleepWakeIDRestoreKey        "Wake ID Restore ns"
+#define kSleepWakeWakeEntriesKey      "Wake Entries ns"
+#define kSleepWakeWakeEntryCountKey   "Wake Entries"
+#define kInterruptStatisticsKey       "Interrupt Statistics"
+#define kStatisticsVectorKey          "Vector"
+#define kStatisticsNubKey             "Nub"
+#define kStatisticsDeliveredKey       "Delivered"
+#define kStatisticsSpuriousKey        "Spurious"
+#define kStatisticsSoftDisabledKey    "Soft Disabled"
+#define kStatisticsHardDisabledKey    "Hard Disabled"
+#define kStatisticsHandlerCyclesKey   "Handler Cycles"
+#define kStatisticsPerCPUDeliveredKey "Per CPU Delivered"
+
+/* Tunables, read from the provider or from the driver personality */
+
+#define kBalancerAPICIDsKey           "Balancer APIC IDs"
+#define kBalancerIntervalKey          "Balancer Interval"
+#define kBalancerThresholdKey         "Balancer Threshold"
+#define kBalancerHoldOffKey           "Balancer Hold Off"
+#define kStormThresholdKey            "Storm Threshold"
+#define kStormWindowKey               "Storm Window"
+#define kStormBackoffKey              "Storm Backoff"
+#define kDirectedEOIKey               "Directed EOI"
+#define kInterruptTraceKey            "Interrupt Trace"
+#define kStatisticsIntervalKey        "Statistics Interval"
+#define kLatencyHistogramKey          "Latency Histograms"
+#define kLatencyRecordCyclesKey       "Latency Record Cycles"
+#define kStatisticsLatencyKey         "Handler Latency Cycles"
+#define kLatencyCountKey              "Count"
+#define kLatencyP50Key                "p50"
+#define kLatencyP99Key                "p99"
+#define kLatencyP999Key               "p99.9"
+#define kLatencyMaxKey                "Max"
+#define kStartMicrosecondsKey         "Start Microseconds"
+#define kVectorLocksAllocatedKey      "Vector Locks Allocated"
+#define kDeferredProgrammingKey       "Deferred Programming"
+#define kResetMMIOWritesKey           "Reset MMIO Writes"
+
+enum {
+    kDefaultBalancerInterval        = 0,    /* ms, zero disables  */
+    kDefaultBalancerThreshold       = 25,   /* percent imbalance  */
+    kDefaultBalancerHoldOff         = 4,    /* balancer intervals */
+    kDefaultStormThreshold          = 0,    /* interrupts, zero disables */
+    kDefaultStormWindow             = 100,  /* ms */
+    kDefaultStormBackoff            = 100,  /* ms */
+    kDefaultStatisticsInterval      = 1000, /* us, shared memory update */
+    kMinStatisticsInterval          = 100,  /* us, bounds update overhead */
+    kMaxStormBackoffShift           = 3,    /* backoff grows up to 8x */
+    kDirectedEOIMinVersion          = 0x20  /* first version with EOIR */
+};
 
 /* APIC indirect registers indices */
 
@@ -118,7 +191,44 @@ enum {
     kRTHIExtendedDestinationIDShift = 16,
     
     kRTHIDestinationMask            = 0xFF000000,
-    kRTHIDestinationShift           = 24
+    kRTHIDestinationShift           = 24,
+
+    /* Destination ID bits 14:8 in the extended destination ID field */
+    kRTHIExtendedAPICIDMask         = 0x00FE0000,
+    kRTHIExtendedAPICIDShift        = 17,
+
+    /* Remappable format, routing is looked up by interrupt index */
+    kRTHIInterruptFormatMask        = 0x00010000,
+    kRTHIInterruptFormatRemappable  = kRTHIInterruptFormatMask,
+    kRTHIInterruptIndexMask         = 0xFFFE0000,
+    kRTHIInterruptIndexShift        = 17,
+    kRTLOInterruptIndex15Mask       = 0x00000800
+};
+
+/* Interrupt remapping table entry, in the VT-d remapped format */
+
+typedef struct RemapEntry {
+    UInt32 l32;                     /* present, modes and vector      */
+    UInt32 destination;             /* destination ID, see below      */
+    UInt32 sourceID;                /* source validation, unused      */
+    UInt32 reserved;
+} RemapEntry_t;
+
+enum {
+    kIRTEPresent                    = 0x00000001,
+    kIRTEDestinationModeLogical     = 0x00000004,
+    kIRTERedirectionHint            = 0x00000008,
+    kIRTETriggerModeLevel           = 0x00000010,
+    kIRTEDeliveryModeShift          = 5,
+    kIRTEVectorShift                = 16,
+
+    /* In xAPIC mode the 8-bit APIC ID sits in bits 15:8 of the
+       destination, in x2APIC mode the destination is the full ID */
+    kIRTEDestinationXAPICShift      = 8,
+
+    kMaxAPICID                      = 0xFF,
+    kMaxExtendedAPICID              = 0x7FFF,
+    kMaxRemapIndex                  = 0xFFFF
 };
 
 /* Redirection Table vector entry */
@@ -128,6 +238,215 @@ typedef struct VectorEntry {
     UInt32 h32;
 } VectorEntry_t;
 
+/* Halves of a vector entry whose hardware contents are unknown */
+
+enum {
+    kVectorDirtyLow   = 0x01,
+    kVectorDirtyHigh  = 0x02,
+    kVectorDirtyAll   = kVectorDirtyLow | kVectorDirtyHigh
+};
+
+#define kIndexShadowInvalid 0xFFFFFFFF
+
+/* Interrupt specifier flags, decoded into vector table fields */
+
+enum {
+    kSpecifierValid                 = 0x00000001,
+    kSpecifierShareable             = 0x00000002,
+    kSpecifierRTLOMask              = kRTLOTriggerModeMask | kRTLOInputPolarityMask
+};
+
+/* Additional handler on a shared vector */
+
+typedef struct SharedHandler {
+    struct SharedHandler * volatile next;
+    IOService *nub;
+    int source;
+    void *target;
+    IOInterruptHandler handler;
+    void *refCon;
+    volatile UInt32 enabled;
+} SharedHandler_t;
+
+/* Per-vector software state kept alongside the vector table */
+
+typedef struct VectorState {
+    UInt64 sampledCount;            /* delivered count at last sample */
+    UInt32 rate;                    /* interrupts per balancer period */
+    UInt32 holdOff;                 /* periods before it can move     */
+    volatile UInt32 stormCount;     /* interrupts in the storm window */
+    volatile UInt32 spurious;       /* hits while unregistered        */
+    UInt8  stormThrottled;          /* masked by the storm detector   */
+    UInt8  stormReported;           /* offender was logged            */
+    UInt8  stormBackoffShift;       /* backoff doubling for repeats   */
+    UInt64 stormWindowStart;        /* absolute time of window start  */
+    UInt64 stormReleaseTime;        /* absolute time to unmask        */
+    SharedHandler * volatile sharedHandlers; /* after the primary     */
+    struct LatencyHistogram * volatile latency; /* handler times      */
+    volatile SInt32 sharedReaders[2]; /* CPUs walking sharedHandlers, */
+    volatile UInt32 sharedEpoch;    /* counted in this epoch's slot   */
+    UInt32 destination;             /* APIC ID or logical destination */
+    UInt32 routingModes;            /* delivery and destination modes */
+    OSData * volatile specifierData; /* retained, key of the decode    */
+    volatile UInt32 specifierDecoded; /* decode of specifierData flags */
+    thread_call_t threadCall;       /* worker for threaded dispatch   */
+    volatile SInt32 threadPending;  /* interrupts queued to worker    */
+    thread_t volatile threadActive; /* worker running the handlers    */
+    thread_t volatile lockHolder;   /* unregistering in the superclass */
+} VectorState_t;
+
+/* Per-vector interrupt counters, one set for every CPU */
+
+typedef struct VectorCounters {
+    UInt64 delivered;               /* handler invocations            */
+    UInt64 spurious;                /* in totals only, see VectorState */
+    UInt64 softDisabled;            /* hits while soft disabled       */
+    UInt64 hardDisabled;            /* entry masked by the controller */
+    UInt64 handlerCycles;           /* TSC cycles spent in handlers   */
+} VectorCounters_t;
+
+enum {
+    kCounterSlabShift               = 3,
+    kCounterSlabVectors             = (1 << kCounterSlabShift)
+};
+
+/* Log-linear histogram of handler times in TSC cycles. Below
+   kLatencySubBuckets cycles every value has its own bucket, above it
+   every power of two is split into kLatencySubBuckets equal buckets,
+   so the relative error stays under 1 / kLatencySubBuckets. Times of
+   2^kLatencyMaxShift cycles and more share the last bucket. */
+
+enum {
+    kLatencySubBucketShift          = 3,
+    kLatencySubBuckets              = (1 << kLatencySubBucketShift),
+    kLatencyMaxShift                = 40,
+    kLatencyBucketCount             = kLatencySubBuckets * (kLatencyMaxShift - kLatencySubBucketShift + 1)
+};
+
+typedef struct LatencyHistogram {
+    volatile UInt64 maximum;        /* longest time seen              */
+    volatile SInt64 buckets[kLatencyBucketCount];
+} LatencyHistogram_t;
+
+static inline UInt32 latencyBucket(UInt64 cycles)
+{
+    UInt32 msb;
+
+    if (cycles < kLatencySubBuckets)
+    {
+        return (UInt32)cycles;
+    }
+
+    msb = 63 - __builtin_clzll(cycles);
+    if (msb >= kLatencyMaxShift)
+    {
+        return kLatencyBucketCount - 1;
+    }
+
+    return ((msb - kLatencySubBucketShift + 1) << kLatencySubBucketShift) |
+           (UInt32)((cycles >> (msb - kLatencySubBucketShift)) & (kLatencySubBuckets - 1));
+}
+
+/* Largest time that falls into a bucket */
+
+static inline UInt64 latencyBucketLimit(UInt32 bucket)
+{
+    UInt32 octave = bucket >> kLatencySubBucketShift;
+
+    if (0 == octave)
+    {
+        return bucket;
+    }
+
+    return ((((UInt64)(kLatencySubBuckets | (bucket & (kLatencySubBuckets - 1)))) + 1) << (octave - 1)) - 1;
+}
+
+/* Count a handler time. Wait-free: a single atomic add, and a racy
+   maximum that can only lose to a larger time recorded at the same
+   moment on another CPU. */
+
+static inline void recordLatency(LatencyHistogram *histogram, UInt64 cycles)
+{
+    OSIncrementAtomic64(&histogram->buckets[latencyBucket(cycles)]);
+
+    if (cycles > histogram->maximum)
+    {
+        histogram->maximum = cycles;
+    }
+}
+
+/* Time spent in each phase of a sleep/wake cycle, in absolute time */
+
+typedef struct SleepWakeRecord {
+    UInt64 sleepStart;              /* when prepareForSleep() ran     */
+    UInt64 sleepMask;               /* masking entries for sleep      */
+    UInt64 deepIdle;                /* unmasking for deep idle        */
+    UInt64 wakePICMask;             /* masking the 8259 PICs          */
+    UInt64 wakeIDRestore;           /* restoring the ID register      */
+    UInt64 wakeEntries;             /* programming restored entries   */
+    UInt32 sleepEntryCount;         /* entries masked for sleep       */
+    UInt32 deepIdleCount;           /* deep idle calls in the cycle   */
+    UInt32 wakeEntryCount;          /* entries restored on wake       */
+} SleepWakeRecord_t;
+
+enum {
+    kSleepWakeHistoryCount          = 8
+};
+
+#define kCacheLineSize 64
+
+/* Interrupt trace record, as returned by DrainInterruptTrace */
+
+typedef struct TraceRecord {
+    UInt64 entryTime;               /* TSC at handler entry or event  */
+    UInt64 exitTime;                /* TSC at handler exit, or zero   */
+    UInt32 sequence;                /* ring position + 1, 0 if torn   */
+    UInt32 argument;                /* APIC ID for retarget events    */
+    UInt16 vector;                  /* system vector number           */
+    UInt8  cpu;
+    UInt8  event;
+    UInt32 reserved;
+} TraceRecord_t;
+
+enum {
+    kTraceEventInterrupt            = 1,
+    kTraceEventMask                 = 2,
+    kTraceEventUnmask               = 3,
+    kTraceEventRetarget             = 4
+};
+
+/* Single writer trace ring, one per CPU */
+
+enum {
+    kTraceRingSize                  = 256   /* records, power of 2 */
+};
+
+typedef struct TraceRing {
+    volatile UInt32 head;           /* records ever written           */
+    UInt32 tail;                    /* records consumed by the reader */
+    UInt8  pad[kCacheLineSize - (2 * sizeof(UInt32))];
+    TraceRecord records[kTraceRingSize];
+} TraceRing_t;
+
+/* System-wide map of global system interrupts to I/O APIC pins */
+
+typedef struct GSIEntry {
+    class AppleAPICInterruptController * volatile controller;
+} GSIEntry_t;
+
+enum {
+    kGSIPageShift                   = 8,
+    kGSIPageSize                    = (1 << kGSIPageShift),
+    kGSIPageCount                   = 256   /* GSIs 0 to 65535 */
+};
+
+static inline UInt64 readTimestamp(void)
+{
+    UInt32 lo, hi;
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (((UInt64)hi) << 32) | lo;
+}
+
 #define AppleAPIC AppleAPICInterruptController
 
 class AppleAPIC : public IOInterruptController
@@ -137,6 +456,15 @@ class AppleAPIC : public IOInterruptController
 protected:
     const OSSymbol *_handleSleepWakeFunction;
 	const OSSymbol *_setVectorPhysicalDestination;
+    const OSSymbol *_setVectorLogicalDestination;
+    const OSSymbol *_getInterruptRemapTable;
+    const OSSymbol *_lookupGlobalSystemInterrupt;
+    const OSSymbol *_setGlobalSystemInterruptDestination;
+    const OSSymbol *_setInterruptTrace;
+    const OSSymbol *_drainInterruptTrace;
+    const OSSymbol *_resetInterruptLatency;
+    const OSSymbol *_getRegisterSnapshot;
+    const OSSymbol *_compareRegisterSnapshot;
 
     // APIC registers are memory mapped.
 
@@ -152,76 +480,445 @@ protected:
 
     // A cache of entries in the vector table. Makes restoring
     // hardware context following system sleep easier, and also
-    // avoids a register read on vector updates.
+    // avoids a register read on vector updates. The lower half
+    // of each entry is updated with atomic operations, and must
+    // always match what was last written to the hardware.
 
     VectorEntry *_vectorTable;
     IOInterruptVectorNumber _vectorCount;
 
-    // The APIC ID of the CPU that will handle the interrupt.
-    // in physical mode.
+    // The APIC ID of the CPU that handles the interrupt in physical
+    // mode, or the logical destination (flat mask or cluster and mask)
+    // in logical mode.
     IOInterruptVectorNumber _destinationAddress;
 
+    // Default delivery and destination modes for every vector,
+    // as redirection table lower 32-bit fields.
+    UInt32 _deliveryMode;
+    UInt32 _destinationMode;
+
+    // Routing to APIC IDs above 255. With extended destination IDs,
+    // bits 14:8 of the APIC ID go in the extended destination field.
+    // With interrupt remapping, every entry is in remappable format
+    // and indexes its own entry in a remapping table, which holds a
+    // full 32-bit destination in x2APIC mode, and an 8-bit one in
+    // xAPIC mode. The platform hands the table to the remapping
+    // hardware, and gives back a function that invalidates the
+    // hardware's cached copy of an entry, called under _apicLock.
+    bool _extendedDestinationID;
+    IOBufferMemoryDescriptor *_remapTable;
+    RemapEntry *_remapEntries;
+    UInt32 _remapIndexBase;
+    bool _remapX2APIC;
+    APICRemapInvalidateFunction _remapInvalidate;
+    void *_remapInvalidateRefCon;
+
     // ID register at register index 0, saved across sleep/wake.
     UInt32 _apicIDRegister;
 
+    // Version of the I/O APIC, from the version register.
+    UInt32 _apicVersion;
+
+    // When the local APICs do not broadcast EOI messages, level
+    // triggered entries must be acknowledged here to clear their
+    // Remote IRR bit. Newer I/O APICs have an EOI register for it,
+    // older ones need the trigger mode to be toggled instead.
+    bool _directedEOI;
+
+    // Only mask entries on reset, and leave the rest of each entry
+    // to be written when its vector is first used. This halves the
+    // boot writes, but doubles the writes of every vector used, so
+    // it is off unless the platform opts in.
+    bool _deferredProgramming;
+
+    // Software state for each vector.
+    VectorState *_vectorState;
+
+    // Our vectors are in the global system interrupt map.
+    bool _gsiRegistered;
+
+    // Interrupt counters, pooled in slabs of kCounterSlabVectors
+    // vectors. Within a slab, each CPU owns a block of counters for
+    // those vectors, aligned to a cache line so that no two CPUs ever
+    // write to the same line. Only the owning CPU writes its block,
+    // with interrupts disabled, so no atomics or locks are needed.
+    // Readers sum the blocks without synchronization.
+    //
+    // A vector gets a slot when first registered, and keeps it. Slot 0
+    // is shared by every vector without one, and is never reported.
+    // Slabs are allocated as slots run out, and kept until free().
+    UInt8 * volatile *_counterSlabs;
+    volatile UInt16 *_counterSlot;
+    UInt32 _counterSlabCount;
+    UInt32 _counterSlotsUsed;
+    UInt32 _cpuCount;
+    UInt32 _cpuCounterStride;
+
+    inline VectorCounters *getVectorCounters(UInt32 cpu, IOInterruptVectorNumber vectorNumber)
+    {
+        UInt32 slot = _counterSlot[vectorNumber];
+
+        return ((VectorCounters *)(_counterSlabs[slot >> kCounterSlabShift] + (cpu * _cpuCounterStride))) +
+               (slot & (kCounterSlabVectors - 1));
+    }
+
+    // Serializes interrupt registration, and with it all changes to
+    // the shared handler chains. The chains are walked without locks,
+    // readers announce themselves in the sharedReaders slot of the
+    // current epoch. A removed handler is freed once the slot of the
+    // epoch it was removed in drains, so readers that come later do
+    // not hold it up.
+    IOLock *_registerLock;
+
+    // Interrupt affinity balancer. Periodically samples the rate of
+    // every vector, and moves a hot vector from the busiest to the
+    // least busy destination APIC when the imbalance between them
+    // exceeds the threshold.
+    thread_call_t _balancerCall;
+    UInt32 *_balancerAPICIDs;
+    UInt64 *_balancerLoad;
+    UInt32 _balancerCPUCount;
+    UInt32 _balancerInterval;
+    UInt32 _balancerThreshold;
+    UInt32 _balancerHoldOff;
+
+    // Interrupt storm detector. A vector that takes the threshold
+    // number of interrupts within the window is masked, and unmasked
+    // again by a timer after the backoff time. The dispatch path only
+    // counts, and reads the clock once every threshold interrupts.
+    thread_call_t _stormCall;
+    volatile UInt32 _stormCallArmed;
+    UInt32 _stormThreshold;
+    UInt64 _stormWindow;
+    UInt64 _stormBackoff;
+
+    // Running count of uncached register accesses. Every access
+    // to the APIC goes through indexRead() and indexWrite(), so
+    // these give the MMIO cost of any controller operation.
+    UInt64 _mmioReads;
+    UInt64 _mmioWrites;
+    UInt64 _mmioWritesSaved;
+
+    // EOI register writes, made without _apicLock from any CPU,
+    // so counted apart and atomically.
+    volatile SInt64 _eoiWrites;
+
+    // Vector locks allocated so far, out of _vectorCount.
+    UInt32 _vectorLocksAllocated;
+
+    // Shadow of the hardware state. The last index selected in
+    // the IND register, and the last value written to each half
+    // of every vector entry. Dirty bits mark halves whose contents
+    // are unknown, such as on start or after system wake. Except
+    // during start and wake, only touched while holding _apicLock.
+    UInt32 _indexShadow;
+    VectorEntry *_vectorShadow;
+    UInt8 *_vectorDirty;
+
+    // Scratch table for building whole-table updates, such as the
+    // masked entries written before sleep. Allocated up front so the
+    // sleep path never allocates memory.
+    VectorEntry *_vectorScratch;
+    IOInterruptVectorNumber *_vectorList;
+
+    // Bitmaps over the vector table, one bit per vector. Enabled
+    // vectors are unmasked in the table, modified vectors differ from
+    // what resetVectorTable() set up. Vectors in neither map are only
+    // ever masked, so sleep and wake leave them alone.
+    volatile UInt32 *_vectorEnabledMap;
+    volatile UInt32 *_vectorModifiedMap;
+    UInt32 _vectorMapWords;
+
+    // MMIO cost of the sleep/wake cycle in progress, and of the last
+    // complete one. Saved accesses are counted against writing every
+    // vector entry on sleep and wake.
+    UInt64 _sleepWakeAccesses;
+    UInt64 _sleepWakeAccessesSaved;
+    UInt64 _lastSleepWakeAccesses;
+    UInt64 _lastSleepWakeAccessesSaved;
+    UInt64 _lastSleepWakeMicrosecondsSaved;
+
+    // Interrupt trace rings, allocated when tracing is first turned
+    // on, and kept until free() so that a reader is never left with
+    // a dangling ring. _traceEnabled is the only check on hot paths.
+    TraceRing *_traceRings;
+    volatile UInt32 _traceEnabled;
+
+    // Statistics region shared read-only with user clients. While any
+    // client is open, _statsCall refreshes it every _statsInterval us.
+    // A call entered by a new client can start while the one of a
+    // previous client is still running, so updates hold _statsLock.
+    IOBufferMemoryDescriptor *_statsMemory;
+    APICStatistics *_stats;
+    thread_call_t _statsCall;
+    IOLock *_statsLock;
+    UInt32 _statsInterval;
+    volatile SInt32 _statsClients;
+
+    // Handler time histograms are allocated when a vector is first
+    // registered, if enabled, and kept until free() since a handler
+    // may still be recording into one. _latencyRecordCycles is the
+    // measured cost of a recording.
+    bool _latencyEnabled;
+    UInt64 _latencyRecordCycles;
+
+    // Phase timings of the last kSleepWakeHistoryCount cycles. The
+    // record of the cycle in progress is at _sleepWakeCycles, and is
+    // only complete once the count moves on at wake.
+    SleepWakeRecord _sleepWakeHistory[kSleepWakeHistoryCount];
+    UInt32 _sleepWakeCycles;
+    bool _sleepWakePending;
+
     // Inline functions to read and write to the APIC
     // indirect registers. Must be accessed as 32-bit values.
-    inline UInt32 indexRead(UInt32 index)
+    // The IND register write is skipped if the index is
+    // already selected.
+    inline void indexSelect(UInt32 index)
     {
+        if (index == _indexShadow)
+        {
+            _mmioWritesSaved++;
+            return;
+        }
+
+        _mmioWrites++;
         IOAPIC_REG(IND) = index;
+        _indexShadow = index;
+    }
+
+    inline UInt32 indexRead(UInt32 index)
+    {
+        indexSelect(index);
+        _mmioReads++;
         return IOAPIC_REG(DAT);
     }
 
     inline void indexWrite(UInt32 index, UInt32 value)
     {
-        IOAPIC_REG(IND) = index;
+        indexSelect(index);
+        _mmioWrites++;
         IOAPIC_REG(DAT) = value;
     }
 
-    // Enable or disable (mask) a vector entry. Protected with
-    // a spinlock with interrupt disabled.
+    // Write one half of a vector entry, unless the hardware is
+    // known to already hold that value. Call with _apicLock held.
+    inline void writeVectorLowLocked(IOInterruptVectorNumber vectorNumber, UInt32 l32)
+    {
+        if ((_vectorDirty[vectorNumber] & kVectorDirtyLow) || (_vectorShadow[vectorNumber].l32 != l32))
+        {
+            indexWrite(kIndexRTLO + (vectorNumber * 2), l32);
+            _vectorShadow[vectorNumber].l32 = l32;
+            _vectorDirty[vectorNumber] &= ~kVectorDirtyLow;
+        } else {
+            _mmioWritesSaved += 2;
+        }
+    }
+
+    inline bool vectorEntryCurrent(IOInterruptVectorNumber vectorNumber, VectorEntry entry)
+    {
+        return ((_vectorDirty[vectorNumber] == 0) &&
+                (_vectorShadow[vectorNumber].l32 == entry.l32) &&
+                (_vectorShadow[vectorNumber].h32 == entry.h32));
+    }
+
+    inline void writeVectorHighLocked(IOInterruptVectorNumber vectorNumber, UInt32 h32)
+    {
+        if ((_vectorDirty[vectorNumber] & kVectorDirtyHigh) || (_vectorShadow[vectorNumber].h32 != h32))
+        {
+            indexWrite(kIndexRTHI + (vectorNumber * 2), h32);
+            _vectorShadow[vectorNumber].h32 = h32;
+            _vectorDirty[vectorNumber] &= ~kVectorDirtyHigh;
+        } else {
+            _mmioWritesSaved += 2;
+        }
+    }
+
+    // Announce a walk of the shared handler chain of a vector, and end
+    // it. The slot returned by the first must be passed to the second.
+    inline UInt32 enterSharedReaders(IOInterruptVectorNumber vectorNumber)
+    {
+        VectorState *state = &_vectorState[vectorNumber];
+        UInt32 slot = state->sharedEpoch & 1;
+
+        OSIncrementAtomic(&state->sharedReaders[slot]);
+        return slot;
+    }
+
+    inline void exitSharedReaders(IOInterruptVectorNumber vectorNumber, UInt32 slot)
+    {
+        OSDecrementAtomic(&_vectorState[vectorNumber].sharedReaders[slot]);
+    }
+
     inline IOReturn IOSimpleLockUnlockEnableInterruptRV(IOSimpleLock *lock, IOInterruptState state)
     {
         IOSimpleLockUnlock(lock);
         return ml_set_interrupts_enabled(state);
     }
 
-    inline IOReturn enableVectorEntry(IOInterruptVectorNumber vectorNumber)
+    // Update fields in the lower half of a vector table entry. A
+    // compare and swap keeps concurrent mask bit flips intact.
+    inline void modifyVectorEntryLow(IOInterruptVectorNumber vectorNumber, UInt32 clearBits, UInt32 setBits)
+    {
+        UInt32 oldL32;
+        do {
+            oldL32 = _vectorTable[vectorNumber].l32;
+        } while (!OSCompareAndSwap(oldL32, (oldL32 & ~clearBits) | setBits, &_vectorTable[vectorNumber].l32));
+    }
+
+    // Write the lower half of a vector entry to the hardware. The
+    // spinlock only serializes the IND/DAT register pair, and the
+    // entry is read from the table while holding it, so racing mask
+    // updates always leave the hardware with the latest table state.
+    inline IOReturn writeVectorEntryLow(IOInterruptVectorNumber vectorNumber)
     {
         IOInterruptState state;
         state = IOSimpleLockLockDisableInterrupt(_apicLock);
-        _vectorTable[vectorNumber].l32 &= ~kRTLOMaskDisabled;
-        indexWrite(kIndexRTLO + (vectorNumber * 2), _vectorTable[vectorNumber].l32);
+        // Entries left alone on wake still need their upper half.
+        if (_vectorDirty[vectorNumber] & kVectorDirtyHigh)
+        {
+            updateRemapEntry(vectorNumber);
+            writeVectorHighLocked(vectorNumber, _vectorTable[vectorNumber].h32);
+        }
+        writeVectorLowLocked(vectorNumber, _vectorTable[vectorNumber].l32);
         return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
     }
 
+    inline void setVectorMapBit(volatile UInt32 *map, IOInterruptVectorNumber vectorNumber)
+    {
+        OSBitOrAtomic(1 << (vectorNumber & 31), &map[vectorNumber >> 5]);
+    }
+
+    inline void clearVectorMapBit(volatile UInt32 *map, IOInterruptVectorNumber vectorNumber)
+    {
+        OSBitAndAtomic(~(1 << (vectorNumber & 31)), &map[vectorNumber >> 5]);
+    }
+
+    // Enable or disable (mask) a vector entry. The mask bit in the
+    // vector table is flipped atomically without the spinlock, and
+    // the hardware is only written when the bit actually changed.
+    inline IOReturn enableVectorEntry(IOInterruptVectorNumber vectorNumber)
+    {
+        UInt32 oldL32;
+        oldL32 = OSBitAndAtomic((UInt32)~kRTLOMaskDisabled, &_vectorTable[vectorNumber].l32);
+        if ((oldL32 & kRTLOMaskMask) == kRTLOMaskEnabled)
+        {
+            return kIOReturnSuccess;
+        }
+        if (__builtin_expect(_traceEnabled, 0))
+        {
+            traceEvent(kTraceEventUnmask, vectorNumber, 0, readTimestamp(), 0);
+        }
+        setVectorMapBit(_vectorEnabledMap, vectorNumber);
+        return writeVectorEntryLow(vectorNumber);
+    }
+
     inline IOReturn disableVectorEntry(IOInterruptVectorNumber vectorNumber)
     {
-        IOInterruptState state;
-        state = IOSimpleLockLockDisableInterrupt(_apicLock);
-        _vectorTable[vectorNumber].l32 |= kRTLOMaskDisabled;
-        indexWrite(kIndexRTLO + (vectorNumber * 2), _vectorTable[vectorNumber].l32);
-        return IOSimpleLockUnlockEnableInterruptRV(_apicLock, state);
+        UInt32 oldL32;
+        oldL32 = OSBitOrAtomic(kRTLOMaskDisabled, &_vectorTable[vectorNumber].l32);
+        if ((oldL32 & kRTLOMaskMask) == kRTLOMaskDisabled)
+        {
+            return kIOReturnSuccess;
+        }
+        if (__builtin_expect(_traceEnabled, 0))
+        {
+            traceEvent(kTraceEventMask, vectorNumber, 0, readTimestamp(), 0);
+        }
+        clearVectorMapBit(_vectorEnabledMap, vectorNumber);
+        return writeVectorEntryLow(vectorNumber);
     }
 
     IOReturn resetVectorTable(void);
+    void invalidateRegisterShadow(void);
+    void writeVectorEntryLocked(IOInterruptVectorNumber vectorNumber, VectorEntry entry);
     IOReturn writeVectorEntry(IOInterruptVectorNumber vectorNumber);
     IOReturn writeVectorEntry(IOInterruptVectorNumber vectorNumber, VectorEntry entry);
+    IOReturn writeVectorEntries(const VectorEntry *entries, const IOInterruptVectorNumber *vectorNumbers,
+                                IOInterruptVectorNumber count);
     IOReturn dumpRegisters(void);
+    IOReturn snapshotRegisters(APICRegisterSnapshot *snapshot);
+    UInt32 compareRegisterSnapshot(const APICRegisterSnapshot *snapshot, UInt32 *driftMap);
+    IOInterruptVectorNumber collectVectors(const volatile UInt32 *map1, const volatile UInt32 *map2);
     IOReturn prepareForSleep(void);
     IOReturn prepareForDeepIdle(UInt32 vectorNumber);
     IOReturn resumeFromSleep(void);
 
     IOReturn setVectorPhysicalDestination(UInt32 vectorNumber, UInt32 apicID);
+    void directedEndOfInterrupt(IOInterruptVectorNumber vectorNumber);
+
+    UInt32 decodeSpecifier(OSData *vectorData);
+    UInt32 lookupSpecifier(IOService *nub, int source);
+    void cacheSpecifier(IOService *nub, int source);
+    bool vectorIsShareable(IOService *nub, int source);
+    SharedHandler *findSharedHandler(IOInterruptVectorNumber vectorNumber, IOService *nub, int source,
+                                     UInt32 *readerSlot);
+    bool dispatchSharedHandlers(IOInterruptVectorNumber vectorNumber);
+    bool sharedHandlersEnabled(IOInterruptVectorNumber vectorNumber);
+    void waitForSharedReaders(IOInterruptVectorNumber vectorNumber);
+    IOReturn promoteSharedHandler(IOInterruptVectorNumber vectorNumber);
+    bool lockSharedVector(IOInterruptVectorNumber vectorNumber);
+
+    bool startThreadedVector(IOInterruptVectorNumber vectorNumber, IOService *nub);
+    void stopThreadedVector(IOInterruptVectorNumber vectorNumber);
+    void deferInterrupt(IOInterruptVectorNumber vectorNumber);
+    void threadedInterrupt(IOInterruptVectorNumber vectorNumber);
+    void waitForThreadedInterrupt(IOInterruptVectorNumber vectorNumber);
+    static void threadedInterruptCall(thread_call_param_t param0, thread_call_param_t param1);
+    IOReturn setVectorLogicalDestination(UInt32 vectorNumber, UInt32 destination, bool lowestPriority);
+    void setVectorRouting(IOInterruptVectorNumber vectorNumber, UInt32 destination, UInt32 routingModes);
+    void updateRemapEntry(IOInterruptVectorNumber vectorNumber);
+    bool startInterruptRemapping(IOService *provider);
+    UInt32 maxDestination(bool physical);
+    IOReturn getInterruptRemapTable(IOBufferMemoryDescriptor **table, UInt32 *indexBase,
+                                    APICRemapInvalidateFunction invalidate, void *refCon);
+
+    UInt32 getTunable(IOService *provider, const char *key, UInt32 defaultValue);
+    bool startBalancer(IOService *provider);
+    bool allocateVectorCounters(IOInterruptVectorNumber vectorNumber);
+    void sumVectorCounters(IOInterruptVectorNumber vectorNumber, VectorCounters *total);
+    void sampleVectorRates(void);
+    void balanceVectors(void);
+    static void balancerTimer(thread_call_param_t param0, thread_call_param_t param1);
+
+    bool startStormDetector(IOService *provider);
+    void countInterruptStorm(IOInterruptVectorNumber vectorNumber);
+    void checkInterruptStorm(IOInterruptVectorNumber vectorNumber);
+    void armStormTimer(UInt64 deadline);
+    void releaseStormVectors(void);
+    static void stormTimer(thread_call_param_t param0, thread_call_param_t param1);
+
+    IOReturn setInterruptTrace(bool enable);
+    void traceEvent(UInt8 event, IOInterruptVectorNumber vectorNumber, UInt32 argument,
+                    UInt64 entryTime, UInt64 exitTime);
+    IOReturn drainInterruptTrace(TraceRecord *records, UInt32 *count, UInt32 *lost);
+
+    void allocateLatencyHistogram(IOInterruptVectorNumber vectorNumber);
+    void measureLatencyRecording(void);
+    void resetLatencyHistograms(void);
+    void publishLatency(IOInterruptVectorNumber vectorNumber, OSDictionary *dict);
+
+    void publishStatistics(void);
+    bool startStatisticsExport(IOService *provider);
+    void updateStatisticsExport(void);
+    static void statisticsTimer(thread_call_param_t param0, thread_call_param_t param1);
+    void publishSleepWakeHistory(void);
+
+    bool registerGlobalSystemInterrupts(void);
+    void unregisterGlobalSystemInterrupts(void);
+    IOReturn setGlobalSystemInterruptDestination(UInt32 gsi, UInt32 apicID);
 
     virtual void free(void);
 
 public:
     virtual bool start(IOService * provider);
+    virtual void stop(IOService * provider);
 
     virtual IOReturn getInterruptType(IOService *nub, int source, int *interruptType);
     virtual IOReturn registerInterrupt(IOService *nub, int source, void *target,
                                        IOInterruptHandler handler, void *refCon);
+    virtual IOReturn unregisterInterrupt(IOService *nub, int source);
+    virtual IOReturn enableInterrupt(IOService *nub, int source);
+    virtual IOReturn disableInterrupt(IOService *nub, int source);
 
     virtual void initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector);
     virtual bool vectorCanBeShared(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector);
@@ -232,6 +929,14 @@ public:
 
     virtual IOReturn callPlatformFunction(const OSSymbol *function, bool waitForFunction,
                                           void *param1, void *param2, void *param3, void *param4);
+
+    virtual bool serializeProperties(OSSerialize *s) const;
+
+    static AppleAPIC *lookupGlobalSystemInterrupt(UInt32 gsi, IOInterruptVectorNumber *pin);
+
+    IOReturn openStatistics(void);
+    void closeStatistics(void);
+    IOMemoryDescriptor *getStatisticsMemory(void);
 };
 
 #endif /* !_IOKIT_APPLEAPIC_H */
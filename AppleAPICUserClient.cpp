@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ * 
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <IOKit/IOLib.h>
+
+#include "AppleAPICUserClient.h"
+#include "PICShared.h"
+
+#define super IOUserClient
+OSDefineMetaClassAndStructors(AppleAPICUserClient, IOUserClient)
+
+//---------------------------------------------------------------------------
+bool AppleAPICUserClient::initWithTask(task_t owningTask, void *securityID, UInt32 type)
+{
+    if (type != kAPICStatisticsMemoryType)
+    {
+        return false;
+    }
+
+    // The statistics show which devices interrupt and how often, which
+    // is no business of an unprivileged task.
+    if (clientHasPrivilege(securityID, kIOClientPrivilegeAdministrator) != kIOReturnSuccess)
+    {
+        return false;
+    }
+
+    return super::initWithTask(owningTask, securityID, type);
+}
+
+//---------------------------------------------------------------------------
+bool AppleAPICUserClient::start(IOService *provider)
+{
+    _apic = OSDynamicCast(AppleAPIC, provider);
+    if (0 == _apic)
+    {
+        return false;
+    }
+
+    if (!super::start(provider))
+    {
+        return false;
+    }
+
+    // Keep the shared statistics updated for as long as we are open.
+    if (_apic->openStatistics() != kIOReturnSuccess)
+    {
+        return false;
+    }
+
+    _statisticsOpen = true;
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void AppleAPICUserClient::stop(IOService *provider)
+{
+    if (_statisticsOpen)
+    {
+        _apic->closeStatistics();
+        _statisticsOpen = false;
+    }
+
+    super::stop(provider);
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPICUserClient::clientClose(void)
+{
+    terminate();
+
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+IOReturn AppleAPICUserClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
+{
+    IOMemoryDescriptor *statistics;
+
+    if (type != kAPICStatisticsMemoryType)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    statistics = _apic->getStatisticsMemory();
+    if (0 == statistics)
+    {
+        return kIOReturnNotReady;
+    }
+
+    // The mapping is released by the caller.
+    statistics->retain();
+
+    *options = kIOMapReadOnly;
+    *memory = statistics;
+
+    return kIOReturnSuccess;
+}
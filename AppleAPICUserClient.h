@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ * 
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOKIT_APPLEAPICUSERCLIENT_H
+#define _IOKIT_APPLEAPICUSERCLIENT_H 1
+
+#include <IOKit/IOUserClient.h>
+
+#include "AppleAPIC.h"
+
+/*
+ * User client for monitoring tools. It has no methods, and only hands
+ * out a read-only mapping of the statistics region of its AppleAPIC,
+ * laid out as APICStatistics in PICShared.h.
+ */
+
+class AppleAPICUserClient : public IOUserClient
+{
+    OSDeclareDefaultStructors(AppleAPICUserClient)
+
+protected:
+    AppleAPIC *_apic;
+    bool _statisticsOpen;
+
+public:
+    virtual bool initWithTask(task_t owningTask, void *securityID, UInt32 type);
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+
+    virtual IOReturn clientClose(void);
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory);
+};
+
+#endif /* !_IOKIT_APPLEAPICUSERCLIENT_H */
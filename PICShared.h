@@ -60,12 +60,112 @@ enum {
 #define kVectorCountKey               "Vector Count"
 #define kPhysicalAddressKey           "Physical Address"
 #define kTimerVectorNumberKey         "Timer Vector Number"
+#define kLogicalDestinationKey        "Logical Destination"
+#define kLowestPriorityDeliveryKey    "Lowest Priority Delivery"
+#define kThreadedInterruptKey         "Threaded Interrupt"
+#define kExtendedDestinationIDKey     "Extended Destination ID"
+#define kInterruptRemapIndexKey       "Interrupt Remap Index"
+#define kInterruptRemapX2APICKey      "Interrupt Remap x2APIC"
 
 /*
  * callPlatformFunction function names.
  */
 #define kHandleDeepIdleFunction       "HandleDeepIdle"
 #define kHandleSleepWakeFunction      "HandleSleepWake"
+#define kSetVectorTypeFunction        "SetVectorType"
 #define kSetVectorPhysicalDestination "SetVectorPhysicalDestination"
+#define kSetVectorLogicalDestination  "SetVectorLogicalDestination"
+#define kGetInterruptRemapTable       "GetInterruptRemapTable"
+#define kLookupGlobalSystemInterrupt  "LookupGlobalSystemInterrupt"
+#define kSetGlobalSystemInterruptDestination "SetGlobalSystemInterruptDestination"
+#define kSetInterruptTrace            "SetInterruptTrace"
+#define kDrainInterruptTrace          "DrainInterruptTrace"
+#define kResetInterruptLatency        "ResetInterruptLatency"
+#define kGetRegisterSnapshot          "GetRegisterSnapshot"
+#define kCompareRegisterSnapshot      "CompareRegisterSnapshot"
+
+/*
+ * Interrupt entry cache invalidation, handed to the I/O APIC with
+ * GetInterruptRemapTable by the owner of the remapping hardware. Called
+ * with the index of every remapping table entry after it is updated,
+ * with interrupts disabled and a spinlock held, so it must not block.
+ */
+typedef void (*APICRemapInvalidateFunction)(void *refCon, UInt32 index);
+
+/*
+ * Statistics shared read-only with user space. AppleAPICUserClient maps
+ * them as memory type kAPICStatisticsMemoryType. The sequence is odd
+ * while the kernel updates the region, so a reader copies what it needs
+ * and retries if the sequence was odd or changed across the copy.
+ */
+#define kAPICStatisticsVersion        1
+
+enum {
+    kAPICStatisticsMemoryType  = 0
+};
+
+enum {
+    kAPICVectorRegistered      = 0x01,
+    kAPICVectorMasked          = 0x02,
+    kAPICVectorLogical         = 0x04,
+    kAPICVectorLevel           = 0x08,
+    kAPICVectorThrottled       = 0x10
+};
+
+typedef struct APICVectorStatistics {
+    UInt64 delivered;
+    UInt64 spurious;
+    UInt64 softDisabled;
+    UInt64 hardDisabled;
+    UInt64 handlerCycles;
+    UInt32 vector;             /* system vector number           */
+    UInt32 destination;        /* APIC ID or logical destination */
+    UInt32 flags;              /* kAPICVector flags              */
+    UInt32 reserved;
+} APICVectorStatistics;
+
+typedef struct APICStatistics {
+    volatile UInt32 sequence;
+    UInt32 version;            /* kAPICStatisticsVersion         */
+    UInt32 vectorBase;
+    UInt32 vectorCount;
+    UInt32 vectorOffset;       /* to APICVectorStatistics[]      */
+    UInt32 cpuCount;
+    UInt32 cpuOffset;          /* to UInt64 delivered per CPU    */
+    UInt32 reserved;
+    UInt64 updateTime;         /* mach_absolute_time() of update */
+    UInt64 updateCount;
+    UInt64 updateCycles;       /* TSC cycles of the last update  */
+    UInt32 updateInterval;     /* microseconds between updates   */
+    UInt32 reserved2;
+} APICStatistics;
+
+/*
+ * Raw I/O APIC register contents, read under a single hold of the
+ * register lock. Redirection table entries sit at index 0x10 and up,
+ * so a controller has at most kAPICSnapshotMaxEntries of them.
+ */
+#define kAPICRegisterSnapshotVersion  1
+
+enum {
+    kAPICSnapshotMaxEntries    = 120,
+    kAPICSnapshotMapWords      = (kAPICSnapshotMaxEntries + 31) / 32
+};
+
+typedef struct APICRegisterSnapshot {
+    UInt32 version;            /* kAPICRegisterSnapshotVersion   */
+    UInt32 vectorBase;
+    UInt32 vectorCount;        /* valid entries[]                */
+    UInt32 reserved;
+    UInt64 timestamp;          /* mach_absolute_time() of read   */
+    UInt32 id;                 /* ID register                    */
+    UInt32 ver;                /* VER register                   */
+    UInt32 arb;                /* ARB register                   */
+    UInt32 boot;               /* BOOT register                  */
+    struct {
+        UInt32 l32;
+        UInt32 h32;
+    } entries[kAPICSnapshotMaxEntries];
+} APICRegisterSnapshot;
 
 #endif /* !_IOKIT_PICSHARED_H */
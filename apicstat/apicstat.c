@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ * 
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * apicstat - live interrupt monitor for AppleAPIC interrupt controllers.
+ *
+ * Every AppleAPICInterruptController is found in the I/O Registry and its
+ * statistics region is mapped read-only through AppleAPICUserClient, so
+ * sampling never enters the kernel. The kernel side cost is the periodic
+ * refresh of the region while it is mapped, which is reported with each
+ * sample and bounded by the driver's minimum "Statistics Interval".
+ *
+ * Build with:
+ *   cc -Wall -O2 -o apicstat apicstat.c -framework IOKit -framework CoreFoundation
+ *
+ * The host harness also builds it, against the controllers running in
+ * its own process (harness/usershim).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sysctl.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <AvailabilityMacros.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+
+#include "../PICShared.h"
+
+#define kControllerClass  "AppleAPICInterruptController"
+#define kMaxControllers   16
+#define kMaxSnapshotTries 100
+#define kMaxUpdateWaits   100
+
+// kIOMainPortDefault replaced kIOMasterPortDefault in macOS 12. Both are
+// MACH_PORT_NULL, which older systems take as the default port too.
+#if defined(MAC_OS_VERSION_12_0) && (MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_VERSION_12_0)
+#define kMainPort         kIOMainPortDefault
+#else
+#define kMainPort         MACH_PORT_NULL
+#endif
+
+typedef struct Controller {
+    io_connect_t connect;
+    mach_vm_address_t address;
+    mach_vm_size_t size;
+    UInt32 vectorBase;
+    UInt32 vectorCount;
+    UInt8 *current;                 /* consistent copy of the region */
+    UInt8 *previous;
+    bool havePrevious;
+} Controller;
+
+typedef struct VectorRow {
+    const APICVectorStatistics *stats;
+    double rate;
+    UInt64 cycles;                  /* handler cycles per interrupt  */
+} VectorRow;
+
+static Controller gControllers[kMaxControllers];
+static int gControllerCount;
+static mach_timebase_info_data_t gTimebase;
+static UInt64 gTSCFrequency;
+
+//---------------------------------------------------------------------------
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: apicstat [-i interval] [-n count] [-a] [-j]\n"
+            "  -i interval  seconds between samples, fractions allowed (default 1)\n"
+            "  -n count     number of samples, 0 for no limit (default 0)\n"
+            "  -a           show idle vectors too\n"
+            "  -j           one JSON object per controller and sample\n");
+    exit(1);
+}
+
+//---------------------------------------------------------------------------
+static bool getNumberProperty(io_service_t service, const char *key, UInt32 *value)
+{
+    CFStringRef name;
+    CFTypeRef property;
+    bool found = false;
+
+    name = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+    property = IORegistryEntryCreateCFProperty(service, name, kCFAllocatorDefault, 0);
+    CFRelease(name);
+
+    if (property)
+    {
+        if (CFGetTypeID(property) == CFNumberGetTypeID())
+        {
+            found = CFNumberGetValue((CFNumberRef)property, kCFNumberSInt32Type, value);
+        }
+
+        CFRelease(property);
+    }
+
+    return found;
+}
+
+//---------------------------------------------------------------------------
+// Find every I/O APIC and map its statistics region.
+//---------------------------------------------------------------------------
+static void openControllers(void)
+{
+    const APICStatistics *stats;
+    Controller *controller;
+    io_iterator_t iterator;
+    io_service_t service;
+    kern_return_t kr;
+
+    kr = IOServiceGetMatchingServices(kMainPort, IOServiceMatching(kControllerClass), &iterator);
+    if (kr != KERN_SUCCESS)
+    {
+        fprintf(stderr, "apicstat: no %s found (0x%x)\n", kControllerClass, kr);
+        exit(1);
+    }
+
+    // Stop at the table size before taking another service, which would
+    // otherwise be leaked.
+    while ((gControllerCount < kMaxControllers) && (service = IOIteratorNext(iterator)))
+    {
+        controller = &gControllers[gControllerCount];
+
+        if ((!getNumberProperty(service, kBaseVectorNumberKey, &controller->vectorBase)) ||
+            (!getNumberProperty(service, kVectorCountKey, &controller->vectorCount)))
+        {
+            IOObjectRelease(service);
+            continue;
+        }
+
+        kr = IOServiceOpen(service, mach_task_self(), kAPICStatisticsMemoryType, &controller->connect);
+        IOObjectRelease(service);
+
+        if (kr != KERN_SUCCESS)
+        {
+            fprintf(stderr, "apicstat: cannot open I/O APIC %u (0x%x)\n", controller->vectorBase, kr);
+            continue;
+        }
+
+        kr = IOConnectMapMemory64(controller->connect, kAPICStatisticsMemoryType, mach_task_self(),
+                                  &controller->address, &controller->size, kIOMapAnywhere | kIOMapReadOnly);
+        if (kr != KERN_SUCCESS)
+        {
+            fprintf(stderr, "apicstat: cannot map I/O APIC %u (0x%x)\n", controller->vectorBase, kr);
+            IOServiceClose(controller->connect);
+            continue;
+        }
+
+        stats = (const APICStatistics *)(uintptr_t)controller->address;
+        if ((stats->version != kAPICStatisticsVersion) || (stats->vectorCount != controller->vectorCount))
+        {
+            fprintf(stderr, "apicstat: I/O APIC %u has an unknown statistics layout\n", controller->vectorBase);
+            IOConnectUnmapMemory64(controller->connect, kAPICStatisticsMemoryType, mach_task_self(),
+                                   controller->address);
+            IOServiceClose(controller->connect);
+            continue;
+        }
+
+        controller->current = (UInt8 *)malloc(controller->size);
+        controller->previous = (UInt8 *)malloc(controller->size);
+        if ((0 == controller->current) || (0 == controller->previous))
+        {
+            fprintf(stderr, "apicstat: out of memory\n");
+            exit(1);
+        }
+
+        gControllerCount++;
+    }
+
+    IOObjectRelease(iterator);
+
+    if (0 == gControllerCount)
+    {
+        fprintf(stderr, "apicstat: no usable %s found\n", kControllerClass);
+        exit(1);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Copy a consistent snapshot of the region, retrying while the kernel is
+// in the middle of an update.
+//---------------------------------------------------------------------------
+static bool takeSnapshot(Controller *controller)
+{
+    const volatile APICStatistics *stats = (const volatile APICStatistics *)(uintptr_t)controller->address;
+    UInt32 sequence;
+    int tries = 0;
+    UInt8 *swap;
+
+    swap = controller->previous;
+    controller->previous = controller->current;
+    controller->current = swap;
+
+    for (tries = 0; tries < kMaxSnapshotTries; tries++)
+    {
+        sequence = stats->sequence;
+        if (sequence & 1)
+        {
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(controller->current, (const void *)(uintptr_t)controller->address, controller->size);
+        __sync_synchronize();
+
+        if (stats->sequence == sequence)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------------
+// The region is all zero until the first update after the open. Wait for
+// it, so that the baseline has a time to compute rates from.
+//---------------------------------------------------------------------------
+static bool waitForFirstUpdate(Controller *controller)
+{
+    const volatile APICStatistics *stats = (const volatile APICStatistics *)(uintptr_t)controller->address;
+    int waits = 0;
+
+    for (waits = 0; waits < kMaxUpdateWaits; waits++)
+    {
+        if (stats->updateTime != 0)
+        {
+            return true;
+        }
+
+        usleep(stats->updateInterval ? stats->updateInterval : 1000);
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------------
+static int compareRows(const void *a, const void *b)
+{
+    const VectorRow *rowA = (const VectorRow *)a;
+    const VectorRow *rowB = (const VectorRow *)b;
+
+    if (rowA->rate != rowB->rate)
+    {
+        return (rowA->rate < rowB->rate) ? 1 : -1;
+    }
+
+    return (int)rowA->stats->vector - (int)rowB->stats->vector;
+}
+
+//---------------------------------------------------------------------------
+static void flagString(UInt32 flags, char *string)
+{
+    string[0] = (flags & kAPICVectorRegistered) ? 'R' : '-';
+    string[1] = (flags & kAPICVectorMasked)     ? 'M' : '-';
+    string[2] = (flags & kAPICVectorLevel)      ? 'L' : 'E';
+    string[3] = (flags & kAPICVectorLogical)    ? 'G' : 'P';
+    string[4] = (flags & kAPICVectorThrottled)  ? 'T' : '-';
+    string[5] = '\0';
+}
+
+//---------------------------------------------------------------------------
+static void printController(Controller *controller, bool showAll, bool json)
+{
+    const APICStatistics *now = (const APICStatistics *)controller->current;
+    const APICStatistics *then = (const APICStatistics *)controller->previous;
+    const APICVectorStatistics *vectors;
+    const APICVectorStatistics *oldVectors;
+    const UInt64 *cpuDelivered;
+    const UInt64 *oldCPUDelivered;
+    VectorRow rows[256];
+    UInt64 delivered;
+    double seconds;
+    double overhead = 0;
+    char flags[6];
+    UInt32 rowCount = 0;
+    UInt32 i;
+
+    vectors = (const APICVectorStatistics *)((const UInt8 *)now + now->vectorOffset);
+    oldVectors = (const APICVectorStatistics *)((const UInt8 *)then + then->vectorOffset);
+    cpuDelivered = (const UInt64 *)((const UInt8 *)now + now->cpuOffset);
+    oldCPUDelivered = (const UInt64 *)((const UInt8 *)then + then->cpuOffset);
+
+    seconds = (double)(now->updateTime - then->updateTime) * gTimebase.numer / gTimebase.denom / 1e9;
+    if (seconds <= 0)
+    {
+        seconds = 1e-9;
+    }
+
+    // Fraction of one CPU spent refreshing the region.
+    if ((gTSCFrequency) && (now->updateInterval))
+    {
+        overhead = ((double)now->updateCycles / gTSCFrequency) / (now->updateInterval / 1e6);
+    }
+
+    for (i = 0; (i < now->vectorCount) && (i < 256); i++)
+    {
+        delivered = vectors[i].delivered - oldVectors[i].delivered;
+
+        if ((!showAll) && (0 == delivered) && (!(vectors[i].flags & kAPICVectorRegistered)))
+        {
+            continue;
+        }
+
+        rows[rowCount].stats = &vectors[i];
+        rows[rowCount].rate = delivered / seconds;
+        rows[rowCount].cycles = delivered ? ((vectors[i].handlerCycles - oldVectors[i].handlerCycles) / delivered) : 0;
+        rowCount++;
+    }
+
+    qsort(rows, rowCount, sizeof(VectorRow), compareRows);
+
+    if (json)
+    {
+        printf("{\"base\":%u,\"time\":%llu,\"seconds\":%.6f,\"updateCycles\":%llu,\"updateInterval\":%u,\"cpus\":[",
+               now->vectorBase, (unsigned long long)now->updateTime, seconds,
+               (unsigned long long)now->updateCycles, now->updateInterval);
+
+        for (i = 0; i < now->cpuCount; i++)
+        {
+            printf("%s%.1f", i ? "," : "", (cpuDelivered[i] - oldCPUDelivered[i]) / seconds);
+        }
+
+        printf("],\"vectors\":[");
+
+        for (i = 0; i < rowCount; i++)
+        {
+            printf("%s{\"vector\":%u,\"rate\":%.1f,\"total\":%llu,\"spurious\":%llu,\"destination\":%u,"
+                   "\"registered\":%s,\"masked\":%s,\"level\":%s,\"logical\":%s,\"throttled\":%s,\"cycles\":%llu}",
+                   i ? "," : "", rows[i].stats->vector, rows[i].rate,
+                   (unsigned long long)rows[i].stats->delivered, (unsigned long long)rows[i].stats->spurious,
+                   rows[i].stats->destination,
+                   (rows[i].stats->flags & kAPICVectorRegistered) ? "true" : "false",
+                   (rows[i].stats->flags & kAPICVectorMasked) ? "true" : "false",
+                   (rows[i].stats->flags & kAPICVectorLevel) ? "true" : "false",
+                   (rows[i].stats->flags & kAPICVectorLogical) ? "true" : "false",
+                   (rows[i].stats->flags & kAPICVectorThrottled) ? "true" : "false",
+                   (unsigned long long)rows[i].cycles);
+        }
+
+        printf("]}\n");
+        return;
+    }
+
+    printf("I/O APIC vectors %u-%u   kernel update %llu cycles every %u us (%.3f%% of a CPU)\n",
+           now->vectorBase, now->vectorBase + now->vectorCount - 1,
+           (unsigned long long)now->updateCycles, now->updateInterval, overhead * 100);
+
+    printf("CPU   ");
+    for (i = 0; i < now->cpuCount; i++)
+    {
+        printf(" %8u", i);
+    }
+    printf("\nIRQ/s ");
+    for (i = 0; i < now->cpuCount; i++)
+    {
+        printf(" %8.0f", (cpuDelivered[i] - oldCPUDelivered[i]) / seconds);
+    }
+
+    printf("\n\n%6s %10s %14s %10s %6s %6s %8s\n", "VECTOR", "RATE/s", "TOTAL", "SPURIOUS", "DEST", "FLAGS", "CYCLES");
+
+    for (i = 0; i < rowCount; i++)
+    {
+        flagString(rows[i].stats->flags, flags);
+        printf("%6u %10.0f %14llu %10llu %6u %6s %8llu\n", rows[i].stats->vector, rows[i].rate,
+               (unsigned long long)rows[i].stats->delivered, (unsigned long long)rows[i].stats->spurious,
+               rows[i].stats->destination, flags, (unsigned long long)rows[i].cycles);
+    }
+
+    printf("\n");
+}
+
+//---------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    double interval = 1.0;
+    long count = 0;
+    long sample = 0;
+    bool showAll = false;
+    bool json = false;
+    size_t size = sizeof(gTSCFrequency);
+    int ch;
+    int i;
+
+    while ((ch = getopt(argc, argv, "i:n:aj")) != -1)
+    {
+        switch (ch)
+        {
+            case 'i':
+                interval = atof(optarg);
+                if (interval <= 0)
+                {
+                    usage();
+                }
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'a':
+                showAll = true;
+                break;
+            case 'j':
+                json = true;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    mach_timebase_info(&gTimebase);
+    if (sysctlbyname("machdep.tsc.frequency", &gTSCFrequency, &size, 0, 0) != 0)
+    {
+        gTSCFrequency = 0;
+    }
+
+    openControllers();
+
+    // The first snapshot is only a baseline for the rates.
+    for (i = 0; i < gControllerCount; i++)
+    {
+        if (!waitForFirstUpdate(&gControllers[i]))
+        {
+            fprintf(stderr, "apicstat: I/O APIC %u is not updating its statistics\n",
+                    gControllers[i].vectorBase);
+        }
+
+        gControllers[i].havePrevious = takeSnapshot(&gControllers[i]) &&
+                                       (0 != ((const APICStatistics *)gControllers[i].current)->updateTime);
+    }
+
+    while ((0 == count) || (sample < count))
+    {
+        usleep((useconds_t)(interval * 1e6));
+
+        if (!json)
+        {
+            printf("\033[H\033[2J");
+        }
+
+        for (i = 0; i < gControllerCount; i++)
+        {
+            if (!takeSnapshot(&gControllers[i]))
+            {
+                fprintf(stderr, "apicstat: I/O APIC %u kept changing, sample skipped\n",
+                        gControllers[i].vectorBase);
+                gControllers[i].havePrevious = false;
+                continue;
+            }
+
+            // Without an update yet, there is no time to rate against.
+            if (0 == ((const APICStatistics *)gControllers[i].current)->updateTime)
+            {
+                gControllers[i].havePrevious = false;
+                continue;
+            }
+
+            if (gControllers[i].havePrevious)
+            {
+                printController(&gControllers[i], showAll, json);
+            }
+
+            gControllers[i].havePrevious = true;
+        }
+
+        fflush(stdout);
+        sample++;
+    }
+
+    for (i = 0; i < gControllerCount; i++)
+    {
+        IOConnectUnmapMemory64(gControllers[i].connect, kAPICStatisticsMemoryType, mach_task_self(),
+                               gControllers[i].address);
+        IOServiceClose(gControllers[i].connect);
+    }
+
+    return 0;
+}
@@ -0,0 +1,447 @@
+/*
+ * Test and benchmark support for the host harness: check macros, timing,
+ * and fixtures that start an AppleAPIC on a simulated I/O APIC, and an
+ * Apple8259PIC on the simulated PIC pair.
+ */
+
+#ifndef _HARNESS_HARNESS_H
+#define _HARNESS_HARNESS_H
+
+#include <IOKitShim.h>
+#include <IOAPICSim.h>
+#include <PICSim.h>
+
+#include "AppleAPIC.h"
+#include "Apple8259PIC.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Checks. A failed check is reported and counted, and the test goes on. */
+
+static int gHarnessFailures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            gHarnessFailures++;                                             \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                      \
+    do {                                                                    \
+        unsigned long long _a = (unsigned long long)(a);                    \
+        unsigned long long _b = (unsigned long long)(b);                    \
+        if (_a != _b)                                                       \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: 0x%llx != 0x%llx\n", \
+                    __FILE__, __LINE__, #a, #b, _a, _b);                    \
+            gHarnessFailures++;                                             \
+        }                                                                   \
+    } while (0)
+
+static inline int harnessResult(const char *name)
+{
+    if (gHarnessFailures)
+    {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, gHarnessFailures);
+        return 1;
+    }
+
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+/* Timing */
+
+static inline UInt64 harnessNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((UInt64)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// Benchmarks take --quick from ctest, and run a fraction of the work.
+static inline bool harnessQuick(int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--quick"))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Simulated CPUs. Each thread runs body(cpu, arg) as its own CPU. */
+
+typedef void (*HarnessThreadBody)(UInt32 cpu, void *arg);
+
+struct HarnessThread {
+    pthread_t thread;
+    HarnessThreadBody body;
+    void *arg;
+    UInt32 cpu;
+};
+
+static void *harnessThreadMain(void *param)
+{
+    HarnessThread *thread = (HarnessThread *)param;
+
+    ShimSetCPUNumber(thread->cpu);
+    thread->body(thread->cpu, thread->arg);
+
+    return 0;
+}
+
+static inline void harnessRunThreads(UInt32 count, HarnessThreadBody body, void *arg)
+{
+    HarnessThread *threads = new HarnessThread[count];
+    UInt32 i;
+
+    assert(count <= ml_get_max_cpus());
+
+    for (i = 0; i < count; i++)
+    {
+        threads[i].body = body;
+        threads[i].arg = arg;
+        threads[i].cpu = i;
+        pthread_create(&threads[i].thread, 0, harnessThreadMain, &threads[i]);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        pthread_join(threads[i].thread, 0);
+    }
+
+    delete [] threads;
+}
+
+/* The driver, with its internals opened up to the harness */
+
+class HarnessAPIC : public AppleAPIC
+{
+public:
+    using AppleAPIC::_vectorBase;
+    using AppleAPIC::_vectorCount;
+    using AppleAPIC::_vectorTable;
+    using AppleAPIC::_vectorShadow;
+    using AppleAPIC::_vectorDirty;
+    using AppleAPIC::_vectorState;
+    using AppleAPIC::_apicVersion;
+    using AppleAPIC::_directedEOI;
+    using AppleAPIC::_deferredProgramming;
+    using AppleAPIC::_mmioReads;
+    using AppleAPIC::_mmioWrites;
+    using AppleAPIC::_mmioWritesSaved;
+    using AppleAPIC::_eoiWrites;
+    using AppleAPIC::_stats;
+    using AppleAPIC::_statsClients;
+    using AppleAPIC::_statsLock;
+    using AppleAPIC::_vectorLocksAllocated;
+    using AppleAPIC::_apicLock;
+    using AppleAPIC::_counterSlot;
+    using AppleAPIC::_counterSlotsUsed;
+
+    using AppleAPIC::resetVectorTable;
+    using AppleAPIC::invalidateRegisterShadow;
+    using AppleAPIC::prepareForSleep;
+    using AppleAPIC::resumeFromSleep;
+    using AppleAPIC::setVectorPhysicalDestination;
+    using AppleAPIC::setVectorLogicalDestination;
+    using AppleAPIC::sampleVectorRates;
+    using AppleAPIC::balanceVectors;
+    using AppleAPIC::publishLatency;
+    using AppleAPIC::resetLatencyHistograms;
+    using AppleAPIC::sumVectorCounters;
+    using AppleAPIC::indexWrite;
+    using AppleAPIC::enableVectorEntry;
+    using AppleAPIC::disableVectorEntry;
+    using AppleAPIC::updateStatisticsExport;
+
+    UInt64 mmioAccesses(void) const { return _mmioReads + _mmioWrites + _eoiWrites; }
+};
+
+/* An I/O APIC and its driver. Tunables go on the provider before start(). */
+
+class APICFixture
+{
+public:
+    IOAPICSim *sim;
+    IOService *provider;
+    HarnessAPIC *apic;
+    UInt32 vectorBase;
+
+    APICFixture(UInt32 pins, UInt32 base = 0, UInt32 version = 0x20)
+        : sim(new IOAPICSim(pins, version)), provider(0), apic(0), vectorBase(base)
+    {
+        static UInt32 instance;
+        OSString *name;
+        char buffer[32];
+
+        _address = 0xFEC00000 + (instance++ * 0x1000);
+        ShimMapDevice(_address, sim);
+
+        snprintf(buffer, sizeof(buffer), "io-apic-%u", (unsigned)_address);
+        name = OSString::withCString(buffer);
+        provider = new IOService;
+        provider->init();
+        provider->setProperty(kPhysicalAddressKey, _address, 32);
+        provider->setProperty(kDestinationAPICIDKey, 0ULL, 32);
+        provider->setProperty(kBaseVectorNumberKey, base, 32);
+        provider->setProperty(kInterruptControllerNameKey, name);
+        name->release();
+    }
+
+    ~APICFixture()
+    {
+        UInt32 i;
+
+        for (i = 0; i < _nubCount; i++)
+        {
+            _nubs[i]->_interruptSources[0].vectorData->release();
+            delete [] _nubs[i]->_interruptSources;
+            _nubs[i]->release();
+        }
+
+        if (apic)
+        {
+            apic->release();
+        }
+
+        provider->release();
+        ShimUnmapDevice(_address);
+        delete sim;
+    }
+
+    void setTunable(const char *key, UInt32 value)
+    {
+        provider->setProperty(key, value, 32);
+    }
+
+    bool start(void)
+    {
+        apic = new HarnessAPIC;
+        apic->init();
+        return apic->start(provider);
+    }
+
+    // A nub with one interrupt source on the pin, with specifier flags
+    // from PICShared.h.
+    IOService *addNub(UInt32 pin, UInt32 flags)
+    {
+        IOService *nub;
+        UInt32 specifier[2];
+
+        assert(_nubCount < kMaxNubs);
+
+        specifier[0] = pin;
+        specifier[1] = flags;
+
+        nub = new IOService;
+        nub->init();
+        nub->_interruptSources = new IOInterruptSource[1];
+        nub->_interruptSources[0].interruptController = apic;
+        nub->_interruptSources[0].vectorData = OSData::withBytes(specifier, sizeof(specifier));
+        nub->_numInterruptSources = 1;
+
+        _nubs[_nubCount++] = nub;
+        return nub;
+    }
+
+    // Register and enable a handler for the pin on a new nub.
+    IOService *attach(UInt32 pin, UInt32 flags, IOInterruptHandler handler, void *refCon = 0)
+    {
+        IOService *nub = addNub(pin, flags);
+
+        if ((kIOReturnSuccess != apic->registerInterrupt(nub, 0, this, handler, refCon)) ||
+            (kIOReturnSuccess != apic->enableInterrupt(nub, 0)))
+        {
+            return 0;
+        }
+
+        return nub;
+    }
+
+    // Dispatch the pin's vector as the platform would on the CPU.
+    void dispatch(UInt32 pin)
+    {
+        bool enabled = ml_set_interrupts_enabled(FALSE);
+
+        ShimSetInterruptLevel(true);
+        apic->handleInterrupt(0, 0, vectorBase + pin);
+        ShimSetInterruptLevel(false);
+        ml_set_interrupts_enabled(enabled);
+    }
+
+    // Raise the pin. If the entry sends a message, dispatch it, and then
+    // have the local APIC broadcast its EOI, unless directed EOI is on.
+    // Returns whether the interrupt was delivered.
+    bool raise(UInt32 pin)
+    {
+        UInt32 vector;
+
+        if (!sim->assertPin(pin))
+        {
+            return false;
+        }
+
+        vector = sim->entryLow(pin) & IOAPICSim::kRTLOVectorMask;
+        dispatch(pin);
+
+        if (!apic->_directedEOI)
+        {
+            sim->broadcastEOI(vector);
+        }
+
+        return true;
+    }
+
+private:
+    enum { kMaxNubs = 256 };
+
+    IOPhysicalAddress _address;
+    IOService *_nubs[kMaxNubs];
+    UInt32 _nubCount = 0;
+};
+
+/* The 8259 PIC pair and its driver, on the one simulated PIC instance. */
+
+class HarnessPIC : public Apple8259PIC
+{
+public:
+    using Apple8259PIC::_interruptMasks;
+    using Apple8259PIC::_interruptTriggerTypes;
+    using Apple8259PIC::_autoEOI;
+    using Apple8259PIC::_portReads;
+    using Apple8259PIC::_portWrites;
+    using Apple8259PIC::_portWritesSaved;
+};
+
+class PICFixture
+{
+public:
+    PICSim *sim;
+    IOService *provider;
+    HarnessPIC *pic;
+
+    PICFixture(bool autoEOI = false, UInt16 triggerTypes = 0)
+        : sim(PICSim::instance()), provider(0), pic(0)
+    {
+        OSString *name = OSString::withCString("8259-pic");
+
+        sim->reset();
+        sim->setTriggerTypes(triggerTypes);
+
+        provider = new IOService;
+        provider->init();
+        provider->setProperty(kInterruptControllerNameKey, name);
+        provider->setProperty(kAutoEOIKey, autoEOI, 32);
+        name->release();
+    }
+
+    ~PICFixture()
+    {
+        UInt32 i;
+
+        for (i = 0; i < _nubCount; i++)
+        {
+            _nubs[i]->_interruptSources[0].vectorData->release();
+            delete [] _nubs[i]->_interruptSources;
+            _nubs[i]->release();
+        }
+
+        if (pic)
+        {
+            pic->release();
+        }
+
+        provider->release();
+    }
+
+    bool start(void)
+    {
+        pic = new HarnessPIC;
+        pic->init();
+        return pic->start(provider);
+    }
+
+    // Register and enable a handler for the IRQ on a new nub, with
+    // specifier flags from PICShared.h.
+    IOService *attach(UInt32 irq, UInt32 flags, IOInterruptHandler handler, void *refCon = 0)
+    {
+        IOService *nub;
+        UInt32 specifier[2];
+
+        assert(_nubCount < kMaxNubs);
+
+        specifier[0] = irq;
+        specifier[1] = flags;
+
+        nub = new IOService;
+        nub->init();
+        nub->_interruptSources = new IOInterruptSource[1];
+        nub->_interruptSources[0].interruptController = pic;
+        nub->_interruptSources[0].vectorData = OSData::withBytes(specifier, sizeof(specifier));
+        nub->_numInterruptSources = 1;
+        _nubs[_nubCount++] = nub;
+
+        if ((kIOReturnSuccess != pic->registerInterrupt(nub, 0, this, handler, refCon)) ||
+            (kIOReturnSuccess != pic->enableInterrupt(nub, 0)))
+        {
+            return 0;
+        }
+
+        return nub;
+    }
+
+    // Dispatch the IRQ's vector as the platform would on the CPU, with
+    // no acknowledge cycle on the PICs.
+    void dispatch(UInt32 irq)
+    {
+        bool enabled = ml_set_interrupts_enabled(FALSE);
+
+        ShimSetInterruptLevel(true);
+        pic->handleInterrupt(0, 0, kPICDefaultBaseVector + irq);
+        ShimSetInterruptLevel(false);
+        ml_set_interrupts_enabled(enabled);
+    }
+
+    // Raise the IRQ. If the PICs accept it, dispatch it. Returns whether
+    // the interrupt was delivered.
+    bool raise(UInt32 irq)
+    {
+        if (!sim->acceptIRQ(irq))
+        {
+            return false;
+        }
+
+        dispatch(irq);
+        return true;
+    }
+
+private:
+    enum { kMaxNubs = 16 };
+
+    IOService *_nubs[kMaxNubs];
+    UInt32 _nubCount = 0;
+};
+
+// Handler that counts its calls in the UInt32 behind refCon.
+static inline void countingHandler(void *target, void *refCon, void *nub, int source)
+{
+    __atomic_fetch_add((UInt32 *)refCon, 1, __ATOMIC_RELAXED);
+}
+
+#endif /* !_HARNESS_HARNESS_H */
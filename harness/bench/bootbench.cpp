@@ -0,0 +1,81 @@
+/*
+ * Boot programming of 24, 120 and 240 pin controllers, with deferred
+ * programming off and on: the MMIO accesses the simulator sees during
+ * start(), and the fastest start() of the runs, as the simulated MMIO
+ * is cheap and the mean is mostly allocator noise. The accesses for a
+ * typical handful of pins registered afterwards are counted too, as
+ * deferred programming moves their upper half writes to first use.
+ */
+
+#include "Harness.h"
+
+enum {
+    kAttachedPins   = 8         // a typical boot registers a handful
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static void run(UInt32 pins, bool deferred, UInt32 iterations)
+{
+    APICFixture *fixture;
+    UInt64 startNS = ~0ULL;
+    UInt64 start;
+    UInt64 ns;
+    UInt64 startAccesses = 0;
+    UInt64 attachAccesses = 0;
+    UInt64 accesses;
+    UInt32 i, pin;
+
+    for (i = 0; i < iterations; i++)
+    {
+        fixture = new APICFixture(pins);
+        fixture->setTunable(kDeferredProgrammingKey, deferred);
+
+        accesses = fixture->sim->accesses();
+        start = harnessNanoseconds();
+        if (!fixture->start())
+        {
+            fprintf(stderr, "bootbench: start failed\n");
+            exit(1);
+        }
+        ns = harnessNanoseconds() - start;
+        if (ns < startNS)
+        {
+            startNS = ns;
+        }
+        startAccesses += fixture->sim->accesses() - accesses;
+
+        accesses = fixture->sim->accesses();
+        for (pin = 0; pin < kAttachedPins; pin++)
+        {
+            fixture->attach(pin * (pins / kAttachedPins), kInterruptTriggerModeEdge, nullHandler);
+        }
+        attachAccesses += fixture->sim->accesses() - accesses;
+
+        delete fixture;
+    }
+
+    printf("%3u pins  deferred %-3s  start %5lu accesses %7.1f us   %u pins registered %4lu accesses\n",
+           (unsigned)pins, deferred ? "on" : "off", (unsigned long)(startAccesses / iterations),
+           (double)startNS / 1000, (unsigned)kAttachedPins,
+           (unsigned long)(attachAccesses / iterations));
+}
+
+int main(int argc, char **argv)
+{
+    UInt32 iterations = harnessQuick(argc, argv) ? 10 : 2000;
+    UInt32 pins[] = { 24, 120, 240 };
+    UInt32 i;
+
+    ShimSetLogging(false);
+
+    for (i = 0; i < (sizeof(pins) / sizeof(pins[0])); i++)
+    {
+        run(pins[i], false, iterations);
+        run(pins[i], true, iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Resolving a global system interrupt to its I/O APIC and pin, with 8
+ * and 16 I/O APICs of 24 pins. The global map is compared with a walk
+ * over the controllers, as a client without the map would do, and with
+ * the LookupGlobalSystemInterrupt platform function on top of the map,
+ * which also takes the map lock and retains the controller it returns.
+ * Every answer is checked against the controller ranges.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins           = 24,
+    kMaxControllers = 16,
+    kRepeats        = 5
+};
+
+static APICFixture *gFixtures[kMaxControllers];
+static UInt32 gCount;
+
+static AppleAPIC *walkControllers(UInt32 gsi, UInt32 *pin)
+{
+    HarnessAPIC *apic;
+    UInt32 i;
+
+    for (i = 0; i < gCount; i++)
+    {
+        apic = gFixtures[i]->apic;
+        if ((gsi >= (UInt32)apic->_vectorBase) && (gsi < (UInt32)(apic->_vectorBase + apic->_vectorCount)))
+        {
+            *pin = gsi - apic->_vectorBase;
+            return apic;
+        }
+    }
+
+    return 0;
+}
+
+static void check(UInt32 gsi, AppleAPIC *controller, UInt32 pin)
+{
+    if ((controller != gFixtures[gsi / kPins]->apic) || (pin != (gsi % kPins)))
+    {
+        fprintf(stderr, "gsibench: GSI %u resolved wrong\n", (unsigned)gsi);
+        exit(1);
+    }
+}
+
+static UInt64 timeMap(UInt32 gsis, UInt64 iterations)
+{
+    IOInterruptVectorNumber vectorPin;
+    AppleAPIC *controller;
+    UInt64 start;
+    UInt64 i;
+    UInt32 gsi;
+
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        gsi = (i * 7) % gsis;
+        controller = AppleAPIC::lookupGlobalSystemInterrupt(gsi, &vectorPin);
+        check(gsi, controller, vectorPin);
+    }
+
+    return harnessNanoseconds() - start;
+}
+
+static UInt64 timeWalk(UInt32 gsis, UInt64 iterations)
+{
+    AppleAPIC *controller;
+    UInt64 start;
+    UInt64 i;
+    UInt32 gsi;
+    UInt32 pin;
+
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        gsi = (i * 7) % gsis;
+        controller = walkControllers(gsi, &pin);
+        check(gsi, controller, pin);
+    }
+
+    return harnessNanoseconds() - start;
+}
+
+// The platform function retains the controller it returns.
+static UInt64 timePlatform(UInt32 gsis, UInt64 iterations)
+{
+    const OSSymbol *lookup = OSSymbol::withCString(kLookupGlobalSystemInterrupt);
+    IOInterruptController *found;
+    UInt64 start;
+    UInt64 i;
+    UInt32 gsi;
+    UInt32 pin;
+
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        gsi = (i * 7) % gsis;
+        gFixtures[0]->apic->callPlatformFunction(lookup, false, (void *)(uintptr_t)gsi, &found, &pin, 0);
+        check(gsi, (AppleAPIC *)found, pin);
+        found->release();
+    }
+
+    return harnessNanoseconds() - start;
+}
+
+static UInt64 fastest(UInt64 a, UInt64 b)
+{
+    return (a < b) ? a : b;
+}
+
+static void report(UInt32 count, const char *name, UInt64 ns, UInt64 iterations)
+{
+    printf("%2u I/O APICs  %-16s %6.1f ns/lookup\n", (unsigned)count, name, (double)ns / iterations);
+}
+
+static void run(UInt32 count, UInt64 iterations)
+{
+    UInt64 mapNS = ~0ULL;
+    UInt64 walkNS = ~0ULL;
+    UInt64 platformNS = ~0ULL;
+    UInt32 gsis = count * kPins;
+    UInt32 repeat;
+
+    for (gCount = 0; gCount < count; gCount++)
+    {
+        gFixtures[gCount] = new APICFixture(kPins, gCount * kPins);
+        if (!gFixtures[gCount]->start())
+        {
+            fprintf(stderr, "gsibench: start failed\n");
+            exit(1);
+        }
+    }
+
+    // Spread the lookups over all controllers, the last one included.
+    // The methods take turns, and the fastest pass of each is kept, so
+    // that the host scheduling other work does not favour either.
+    for (repeat = 0; repeat < kRepeats; repeat++)
+    {
+        mapNS = fastest(mapNS, timeMap(gsis, iterations));
+        walkNS = fastest(walkNS, timeWalk(gsis, iterations));
+        platformNS = fastest(platformNS, timePlatform(gsis, iterations));
+    }
+
+    report(count, "global map", mapNS, iterations);
+    report(count, "controller walk", walkNS, iterations);
+    report(count, "platform call", platformNS, iterations);
+
+    while (gCount)
+    {
+        delete gFixtures[--gCount];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UInt64 iterations = harnessQuick(argc, argv) ? 5000 : 1000000;
+
+    ShimSetLogging(false);
+
+    run(8, iterations);
+    run(16, iterations);
+
+    // The pages stay after the last controller is gone, and are reused.
+    // Entries of the controllers gone are empty, and not looked at.
+    run(8, iterations);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * What handler time histograms cost. recordLatency() alone, from one CPU
+ * and from several CPUs recording into the same histogram, which is the
+ * case of a shared vector or one retargeted by the balancer, and a full
+ * dispatch with histograms off and on. With several CPUs, each records
+ * the full count, and the time is wall time over that count.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kMaxThreads = 8
+};
+
+struct RecordArg {
+    LatencyHistogram *histogram;
+    UInt64 iterations;
+};
+
+static void recordBody(UInt32 cpu, void *param)
+{
+    RecordArg *arg = (RecordArg *)param;
+    UInt64 i;
+
+    for (i = 0; i < arg->iterations; i++)
+    {
+        // Times spread over the buckets a handler would hit.
+        recordLatency(arg->histogram, 1000 + ((i * 2654435761U) & 0xFFFF));
+    }
+}
+
+static void benchRecord(UInt32 threads, UInt64 iterations)
+{
+    LatencyHistogram *histogram = new LatencyHistogram;
+    RecordArg arg = { histogram, iterations };
+    UInt64 start, ns;
+
+    bzero(histogram, sizeof(LatencyHistogram));
+
+    start = harnessNanoseconds();
+    harnessRunThreads(threads, recordBody, &arg);
+    ns = harnessNanoseconds() - start;
+
+    printf("recordLatency  %u CPU(s) on one histogram  %6.1f ns/record\n", (unsigned)threads,
+           (double)ns / iterations);
+
+    delete histogram;
+}
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static void benchDispatch(bool enabled, UInt64 iterations)
+{
+    APICFixture fixture(kPins);
+    UInt64 start, ns;
+    UInt64 i;
+    UInt32 pin;
+
+    fixture.setTunable(kLatencyHistogramKey, enabled);
+    if (!fixture.start())
+    {
+        fprintf(stderr, "latencybench: start failed\n");
+        exit(1);
+    }
+
+    for (pin = 0; pin < kPins; pin++)
+    {
+        fixture.attach(pin, kInterruptTriggerModeEdge, nullHandler);
+    }
+
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        fixture.dispatch(i % kPins);
+    }
+    ns = harnessNanoseconds() - start;
+
+    printf("dispatch       histograms %-14s %6.1f ns/interrupt\n", enabled ? "on" : "off",
+           (double)ns / iterations);
+}
+
+int main(int argc, char **argv)
+{
+    UInt64 iterations = harnessQuick(argc, argv) ? 5000 : 5000000;
+    UInt32 threads;
+
+    ShimSetLogging(false);
+
+    for (threads = 1; (threads <= kMaxThreads) && (threads <= ml_get_max_cpus()); threads *= 2)
+    {
+        benchRecord(threads, iterations);
+    }
+
+    benchDispatch(false, iterations);
+    benchDispatch(true, iterations);
+
+    return 0;
+}
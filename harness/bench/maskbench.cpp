@@ -0,0 +1,150 @@
+/*
+ * Mask and unmask throughput with 2 to 64 CPUs hammering one I/O APIC,
+ * each on its own vector, against a baseline that takes _apicLock for
+ * every operation as the driver once did.
+ *
+ * "change" masks and unmasks, so every operation flips the bit and
+ * writes the entry under the lock either way. "redundant" unmasks a
+ * vector that is already unmasked, which is the common case of a
+ * disable and enable around a handler: the driver sees the bit
+ * unchanged and skips the lock and the register write, the baseline
+ * takes the lock and writes the entry again.
+ *
+ * The threads only contend as much as the host has CPUs to run them on
+ * at once, so on a small host the columns stay flat with the thread
+ * count and only the per-operation difference shows.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins = 120
+};
+
+enum {
+    kModeChange,
+    kModeChangeLocked,
+    kModeRedundant,
+    kModeRedundantLocked,
+    kModeCount
+};
+
+static const char *gModeNames[kModeCount] = {
+    "change", "change locked", "redundant", "redundant locked"
+};
+
+struct MaskBench {
+    APICFixture *fixture;
+    UInt64 iterations;
+    UInt32 mode;
+};
+
+// The mask update as it was, with the whole update under the lock.
+static void lockedMask(HarnessAPIC *apic, UInt32 pin, bool masked)
+{
+    IOInterruptState state;
+
+    state = IOSimpleLockLockDisableInterrupt(apic->_apicLock);
+    if (masked)
+    {
+        apic->_vectorTable[pin].l32 |= kRTLOMaskDisabled;
+    } else {
+        apic->_vectorTable[pin].l32 &= ~kRTLOMaskDisabled;
+    }
+    apic->indexWrite(kIndexRTLO + (pin * 2), apic->_vectorTable[pin].l32);
+    IOSimpleLockUnlockEnableInterrupt(apic->_apicLock, state);
+}
+
+static void maskLoop(UInt32 cpu, void *arg)
+{
+    MaskBench *bench = (MaskBench *)arg;
+    HarnessAPIC *apic = bench->fixture->apic;
+    UInt32 pin = cpu % kPins;
+    UInt64 i;
+
+    for (i = 0; i < bench->iterations; i++)
+    {
+        switch (bench->mode)
+        {
+            case kModeChange:
+                apic->disableVectorEntry(pin);
+                apic->enableVectorEntry(pin);
+                break;
+
+            case kModeChangeLocked:
+                lockedMask(apic, pin, true);
+                lockedMask(apic, pin, false);
+                break;
+
+            case kModeRedundant:
+                apic->enableVectorEntry(pin);
+                apic->enableVectorEntry(pin);
+                break;
+
+            case kModeRedundantLocked:
+                lockedMask(apic, pin, false);
+                lockedMask(apic, pin, false);
+                break;
+        }
+    }
+}
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    MaskBench bench;
+    UInt64 start, ns, ops;
+    UInt32 threads;
+    UInt32 mode;
+    UInt32 pin;
+
+    ShimSetLogging(false);
+
+    if (!fixture.start())
+    {
+        fprintf(stderr, "maskbench: start failed\n");
+        return 1;
+    }
+
+    for (pin = 0; pin < kPins; pin++)
+    {
+        fixture.attach(pin, kInterruptTriggerModeEdge, nullHandler);
+    }
+
+    bench.fixture = &fixture;
+    bench.iterations = harnessQuick(argc, argv) ? 500 : 50000;
+
+    printf("        ");
+    for (mode = 0; mode < kModeCount; mode++)
+    {
+        printf("  %27s", gModeNames[mode]);
+    }
+    printf("\n");
+
+    for (threads = 2; threads <= 64; threads *= 2)
+    {
+        printf("%2u CPUs ", (unsigned)threads);
+
+        for (mode = 0; mode < kModeCount; mode++)
+        {
+            bench.mode = mode;
+
+            fixture.sim->resetCounters();
+            start = harnessNanoseconds();
+            harnessRunThreads(threads, maskLoop, &bench);
+            ns = harnessNanoseconds() - start;
+
+            // Two operations per iteration.
+            ops = bench.iterations * threads * 2;
+            printf("  %9.1f ns/op %5.2f MMIO/op", (double)ns / ops, (double)fixture.sim->accesses() / ops);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
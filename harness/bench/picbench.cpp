@@ -0,0 +1,66 @@
+/*
+ * Cost of an interrupt through the 8259 PICs, with specific EOIs and in
+ * automatic EOI mode, for edge triggered IRQs on the master and on the
+ * slave, and a level triggered IRQ on the slave. The simulated ports
+ * cost next to nothing, where a legacy port access takes about a
+ * microsecond on hardware, so the last column adds that back in.
+ */
+
+#include "Harness.h"
+
+enum {
+    kMasterIRQ      = 4,
+    kSlaveIRQ       = 11,
+    kLevelIRQ       = 10,
+    kPortAccessNS   = 1000
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static void run(bool autoEOI, const char *name, UInt32 irq, UInt64 iterations)
+{
+    PICFixture fixture(autoEOI);
+    UInt64 start, ns, accesses;
+    UInt64 i;
+
+    if ((!fixture.start()) ||
+        (!fixture.attach(kMasterIRQ, kInterruptTriggerModeEdge, nullHandler)) ||
+        (!fixture.attach(kSlaveIRQ, kInterruptTriggerModeEdge, nullHandler)) ||
+        (!fixture.attach(kLevelIRQ, kInterruptTriggerModeLevel | kInterruptPolarityLow, nullHandler)))
+    {
+        fprintf(stderr, "picbench: start failed\n");
+        exit(1);
+    }
+
+    fixture.sim->resetCounters();
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        fixture.raise(irq);
+    }
+    ns = harnessNanoseconds() - start;
+    accesses = fixture.sim->accesses();
+
+    printf("%-9s %-12s %8.1f ns/irq  %5.2f ports/irq  %8.1f ns/irq with 1us ports\n",
+           autoEOI ? "auto EOI" : "EOI", name, (double)ns / iterations, (double)accesses / iterations,
+           (double)(ns + (accesses * kPortAccessNS)) / iterations);
+}
+
+int main(int argc, char **argv)
+{
+    UInt64 iterations = harnessQuick(argc, argv) ? 2000 : 1000000;
+    int mode;
+
+    ShimSetLogging(false);
+
+    for (mode = 0; mode < 2; mode++)
+    {
+        run(mode, "master edge", kMasterIRQ, iterations);
+        run(mode, "slave edge", kSlaveIRQ, iterations);
+        run(mode, "slave level", kLevelIRQ, iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Dispatch cost with the storm detector off, armed on a quiet system,
+ * and tripping on a storm. When armed, the dispatch path only counts,
+ * and reads the clock once every threshold interrupts, so the first two
+ * rows should be within noise of each other. In a storm the vector gets
+ * masked, and most raises never reach the CPU.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins           = 24,
+    kThreshold      = 64
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static void run(const char *name, UInt32 threshold, UInt32 window, UInt64 iterations)
+{
+    APICFixture fixture(kPins);
+    UInt64 delivered = 0;
+    UInt64 start, ns;
+    UInt64 i;
+    UInt32 pin;
+
+    fixture.setTunable(kStormThresholdKey, threshold);
+    fixture.setTunable(kStormWindowKey, window);
+
+    if (!fixture.start())
+    {
+        fprintf(stderr, "stormbench: start failed\n");
+        exit(1);
+    }
+
+    for (pin = 0; pin < kPins; pin++)
+    {
+        fixture.attach(pin, kInterruptTriggerModeEdge, nullHandler);
+    }
+
+    fixture.sim->resetCounters();
+    start = harnessNanoseconds();
+    for (i = 0; i < iterations; i++)
+    {
+        if (fixture.raise(i % kPins))
+        {
+            delivered++;
+        }
+    }
+    ns = harnessNanoseconds() - start;
+
+    printf("%-24s %8.1f ns/raise  %6.2f MMIO/raise  %6.2f%% delivered\n", name,
+           (double)ns / iterations, (double)fixture.sim->accesses() / iterations,
+           (100.0 * delivered) / iterations);
+}
+
+int main(int argc, char **argv)
+{
+    UInt64 iterations = harnessQuick(argc, argv) ? 5000 : 1000000;
+
+    ShimSetLogging(false);
+
+    run("storm detection off", 0, 0, iterations);
+
+    // A zero window never trips, leaving only the cost of detection.
+    run("storm detection armed", kThreshold, 0, iterations);
+    run("storm detection tripped", kThreshold, 100, iterations);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Tail latency with and without threaded dispatch. Every round a slow
+ * vector and a fast one become pending on the same CPU together. The
+ * fast handler's latency counts from that moment, so with direct
+ * dispatch it includes the whole slow handler. With the slow vector
+ * threaded, the CPU only runs its top half first. The slow handler's
+ * completion latency is reported too, as the price paid for it.
+ */
+
+#include "Harness.h"
+
+#include <algorithm>
+#include <vector>
+
+enum {
+    kPins               = 24,
+    kSlowPin            = 3,
+    kFastPin            = 4,
+    kSlowHandlerNanos   = 20000
+};
+
+struct LatencyRun {
+    UInt64 pendingTime;
+    volatile UInt32 slowDone;
+    std::vector<UInt64> fast;
+    std::vector<UInt64> slow;
+};
+
+static void fastHandler(void *target, void *refCon, void *nub, int source)
+{
+    LatencyRun *run = (LatencyRun *)refCon;
+
+    run->fast.push_back(harnessNanoseconds() - run->pendingTime);
+}
+
+static void slowHandler(void *target, void *refCon, void *nub, int source)
+{
+    LatencyRun *run = (LatencyRun *)refCon;
+    UInt64 start = harnessNanoseconds();
+
+    while ((harnessNanoseconds() - start) < kSlowHandlerNanos)
+    {
+    }
+
+    run->slow.push_back(harnessNanoseconds() - run->pendingTime);
+    __atomic_store_n(&run->slowDone, 1, __ATOMIC_RELEASE);
+}
+
+static UInt64 percentile(std::vector<UInt64> &samples, double fraction)
+{
+    size_t index = (size_t)(fraction * (samples.size() - 1));
+
+    std::sort(samples.begin(), samples.end());
+    return samples[index];
+}
+
+static void report(const char *name, std::vector<UInt64> &samples)
+{
+    printf("  %-5s p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n", name,
+           percentile(samples, 0.5) / 1000.0, percentile(samples, 0.99) / 1000.0,
+           percentile(samples, 0.999) / 1000.0, percentile(samples, 1.0) / 1000.0);
+}
+
+static void run(bool threaded, UInt32 rounds)
+{
+    APICFixture fixture(kPins);
+    LatencyRun run;
+    IOService *nub;
+    bool enabled;
+    UInt32 i;
+
+    run.fast.reserve(rounds);
+    run.slow.reserve(rounds);
+
+    if (!fixture.start())
+    {
+        fprintf(stderr, "threadbench: start failed\n");
+        exit(1);
+    }
+
+    nub = fixture.addNub(kSlowPin, kInterruptTriggerModeEdge);
+    nub->setProperty(kThreadedInterruptKey, threaded);
+    fixture.apic->registerInterrupt(nub, 0, &fixture, slowHandler, &run);
+    fixture.apic->enableInterrupt(nub, 0);
+    fixture.attach(kFastPin, kInterruptTriggerModeEdge, fastHandler, &run);
+
+    for (i = 0; i < rounds; i++)
+    {
+        // Both are taken back to back, before the CPU gets to switch
+        // to the worker.
+        run.slowDone = 0;
+        enabled = ml_set_interrupts_enabled(FALSE);
+        run.pendingTime = harnessNanoseconds();
+        fixture.raise(kSlowPin);
+        fixture.raise(kFastPin);
+        ml_set_interrupts_enabled(enabled);
+
+        // One round at a time, so the samples do not overlap.
+        while (!__atomic_load_n(&run.slowDone, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+    }
+
+    printf("%s dispatch of the slow vector:\n", threaded ? "threaded" : "direct");
+    report("fast", run.fast);
+    report("slow", run.slow);
+
+    fixture.apic->unregisterInterrupt(nub, 0);
+}
+
+int main(int argc, char **argv)
+{
+    UInt32 rounds = harnessQuick(argc, argv) ? 200 : 20000;
+
+    ShimSetLogging(false);
+
+    run(false, rounds);
+    run(true, rounds);
+
+    return 0;
+}
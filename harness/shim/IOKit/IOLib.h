@@ -0,0 +1,2 @@
+/* Host shim, see IOKitShim.h */
+#include <IOKitShim.h>
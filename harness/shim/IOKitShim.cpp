@@ -0,0 +1,1286 @@
+/*
+ * Host implementation of the kernel interfaces declared in IOKitShim.h.
+ */
+
+#include <IOKitShim.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+//---------------------------------------------------------------------------
+// Thread identity and interrupt state
+//---------------------------------------------------------------------------
+
+static thread_local int tCPUNumber;
+static thread_local bool tInterruptsDisabled;
+static thread_local bool tInterruptLevel;
+
+// Thread calls entered with interrupts disabled only wake their worker
+// once interrupts are enabled again, as the kernel would only switch
+// to it on the way out of the interrupt.
+enum { kDeferredWakeups = 16 };
+static thread_local thread_call_t tDeferredWakeups[kDeferredWakeups];
+static thread_local unsigned int tDeferredWakeupCount;
+static void flushDeferredWakeups(void);
+static unsigned int gMaxCPUs = 64;
+static bool gAdministrator = true;
+static bool gLogging = true;
+static volatile size_t gBytesAllocated;
+
+void ShimSetCPUNumber(int cpu)
+{
+    assert((unsigned int)cpu < gMaxCPUs);
+    tCPUNumber = cpu;
+}
+
+void ShimSetMaxCPUs(unsigned int cpus)
+{
+    gMaxCPUs = cpus;
+}
+
+void ShimSetInterruptLevel(bool atInterruptLevel)
+{
+    tInterruptLevel = atInterruptLevel;
+}
+
+void ShimSetAdministrator(bool administrator)
+{
+    gAdministrator = administrator;
+}
+
+void ShimSetLogging(bool enabled)
+{
+    gLogging = enabled;
+}
+
+size_t ShimBytesAllocated(void)
+{
+    return gBytesAllocated;
+}
+
+extern "C" int cpu_number(void)
+{
+    return tCPUNumber;
+}
+
+extern "C" unsigned int ml_get_max_cpus(void)
+{
+    return gMaxCPUs;
+}
+
+extern "C" bool ml_set_interrupts_enabled(bool enable)
+{
+    bool wasEnabled = !tInterruptsDisabled;
+
+    tInterruptsDisabled = !enable;
+
+    if (enable && (!wasEnabled))
+    {
+        flushDeferredWakeups();
+    }
+
+    return wasEnabled;
+}
+
+extern "C" void lapic_end_of_interrupt(void)
+{
+}
+
+//---------------------------------------------------------------------------
+// Time. Absolute time is kept in nanoseconds.
+//---------------------------------------------------------------------------
+
+extern "C" uint64_t mach_absolute_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * kSecondScale) + ts.tv_nsec;
+}
+
+extern "C" void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result)
+{
+    *result = abstime;
+}
+
+extern "C" void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result)
+{
+    *result = nanoseconds;
+}
+
+extern "C" void clock_interval_to_deadline(uint32_t interval, uint32_t scaleFactor, uint64_t *result)
+{
+    *result = mach_absolute_time() + ((uint64_t)interval * scaleFactor);
+}
+
+//---------------------------------------------------------------------------
+// IOLib
+//---------------------------------------------------------------------------
+
+extern "C" void IOLog(const char *format, ...)
+{
+    va_list args;
+
+    if (!gLogging)
+    {
+        return;
+    }
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern "C" void IOSleep(unsigned milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+// Spin like the kernel, but give the CPU away, since the thread being
+// waited for may share it.
+extern "C" void IODelay(unsigned microseconds)
+{
+    uint64_t deadline = mach_absolute_time() + ((uint64_t)microseconds * kMicrosecondScale);
+
+    do {
+        sched_yield();
+    } while (mach_absolute_time() < deadline);
+}
+
+extern "C" void *IOMalloc(size_t size)
+{
+    void *address = calloc(1, size);
+
+    if (address)
+    {
+        __atomic_fetch_add(&gBytesAllocated, size, __ATOMIC_RELAXED);
+    }
+
+    return address;
+}
+
+extern "C" void IOFree(void *address, size_t size)
+{
+    if (address)
+    {
+        __atomic_fetch_sub(&gBytesAllocated, size, __ATOMIC_RELAXED);
+        ::free(address);
+    }
+}
+
+extern "C" void *IOMallocAligned(size_t size, size_t alignment)
+{
+    void *address = 0;
+
+    if (alignment < sizeof(void *))
+    {
+        alignment = sizeof(void *);
+    }
+
+    if (posix_memalign(&address, alignment, size))
+    {
+        return 0;
+    }
+
+    memset(address, 0xA5, size);
+    __atomic_fetch_add(&gBytesAllocated, size, __ATOMIC_RELAXED);
+
+    return address;
+}
+
+extern "C" void IOFreeAligned(void *address, size_t size)
+{
+    IOFree(address, size);
+}
+
+//---------------------------------------------------------------------------
+// Locks. Simple locks spin, yielding so that a preempted holder on the
+// same host CPU can make progress.
+//---------------------------------------------------------------------------
+
+struct IOSimpleLock {
+    volatile UInt32 locked;
+};
+
+struct IOLock {
+    pthread_mutex_t mutex;
+};
+
+extern "C" IOSimpleLock *IOSimpleLockAlloc(void)
+{
+    return IONew(IOSimpleLock, 1);
+}
+
+extern "C" void IOSimpleLockFree(IOSimpleLock *lock)
+{
+    IODelete(lock, IOSimpleLock, 1);
+}
+
+extern "C" void IOSimpleLockLock(IOSimpleLock *lock)
+{
+    unsigned int spins = 0;
+
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+    {
+        if (++spins >= 64)
+        {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+extern "C" void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+extern "C" IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock)
+{
+    IOInterruptState state = ml_set_interrupts_enabled(false);
+
+    IOSimpleLockLock(lock);
+
+    return state;
+}
+
+extern "C" void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state)
+{
+    IOSimpleLockUnlock(lock);
+    ml_set_interrupts_enabled(state);
+}
+
+extern "C" IOLock *IOLockAlloc(void)
+{
+    IOLock *lock = IONew(IOLock, 1);
+
+    if (lock)
+    {
+        pthread_mutex_init(&lock->mutex, 0);
+    }
+
+    return lock;
+}
+
+extern "C" void IOLockFree(IOLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    IODelete(lock, IOLock, 1);
+}
+
+extern "C" void IOLockLock(IOLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+extern "C" void IOLockUnlock(IOLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+extern "C" thread_t current_thread(void)
+{
+    return (thread_t)pthread_self();
+}
+
+//---------------------------------------------------------------------------
+// Thread calls. Every call has its own worker thread, which runs the
+// function once per enter, after the deadline if one was given.
+//---------------------------------------------------------------------------
+
+struct thread_call {
+    thread_call_func_t func;
+    thread_call_param_t param0;
+    thread_call_param_t param1;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint64_t deadline;
+    bool pending;
+    bool running;
+    bool exiting;
+};
+
+static void *threadCallWorker(void *arg)
+{
+    thread_call_t call = (thread_call_t)arg;
+    thread_call_param_t param1;
+    struct timespec ts;
+    uint64_t now;
+
+    pthread_mutex_lock(&call->mutex);
+
+    while (!call->exiting)
+    {
+        if (!call->pending)
+        {
+            pthread_cond_wait(&call->cond, &call->mutex);
+            continue;
+        }
+
+        now = mach_absolute_time();
+        if (now < call->deadline)
+        {
+            // The condition variable waits on CLOCK_MONOTONIC, like
+            // mach_absolute_time().
+            ts.tv_sec = call->deadline / kSecondScale;
+            ts.tv_nsec = call->deadline % kSecondScale;
+            pthread_cond_timedwait(&call->cond, &call->mutex, &ts);
+            continue;
+        }
+
+        param1 = call->param1;
+        call->pending = false;
+        call->running = true;
+        pthread_mutex_unlock(&call->mutex);
+
+        call->func(call->param0, param1);
+
+        pthread_mutex_lock(&call->mutex);
+        call->running = false;
+        pthread_cond_broadcast(&call->cond);
+    }
+
+    pthread_mutex_unlock(&call->mutex);
+
+    return 0;
+}
+
+extern "C" thread_call_t thread_call_allocate_with_priority(thread_call_func_t func, thread_call_param_t param0,
+                                                            thread_call_priority_t priority)
+{
+    pthread_condattr_t attr;
+    thread_call_t call;
+
+    call = IONew(struct thread_call, 1);
+    if (0 == call)
+    {
+        return 0;
+    }
+
+    call->func = func;
+    call->param0 = param0;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&call->mutex, 0);
+    pthread_cond_init(&call->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&call->thread, 0, threadCallWorker, call))
+    {
+        IODelete(call, struct thread_call, 1);
+        return 0;
+    }
+
+    return call;
+}
+
+extern "C" thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0)
+{
+    return thread_call_allocate_with_priority(func, param0, THREAD_CALL_PRIORITY_KERNEL);
+}
+
+static bool deferWakeup(thread_call_t call)
+{
+    unsigned int i;
+
+    if (!tInterruptsDisabled)
+    {
+        return false;
+    }
+
+    for (i = 0; i < tDeferredWakeupCount; i++)
+    {
+        if (tDeferredWakeups[i] == call)
+        {
+            return true;
+        }
+    }
+
+    if (tDeferredWakeupCount == kDeferredWakeups)
+    {
+        return false;
+    }
+
+    tDeferredWakeups[tDeferredWakeupCount++] = call;
+    return true;
+}
+
+static void flushDeferredWakeups(void)
+{
+    thread_call_t call;
+
+    while (tDeferredWakeupCount)
+    {
+        call = tDeferredWakeups[--tDeferredWakeupCount];
+        pthread_mutex_lock(&call->mutex);
+        pthread_cond_broadcast(&call->cond);
+        pthread_mutex_unlock(&call->mutex);
+    }
+}
+
+static bool threadCallEnter(thread_call_t call, thread_call_param_t param1, uint64_t deadline)
+{
+    bool wasPending;
+
+    pthread_mutex_lock(&call->mutex);
+    wasPending = call->pending;
+    call->pending = true;
+    call->param1 = param1;
+    call->deadline = deadline;
+    if (!deferWakeup(call))
+    {
+        pthread_cond_broadcast(&call->cond);
+    }
+    pthread_mutex_unlock(&call->mutex);
+
+    return wasPending;
+}
+
+extern "C" bool thread_call_enter(thread_call_t call)
+{
+    return threadCallEnter(call, 0, 0);
+}
+
+extern "C" bool thread_call_enter1(thread_call_t call, thread_call_param_t param1)
+{
+    return threadCallEnter(call, param1, 0);
+}
+
+extern "C" bool thread_call_enter_delayed(thread_call_t call, uint64_t deadline)
+{
+    return threadCallEnter(call, 0, deadline);
+}
+
+extern "C" bool thread_call_enter1_delayed(thread_call_t call, thread_call_param_t param1, uint64_t deadline)
+{
+    return threadCallEnter(call, param1, deadline);
+}
+
+extern "C" bool thread_call_cancel(thread_call_t call)
+{
+    bool wasPending;
+
+    pthread_mutex_lock(&call->mutex);
+    wasPending = call->pending;
+    call->pending = false;
+    pthread_mutex_unlock(&call->mutex);
+
+    return wasPending;
+}
+
+extern "C" bool thread_call_cancel_wait(thread_call_t call)
+{
+    bool wasPending;
+
+    assert(!pthread_equal(pthread_self(), call->thread));
+
+    pthread_mutex_lock(&call->mutex);
+    wasPending = call->pending;
+    call->pending = false;
+    while (call->running)
+    {
+        pthread_cond_wait(&call->cond, &call->mutex);
+    }
+    pthread_mutex_unlock(&call->mutex);
+
+    return wasPending;
+}
+
+extern "C" bool thread_call_isactive(thread_call_t call)
+{
+    bool active;
+
+    pthread_mutex_lock(&call->mutex);
+    active = (call->pending || call->running);
+    pthread_mutex_unlock(&call->mutex);
+
+    return active;
+}
+
+extern "C" bool thread_call_free(thread_call_t call)
+{
+    pthread_mutex_lock(&call->mutex);
+    call->exiting = true;
+    call->pending = false;
+    pthread_cond_broadcast(&call->cond);
+    pthread_mutex_unlock(&call->mutex);
+
+    pthread_join(call->thread, 0);
+    pthread_cond_destroy(&call->cond);
+    pthread_mutex_destroy(&call->mutex);
+    IODelete(call, struct thread_call, 1);
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// libkern containers
+//---------------------------------------------------------------------------
+
+// The allocation size is kept in front of the object, for IOFree().
+enum { kObjectHeaderSize = 16 };
+
+void *OSObject::operator new(size_t size) throw()
+{
+    UInt8 *mem = (UInt8 *)IOMalloc(size + kObjectHeaderSize);
+
+    if (0 == mem)
+    {
+        return 0;
+    }
+
+    *(size_t *)mem = size + kObjectHeaderSize;
+
+    return mem + kObjectHeaderSize;
+}
+
+void OSObject::operator delete(void *mem)
+{
+    UInt8 *header = (UInt8 *)mem - kObjectHeaderSize;
+
+    IOFree(header, *(size_t *)header);
+}
+
+void OSObject::free(void)
+{
+    delete this;
+}
+
+void OSObject::retain(void) const
+{
+    OSIncrementAtomic(&_retainCount);
+}
+
+void OSObject::release(void) const
+{
+    if (OSDecrementAtomic(&_retainCount) == 1)
+    {
+        ((OSObject *)this)->free();
+    }
+}
+
+static char *copyString(const char *cString)
+{
+    size_t length = strlen(cString) + 1;
+    char *copy = (char *)IOMalloc(length);
+
+    if (copy)
+    {
+        memcpy(copy, cString, length);
+    }
+
+    return copy;
+}
+
+OSString *OSString::withCString(const char *cString)
+{
+    OSString *string = new OSString;
+
+    string->_string = copyString(cString);
+
+    return string;
+}
+
+void OSString::free(void)
+{
+    if (_string)
+    {
+        IOFree(_string, strlen(_string) + 1);
+    }
+
+    OSObject::free();
+}
+
+static pthread_mutex_t gSymbolLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, OSSymbol *> *gSymbols;
+
+const OSSymbol *OSSymbol::withCString(const char *cString)
+{
+    OSSymbol *symbol;
+
+    pthread_mutex_lock(&gSymbolLock);
+
+    if (0 == gSymbols)
+    {
+        gSymbols = new std::map<std::string, OSSymbol *>;
+    }
+
+    std::map<std::string, OSSymbol *>::iterator it = gSymbols->find(cString);
+    if (it != gSymbols->end())
+    {
+        symbol = it->second;
+        symbol->retain();
+    } else {
+        symbol = new OSSymbol;
+        symbol->_string = copyString(cString);
+        symbol->retain();
+        (*gSymbols)[cString] = symbol;
+    }
+
+    pthread_mutex_unlock(&gSymbolLock);
+
+    return symbol;
+}
+
+const OSSymbol *OSSymbol::withString(const OSString *string)
+{
+    if (0 == string)
+    {
+        return 0;
+    }
+
+    return withCString(string->getCStringNoCopy());
+}
+
+OSNumber *OSNumber::withNumber(unsigned long long value, unsigned int numberOfBits)
+{
+    OSNumber *number = new OSNumber;
+
+    number->_size = numberOfBits;
+    number->_value = (numberOfBits < 64) ? (value & ((1ULL << numberOfBits) - 1)) : value;
+
+    return number;
+}
+
+static OSBoolean gBooleanTrue(true);
+static OSBoolean gBooleanFalse(false);
+OSBoolean * const kOSBooleanTrue = &gBooleanTrue;
+OSBoolean * const kOSBooleanFalse = &gBooleanFalse;
+
+OSData *OSData::withCapacity(unsigned int capacity)
+{
+    OSData *data = new OSData;
+
+    data->_capacity = capacity ? capacity : 1;
+    data->_bytes = (UInt8 *)IOMalloc(data->_capacity);
+
+    return data;
+}
+
+OSData *OSData::withBytes(const void *bytes, unsigned int length)
+{
+    OSData *data = withCapacity(length);
+
+    data->appendBytes(bytes, length);
+
+    return data;
+}
+
+bool OSData::appendBytes(const void *bytes, unsigned int length)
+{
+    UInt8 *grown;
+
+    if ((_length + length) > _capacity)
+    {
+        grown = (UInt8 *)IOMalloc(_length + length);
+        memcpy(grown, _bytes, _length);
+        IOFree(_bytes, _capacity);
+        _bytes = grown;
+        _capacity = _length + length;
+    }
+
+    memcpy(_bytes + _length, bytes, length);
+    _length += length;
+
+    return true;
+}
+
+void OSData::free(void)
+{
+    IOFree(_bytes, _capacity);
+    OSObject::free();
+}
+
+OSArray *OSArray::withCapacity(unsigned int capacity)
+{
+    OSArray *array = new OSArray;
+
+    array->_capacity = capacity ? capacity : 1;
+    array->_objects = IONew(OSObject *, array->_capacity);
+
+    return array;
+}
+
+bool OSArray::setObject(const OSMetaClassBase *object)
+{
+    OSObject *obj = (OSObject *)OSDynamicCast(OSObject, object);
+    OSObject **grown;
+
+    if (0 == obj)
+    {
+        return false;
+    }
+
+    if (_count == _capacity)
+    {
+        grown = IONew(OSObject *, _capacity * 2);
+        memcpy(grown, _objects, sizeof(OSObject *) * _count);
+        IODelete(_objects, OSObject *, _capacity);
+        _objects = grown;
+        _capacity *= 2;
+    }
+
+    obj->retain();
+    _objects[_count++] = obj;
+
+    return true;
+}
+
+void OSArray::free(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < _count; i++)
+    {
+        _objects[i]->release();
+    }
+
+    IODelete(_objects, OSObject *, _capacity);
+    OSObject::free();
+}
+
+OSDictionary *OSDictionary::withCapacity(unsigned int capacity)
+{
+    OSDictionary *dict = new OSDictionary;
+
+    dict->_capacity = capacity ? capacity : 1;
+    dict->_entries = IONew(Entry, dict->_capacity);
+
+    return dict;
+}
+
+bool OSDictionary::setObject(const char *key, const OSMetaClassBase *object)
+{
+    OSObject *obj = (OSObject *)OSDynamicCast(OSObject, object);
+    Entry *grown;
+    unsigned int i;
+
+    if ((0 == key) || (0 == obj))
+    {
+        return false;
+    }
+
+    obj->retain();
+
+    for (i = 0; i < _count; i++)
+    {
+        if (0 == strcmp(_entries[i].key, key))
+        {
+            _entries[i].object->release();
+            _entries[i].object = obj;
+            return true;
+        }
+    }
+
+    if (_count == _capacity)
+    {
+        grown = IONew(Entry, _capacity * 2);
+        memcpy(grown, _entries, sizeof(Entry) * _count);
+        IODelete(_entries, Entry, _capacity);
+        _entries = grown;
+        _capacity *= 2;
+    }
+
+    _entries[_count].key = copyString(key);
+    _entries[_count].object = obj;
+    _count++;
+
+    return true;
+}
+
+OSObject *OSDictionary::getObject(const char *key) const
+{
+    unsigned int i;
+
+    for (i = 0; i < _count; i++)
+    {
+        if (0 == strcmp(_entries[i].key, key))
+        {
+            return _entries[i].object;
+        }
+    }
+
+    return 0;
+}
+
+void OSDictionary::removeObject(const char *key)
+{
+    unsigned int i;
+
+    for (i = 0; i < _count; i++)
+    {
+        if (0 == strcmp(_entries[i].key, key))
+        {
+            IOFree(_entries[i].key, strlen(_entries[i].key) + 1);
+            _entries[i].object->release();
+            _entries[i] = _entries[--_count];
+            return;
+        }
+    }
+}
+
+void OSDictionary::free(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < _count; i++)
+    {
+        IOFree(_entries[i].key, strlen(_entries[i].key) + 1);
+        _entries[i].object->release();
+    }
+
+    IODelete(_entries, Entry, _capacity);
+    OSObject::free();
+}
+
+//---------------------------------------------------------------------------
+// Registry entries and services
+//---------------------------------------------------------------------------
+
+IORegistryEntry::IORegistryEntry()
+{
+    _properties = OSDictionary::withCapacity(16);
+    _propertyLock = IOLockAlloc();
+}
+
+void IORegistryEntry::free(void)
+{
+    _properties->release();
+    IOLockFree(_propertyLock);
+    OSObject::free();
+}
+
+OSObject *IORegistryEntry::getProperty(const char *key) const
+{
+    OSObject *object;
+
+    IOLockLock(_propertyLock);
+    object = _properties->getObject(key);
+    IOLockUnlock(_propertyLock);
+
+    return object;
+}
+
+bool IORegistryEntry::setProperty(const char *key, OSObject *object)
+{
+    bool result;
+
+    IOLockLock(_propertyLock);
+    result = _properties->setObject(key, object);
+    IOLockUnlock(_propertyLock);
+
+    return result;
+}
+
+bool IORegistryEntry::setProperty(const char *key, unsigned long long value, unsigned int numberOfBits)
+{
+    OSNumber *num = OSNumber::withNumber(value, numberOfBits);
+    bool result = setProperty(key, num);
+
+    num->release();
+
+    return result;
+}
+
+bool IORegistryEntry::setProperty(const char *key, bool value)
+{
+    return setProperty(key, value ? kOSBooleanTrue : kOSBooleanFalse);
+}
+
+bool IORegistryEntry::setProperty(const char *key, const char *value)
+{
+    OSString *string = OSString::withCString(value);
+    bool result = setProperty(key, string);
+
+    string->release();
+
+    return result;
+}
+
+void IORegistryEntry::removeProperty(const char *key)
+{
+    IOLockLock(_propertyLock);
+    _properties->removeObject(key);
+    IOLockUnlock(_propertyLock);
+}
+
+static IOPlatformExpert *gPlatform;
+
+IOPlatformExpert *IOService::getPlatform(void)
+{
+    if (0 == gPlatform)
+    {
+        IOPlatformExpert *platform = new IOPlatformExpert;
+
+        if (!OSCompareAndSwapPtr(0, platform, (void * volatile *)&gPlatform))
+        {
+            platform->release();
+        }
+    }
+
+    return gPlatform;
+}
+
+IOReturn IOService::callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+                                         void *param1, void *param2, void *param3, void *param4)
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOService::newUserClient(task_t owningTask, void *securityID, UInt32 type, IOUserClient **handler)
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOService::registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon)
+{
+    _interruptTarget = (IOService *)target;
+    _interruptAction = handler;
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::callInterrupt(int source)
+{
+    if (0 == _interruptAction)
+    {
+        return kIOReturnNotReady;
+    }
+
+    return _interruptAction(_interruptTarget, 0, this, source);
+}
+
+static pthread_mutex_t gControllerLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, IOInterruptController *> *gControllers;
+
+IOReturn IOPlatformExpert::registerInterruptController(OSSymbol *name, IOInterruptController *controller)
+{
+    pthread_mutex_lock(&gControllerLock);
+
+    if (0 == gControllers)
+    {
+        gControllers = new std::map<std::string, IOInterruptController *>;
+    }
+
+    (*gControllers)[name->getCStringNoCopy()] = controller;
+
+    pthread_mutex_unlock(&gControllerLock);
+
+    return kIOReturnSuccess;
+}
+
+IOInterruptController *IOPlatformExpert::lookUpInterruptController(const char *name)
+{
+    IOInterruptController *controller = 0;
+
+    pthread_mutex_lock(&gControllerLock);
+
+    if (gControllers)
+    {
+        std::map<std::string, IOInterruptController *>::iterator it = gControllers->find(name);
+        if (it != gControllers->end())
+        {
+            controller = it->second;
+        }
+    }
+
+    pthread_mutex_unlock(&gControllerLock);
+
+    return controller;
+}
+
+IOInterruptController *ShimGetInterruptController(unsigned int index)
+{
+    IOInterruptController *controller = 0;
+
+    pthread_mutex_lock(&gControllerLock);
+
+    if ((gControllers) && (index < gControllers->size()))
+    {
+        std::map<std::string, IOInterruptController *>::iterator it = gControllers->begin();
+        std::advance(it, index);
+        controller = it->second;
+    }
+
+    pthread_mutex_unlock(&gControllerLock);
+
+    return controller;
+}
+
+bool IOPlatformExpert::atInterruptLevel(void)
+{
+    return tInterruptLevel;
+}
+
+//---------------------------------------------------------------------------
+// Memory descriptors
+//---------------------------------------------------------------------------
+
+static pthread_mutex_t gDeviceLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<IOPhysicalAddress, void *> *gDevices;
+
+void ShimMapDevice(IOPhysicalAddress address, void *device)
+{
+    pthread_mutex_lock(&gDeviceLock);
+
+    if (0 == gDevices)
+    {
+        gDevices = new std::map<IOPhysicalAddress, void *>;
+    }
+
+    (*gDevices)[address] = device;
+
+    pthread_mutex_unlock(&gDeviceLock);
+}
+
+void ShimUnmapDevice(IOPhysicalAddress address)
+{
+    pthread_mutex_lock(&gDeviceLock);
+
+    if (gDevices)
+    {
+        gDevices->erase(address);
+    }
+
+    pthread_mutex_unlock(&gDeviceLock);
+}
+
+IOMemoryMap *IOMemoryMap::withAddress(IOVirtualAddress address)
+{
+    IOMemoryMap *map = new IOMemoryMap;
+
+    map->_address = address;
+
+    return map;
+}
+
+IOMemoryDescriptor *IOMemoryDescriptor::withPhysicalAddress(IOPhysicalAddress address, IOByteCount withLength,
+                                                            IOOptionBits withDirection)
+{
+    IOMemoryDescriptor *md = new IOMemoryDescriptor;
+
+    md->_physicalAddress = address;
+    md->_length = withLength;
+
+    return md;
+}
+
+IOMemoryMap *IOMemoryDescriptor::map(IOOptionBits options)
+{
+    void *device = 0;
+
+    pthread_mutex_lock(&gDeviceLock);
+
+    if (gDevices)
+    {
+        std::map<IOPhysicalAddress, void *>::iterator it = gDevices->find(_physicalAddress);
+        if (it != gDevices->end())
+        {
+            device = it->second;
+        }
+    }
+
+    pthread_mutex_unlock(&gDeviceLock);
+
+    if (0 == device)
+    {
+        return 0;
+    }
+
+    return IOMemoryMap::withAddress((IOVirtualAddress)device);
+}
+
+IOBufferMemoryDescriptor *IOBufferMemoryDescriptor::withOptions(IOOptionBits options, size_t capacity,
+                                                                size_t alignment)
+{
+    IOBufferMemoryDescriptor *md = new IOBufferMemoryDescriptor;
+
+    md->_buffer = IOMallocAligned(capacity, alignment);
+    md->_length = capacity;
+    md->_physicalAddress = (IOPhysicalAddress)(uintptr_t)md->_buffer;
+
+    return md;
+}
+
+IOMemoryMap *IOBufferMemoryDescriptor::map(IOOptionBits options)
+{
+    return IOMemoryMap::withAddress((IOVirtualAddress)_buffer);
+}
+
+void IOBufferMemoryDescriptor::free(void)
+{
+    IOFreeAligned(_buffer, _length);
+    IOMemoryDescriptor::free();
+}
+
+//---------------------------------------------------------------------------
+// User clients
+//---------------------------------------------------------------------------
+
+extern "C" task_t current_task(void)
+{
+    return (task_t)&gAdministrator;
+}
+
+IOReturn IOUserClient::clientHasPrivilege(void *securityToken, const char *privilegeName)
+{
+    if (0 != strcmp(privilegeName, kIOClientPrivilegeAdministrator))
+    {
+        return kIOReturnUnsupported;
+    }
+
+    return gAdministrator ? kIOReturnSuccess : kIOReturnNotPrivileged;
+}
+
+//---------------------------------------------------------------------------
+// Interrupt controller superclass, following xnu
+//---------------------------------------------------------------------------
+
+IOReturn IOInterruptController::registerInterrupt(IOService *nub, int source, void *target,
+                                                  IOInterruptHandler handler, void *refCon)
+{
+    IOInterruptVectorNumber vectorNumber;
+    IOInterruptVector *vector;
+
+    vectorNumber = *(const UInt32 *)nub->_interruptSources[source].vectorData->getBytesNoCopy();
+    vector = &vectors[vectorNumber];
+
+    IOLockLock(vector->interruptLock);
+
+    // Sharing is handled by the subclasses in this tree.
+    if (vector->interruptRegistered)
+    {
+        IOLockUnlock(vector->interruptLock);
+        return kIOReturnNoResources;
+    }
+
+    vector->handler = handler;
+    vector->nub = nub;
+    vector->source = source;
+    vector->target = target;
+    vector->refCon = refCon;
+
+    initVector(vectorNumber, vector);
+
+    // The vector starts out disabled.
+    vector->interruptDisabledHard = 1;
+    vector->interruptDisabledSoft = 1;
+    vector->interruptRegistered = 1;
+
+    IOLockUnlock(vector->interruptLock);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::unregisterInterrupt(IOService *nub, int source)
+{
+    IOInterruptVectorNumber vectorNumber;
+    IOInterruptVector *vector;
+
+    vectorNumber = *(const UInt32 *)nub->_interruptSources[source].vectorData->getBytesNoCopy();
+    vector = &vectors[vectorNumber];
+
+    IOLockLock(vector->interruptLock);
+
+    if (!vector->interruptRegistered)
+    {
+        IOLockUnlock(vector->interruptLock);
+        return kIOReturnSuccess;
+    }
+
+    disableInterrupt(nub, source);
+    disableVectorHard(vectorNumber, vector);
+
+    vector->interruptActive = 0;
+    vector->interruptDisabledSoft = 0;
+    vector->interruptDisabledHard = 0;
+    vector->interruptRegistered = 0;
+    vector->nub = 0;
+    vector->source = 0;
+    vector->handler = 0;
+    vector->target = 0;
+    vector->refCon = 0;
+
+    IOLockUnlock(vector->interruptLock);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::getInterruptType(IOService *nub, int source, int *interruptType)
+{
+    IOInterruptVectorNumber vectorNumber;
+
+    if ((0 == nub) || (0 == interruptType))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    vectorNumber = *(const UInt32 *)nub->_interruptSources[source].vectorData->getBytesNoCopy();
+    *interruptType = getVectorType(vectorNumber, &vectors[vectorNumber]);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::enableInterrupt(IOService *nub, int source)
+{
+    IOInterruptVectorNumber vectorNumber;
+    IOInterruptVector *vector;
+
+    vectorNumber = *(const UInt32 *)nub->_interruptSources[source].vectorData->getBytesNoCopy();
+    vector = &vectors[vectorNumber];
+
+    if (vector->interruptDisabledSoft)
+    {
+        vector->interruptDisabledSoft = 0;
+        OSMemoryBarrier();
+
+        if (!getPlatform()->atInterruptLevel())
+        {
+            while (vector->interruptActive)
+            {
+                sched_yield();
+            }
+        }
+
+        if (vector->interruptDisabledHard)
+        {
+            vector->interruptDisabledHard = 0;
+            enableVector(vectorNumber, vector);
+        }
+    }
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOInterruptController::disableInterrupt(IOService *nub, int source)
+{
+    IOInterruptVectorNumber vectorNumber;
+    IOInterruptVector *vector;
+
+    vectorNumber = *(const UInt32 *)nub->_interruptSources[source].vectorData->getBytesNoCopy();
+    vector = &vectors[vectorNumber];
+
+    vector->interruptDisabledSoft = 1;
+    OSMemoryBarrier();
+
+    if (!getPlatform()->atInterruptLevel())
+    {
+        while (vector->interruptActive)
+        {
+            sched_yield();
+        }
+    }
+
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,602 @@
+/*
+ * Host shim for the parts of IOKit, libkern and osfmk used by the
+ * interrupt controller drivers, so that they can be built and run as
+ * ordinary Linux programs by the simulation harness. Only what the
+ * drivers call is provided. Locks and thread calls are backed by real
+ * threads, "CPUs" and the interrupt enable state are per host thread,
+ * and device registers come from the simulators in harness/sim.
+ */
+
+#ifndef _HARNESS_IOKITSHIM_H
+#define _HARNESS_IOKITSHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+/* Basic types */
+
+typedef uint8_t  UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int8_t   SInt8;
+typedef int16_t  SInt16;
+typedef int32_t  SInt32;
+typedef int64_t  SInt64;
+
+typedef int IOReturn;
+typedef UInt32 IOOptionBits;
+typedef UInt64 IOByteCount;
+typedef uintptr_t IOVirtualAddress;
+typedef UInt64 IOPhysicalAddress;
+typedef SInt32 IOInterruptVectorNumber;
+typedef bool IOInterruptState;
+
+#define OSTYPES_K64_REV 2
+
+#ifndef FALSE
+#define FALSE false
+#endif
+#ifndef TRUE
+#define TRUE true
+#endif
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+enum {
+    kIOReturnSuccess            = 0,
+    kIOReturnError              = (int)0xe00002bc,
+    kIOReturnNoMemory           = (int)0xe00002bd,
+    kIOReturnNoResources        = (int)0xe00002be,
+    kIOReturnBadArgument        = (int)0xe00002c2,
+    kIOReturnNotPrivileged      = (int)0xe00002c1,
+    kIOReturnUnsupported        = (int)0xe00002c7,
+    kIOReturnBusy               = (int)0xe00002d5,
+    kIOReturnNotReady           = (int)0xe00002d8,
+    kIOReturnNotFound           = (int)0xe00002f0,
+    kIOReturnInvalid            = (int)0xe00002f2,
+    kIOReturnNotPermitted       = (int)0xe00002e2
+};
+
+enum {
+    kIOInterruptTypeEdge        = 0,
+    kIOInterruptTypeLevel       = 1
+};
+
+enum {
+    kIODirectionOut             = 0x2,
+    kIODirectionInOut           = 0x3,
+    kIOMemoryPhysicallyContiguous = 0x00000010,
+    kIOMemoryKernelUserShared   = 0x00000200,
+    kIOMapInhibitCache          = 0x00000100,
+    kIOMapReadOnly              = 0x00001000
+};
+
+enum {
+    kNanosecondScale            = 1,
+    kMicrosecondScale           = 1000,
+    kMillisecondScale           = 1000 * 1000,
+    kSecondScale                = 1000 * 1000 * 1000
+};
+
+/* libkern atomics, returning the old value like the kernel versions */
+
+extern "C" {
+
+static inline SInt32 OSAddAtomic(SInt32 amount, volatile SInt32 *address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt32 OSIncrementAtomic(volatile SInt32 *address)
+{
+    return __atomic_fetch_add(address, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt32 OSDecrementAtomic(volatile SInt32 *address)
+{
+    return __atomic_fetch_sub(address, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt64 OSAddAtomic64(SInt64 amount, volatile SInt64 *address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt64 OSIncrementAtomic64(volatile SInt64 *address)
+{
+    return __atomic_fetch_add(address, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline UInt32 OSBitOrAtomic(UInt32 mask, volatile UInt32 *address)
+{
+    return __atomic_fetch_or(address, mask, __ATOMIC_SEQ_CST);
+}
+
+static inline UInt32 OSBitAndAtomic(UInt32 mask, volatile UInt32 *address)
+{
+    return __atomic_fetch_and(address, mask, __ATOMIC_SEQ_CST);
+}
+
+static inline bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool OSCompareAndSwap64(UInt64 oldValue, UInt64 newValue, volatile UInt64 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool OSCompareAndSwapPtr(void *oldValue, void *newValue, void * volatile *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void OSMemoryBarrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+}
+
+/* IOLib */
+
+typedef struct IOSimpleLock IOSimpleLock;
+typedef struct IOLock IOLock;
+
+extern "C" {
+
+void IOLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void IOSleep(unsigned milliseconds);
+void IODelay(unsigned microseconds);
+
+void *IOMalloc(size_t size);
+void IOFree(void *address, size_t size);
+void *IOMallocAligned(size_t size, size_t alignment);
+void IOFreeAligned(void *address, size_t size);
+
+IOSimpleLock *IOSimpleLockAlloc(void);
+void IOSimpleLockFree(IOSimpleLock *lock);
+void IOSimpleLockLock(IOSimpleLock *lock);
+void IOSimpleLockUnlock(IOSimpleLock *lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state);
+
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+
+bool ml_set_interrupts_enabled(bool enable);
+unsigned int ml_get_max_cpus(void);
+int cpu_number(void);
+void lapic_end_of_interrupt(void);
+
+/* Absolute time is in nanoseconds on the host. */
+uint64_t mach_absolute_time(void);
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result);
+void clock_interval_to_deadline(uint32_t interval, uint32_t scaleFactor, uint64_t *result);
+
+}
+
+#define IONew(type, number)             ((type *)IOMalloc(sizeof(type) * (number)))
+#define IODelete(ptr, type, number)     IOFree((ptr), sizeof(type) * (number))
+
+/* Thread calls */
+
+typedef struct thread_call *thread_call_t;
+typedef void *thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+
+typedef enum {
+    THREAD_CALL_PRIORITY_HIGH   = 0,
+    THREAD_CALL_PRIORITY_KERNEL = 1,
+    THREAD_CALL_PRIORITY_USER   = 2,
+    THREAD_CALL_PRIORITY_LOW    = 3
+} thread_call_priority_t;
+
+extern "C" {
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+thread_call_t thread_call_allocate_with_priority(thread_call_func_t func, thread_call_param_t param0,
+                                                 thread_call_priority_t priority);
+bool thread_call_enter(thread_call_t call);
+bool thread_call_enter1(thread_call_t call, thread_call_param_t param1);
+bool thread_call_enter_delayed(thread_call_t call, uint64_t deadline);
+bool thread_call_enter1_delayed(thread_call_t call, thread_call_param_t param1, uint64_t deadline);
+bool thread_call_cancel(thread_call_t call);
+bool thread_call_cancel_wait(thread_call_t call);
+bool thread_call_isactive(thread_call_t call);
+bool thread_call_free(thread_call_t call);
+
+}
+
+/* libkern containers */
+
+class OSSerialize;
+class OSMetaClassBase
+{
+public:
+    virtual ~OSMetaClassBase() {}
+};
+
+class OSObject : public OSMetaClassBase
+{
+    mutable volatile SInt32 _retainCount;
+
+protected:
+    virtual void free(void);
+
+public:
+    OSObject() : _retainCount(1) {}
+
+    // Kernel objects come out of a zeroed allocation.
+    static void *operator new(size_t size) throw();
+    static void operator delete(void *mem);
+
+    virtual bool init(void) { return true; }
+    void retain(void) const;
+    void release(void) const;
+    int getRetainCount(void) const { return _retainCount; }
+    virtual bool serialize(OSSerialize *s) const { return true; }
+};
+
+#define OSDynamicCast(type, inst)   (dynamic_cast<type *>((OSMetaClassBase *)(inst)))
+#define OSTypeID(type)              (&typeid(type))
+
+#define OSDeclareDefaultStructors(className)    \
+    public:                                     \
+        className(void);                        \
+        virtual ~className(void);               \
+    private:
+
+#define OSDefineMetaClassAndStructors(className, superclassName) \
+    className::className(void) {}                                 \
+    className::~className(void) {}
+
+// GCC binds a pointer to member function to a plain function pointer,
+// which is what the kernel version does with the vtable.
+#define OSMemberFunctionCast(cptrtype, self, func) \
+    ((cptrtype)((self)->*(func)))
+
+class OSString : public OSObject
+{
+protected:
+    char *_string;
+    virtual void free(void);
+
+public:
+    static OSString *withCString(const char *cString);
+    const char *getCStringNoCopy(void) const { return _string; }
+    unsigned int getLength(void) const { return (unsigned int)strlen(_string); }
+    bool isEqualTo(const char *cString) const { return (0 == strcmp(_string, cString)); }
+};
+
+// Symbols are interned, so equal strings give the same object, and are
+// kept for the life of the process.
+class OSSymbol : public OSString
+{
+protected:
+    virtual void free(void) {}
+
+public:
+    static const OSSymbol *withCString(const char *cString);
+    static const OSSymbol *withString(const OSString *string);
+};
+
+class OSNumber : public OSObject
+{
+    UInt64 _value;
+    unsigned int _size;
+
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits);
+    UInt32 unsigned32BitValue(void) const { return (UInt32)_value; }
+    UInt64 unsigned64BitValue(void) const { return _value; }
+    unsigned int numberOfBits(void) const { return _size; }
+    void setValue(unsigned long long value) { _value = value; }
+};
+
+class OSBoolean : public OSObject
+{
+    bool _value;
+
+protected:
+    virtual void free(void) {}
+
+public:
+    explicit OSBoolean(bool value) : _value(value) {}
+    bool isTrue(void) const { return _value; }
+    bool isFalse(void) const { return !_value; }
+};
+
+extern OSBoolean * const kOSBooleanTrue;
+extern OSBoolean * const kOSBooleanFalse;
+
+class OSData : public OSObject
+{
+    UInt8 *_bytes;
+    unsigned int _length;
+    unsigned int _capacity;
+
+protected:
+    virtual void free(void);
+
+public:
+    static OSData *withBytes(const void *bytes, unsigned int length);
+    static OSData *withCapacity(unsigned int capacity);
+    unsigned int getLength(void) const { return _length; }
+    const void *getBytesNoCopy(void) const { return _bytes; }
+    bool appendBytes(const void *bytes, unsigned int length);
+};
+
+class OSCollection : public OSObject
+{
+};
+
+class OSArray : public OSCollection
+{
+    OSObject **_objects;
+    unsigned int _count;
+    unsigned int _capacity;
+
+protected:
+    virtual void free(void);
+
+public:
+    static OSArray *withCapacity(unsigned int capacity);
+    bool setObject(const OSMetaClassBase *object);
+    unsigned int getCount(void) const { return _count; }
+    OSObject *getObject(unsigned int index) const { return (index < _count) ? _objects[index] : 0; }
+};
+
+class OSDictionary : public OSCollection
+{
+    struct Entry { char *key; OSObject *object; };
+    Entry *_entries;
+    unsigned int _count;
+    unsigned int _capacity;
+
+protected:
+    virtual void free(void);
+
+public:
+    static OSDictionary *withCapacity(unsigned int capacity);
+    bool setObject(const char *key, const OSMetaClassBase *object);
+    bool setObject(const OSSymbol *key, const OSMetaClassBase *object) { return setObject(key->getCStringNoCopy(), object); }
+    OSObject *getObject(const char *key) const;
+    void removeObject(const char *key);
+    unsigned int getCount(void) const { return _count; }
+};
+
+class OSSerialize : public OSObject
+{
+};
+
+/* Registry entries and services */
+
+class IOService;
+class IOInterruptController;
+class IOUserClient;
+class IOPlatformExpert;
+struct task;
+typedef struct task *task_t;
+
+extern "C" task_t current_task(void);
+
+struct thread;
+typedef struct thread *thread_t;
+
+extern "C" thread_t current_thread(void);
+
+typedef void (*IOInterruptHandler)(void *target, void *refCon, void *nub, int source);
+typedef IOReturn (*IOInterruptAction)(OSObject *target, void *refCon, IOService *nub, int source);
+
+struct IOInterruptSource {
+    IOInterruptController *interruptController;
+    OSData *vectorData;
+};
+
+class IORegistryEntry : public OSObject
+{
+    OSDictionary *_properties;
+    const char *_name;
+    IOLock *_propertyLock;
+
+protected:
+    virtual void free(void);
+
+public:
+    IORegistryEntry();
+
+    OSObject *getProperty(const char *key) const;
+    bool setProperty(const char *key, OSObject *object);
+    bool setProperty(const char *key, unsigned long long value, unsigned int numberOfBits);
+    bool setProperty(const char *key, bool value);
+    bool setProperty(const char *key, const char *value);
+    void removeProperty(const char *key);
+
+    const char *getName(void) const { return _name ? _name : "IORegistryEntry"; }
+    void setName(const char *name) { _name = name; }
+
+    virtual bool serializeProperties(OSSerialize *s) const { return true; }
+};
+
+class IOService : public IORegistryEntry
+{
+    IOService *_provider;
+    IOService *_interruptTarget;
+    IOInterruptAction _interruptAction;
+
+public:
+    IOInterruptSource *_interruptSources;
+    int _numInterruptSources;
+
+    virtual bool init(OSDictionary *dictionary = 0) { return OSObject::init(); }
+    virtual bool start(IOService *provider) { _provider = provider; return true; }
+    virtual void stop(IOService *provider) {}
+    virtual bool attach(IOService *provider) { _provider = provider; return true; }
+    virtual void detach(IOService *provider) { _provider = 0; }
+    virtual bool open(IOService *forClient, IOOptionBits options = 0, void *arg = 0) { return true; }
+    virtual void close(IOService *forClient, IOOptionBits options = 0) {}
+    virtual bool terminate(IOOptionBits options = 0) { return true; }
+    void registerService(IOOptionBits options = 0) {}
+    IOService *getProvider(void) const { return _provider; }
+    IOPlatformExpert *getPlatform(void);
+
+    virtual IOReturn callPlatformFunction(const OSSymbol *functionName, bool waitForFunction,
+                                          void *param1, void *param2, void *param3, void *param4);
+    virtual IOReturn newUserClient(task_t owningTask, void *securityID, UInt32 type, IOUserClient **handler);
+
+    // A provider taking an interrupt on behalf of a controller, such
+    // as the 8259 cascade. The harness delivers it with callInterrupt().
+    IOReturn registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon = 0);
+    IOReturn enableInterrupt(int source) { return kIOReturnSuccess; }
+    IOReturn callInterrupt(int source);
+};
+
+class IOPlatformExpert : public IOService
+{
+public:
+    IOReturn registerInterruptController(OSSymbol *name, IOInterruptController *controller);
+    IOInterruptController *lookUpInterruptController(const char *name);
+    bool atInterruptLevel(void);
+};
+
+/* Memory descriptors. Physical ranges registered as devices by the
+   harness map to the simulator behind them. */
+
+class IOMemoryMap : public OSObject
+{
+    IOVirtualAddress _address;
+
+public:
+    static IOMemoryMap *withAddress(IOVirtualAddress address);
+    IOVirtualAddress getVirtualAddress(void) { return _address; }
+};
+
+class IOMemoryDescriptor : public OSObject
+{
+protected:
+    IOPhysicalAddress _physicalAddress;
+    IOByteCount _length;
+
+public:
+    static IOMemoryDescriptor *withPhysicalAddress(IOPhysicalAddress address, IOByteCount withLength,
+                                                   IOOptionBits withDirection);
+    IOReturn prepare(IOOptionBits forDirection = 0) { return kIOReturnSuccess; }
+    IOReturn complete(IOOptionBits forDirection = 0) { return kIOReturnSuccess; }
+    virtual IOMemoryMap *map(IOOptionBits options = 0);
+    IOByteCount getLength(void) const { return _length; }
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+    void *_buffer;
+
+protected:
+    virtual void free(void);
+
+public:
+    static IOBufferMemoryDescriptor *withOptions(IOOptionBits options, size_t capacity, size_t alignment = 1);
+    void *getBytesNoCopy(void) { return _buffer; }
+    virtual IOMemoryMap *map(IOOptionBits options = 0);
+};
+
+/* User clients */
+
+#define kIOClientPrivilegeAdministrator "root"
+
+class IOUserClient : public IOService
+{
+public:
+    virtual bool initWithTask(task_t owningTask, void *securityID, UInt32 type) { return init(); }
+    virtual IOReturn clientClose(void) { return kIOReturnUnsupported; }
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
+    {
+        return kIOReturnUnsupported;
+    }
+
+    static IOReturn clientHasPrivilege(void *securityToken, const char *privilegeName);
+};
+
+/* Interrupt controllers, with the behaviour of the xnu superclass */
+
+struct IOInterruptVector {
+    volatile char interruptActive;
+    volatile char interruptDisabledSoft;
+    volatile char interruptDisabledHard;
+    volatile char interruptRegistered;
+    IOLock *interruptLock;
+    IOService *nub;
+    int source;
+    void *target;
+    IOInterruptHandler handler;
+    void *refCon;
+    class IOSharedInterruptController *sharedController;
+};
+
+class IOInterruptController : public IOService
+{
+public:
+    IOInterruptVector *vectors;
+
+    virtual IOReturn registerInterrupt(IOService *nub, int source, void *target,
+                                       IOInterruptHandler handler, void *refCon);
+    virtual IOReturn unregisterInterrupt(IOService *nub, int source);
+    virtual IOReturn getInterruptType(IOService *nub, int source, int *interruptType);
+    virtual IOReturn enableInterrupt(IOService *nub, int source);
+    virtual IOReturn disableInterrupt(IOService *nub, int source);
+    virtual IOReturn causeInterrupt(IOService *nub, int source) { return kIOReturnUnsupported; }
+
+    virtual IOInterruptAction getInterruptHandlerAddress(void) { return 0; }
+    virtual IOReturn handleInterrupt(void *refCon, IOService *nub, int source) { return kIOReturnInvalid; }
+
+    virtual bool vectorCanBeShared(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) { return false; }
+    virtual void initVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) {}
+    virtual int getVectorType(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) { return 0; }
+    virtual void disableVectorHard(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) {}
+    virtual void enableVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) {}
+    virtual void causeVector(IOInterruptVectorNumber vectorNumber, IOInterruptVector *vector) {}
+};
+
+/* Port I/O, provided by the 8259 simulator */
+
+extern "C" {
+void outb(uint16_t port, uint8_t value);
+uint8_t inb(uint16_t port);
+}
+
+/* Harness controls */
+
+// Make a physical range map to a simulated device.
+void ShimMapDevice(IOPhysicalAddress address, void *device);
+void ShimUnmapDevice(IOPhysicalAddress address);
+
+// Host thread identity, as seen by cpu_number() and atInterruptLevel().
+void ShimSetCPUNumber(int cpu);
+void ShimSetMaxCPUs(unsigned int cpus);
+void ShimSetInterruptLevel(bool atInterruptLevel);
+
+// The registered interrupt controllers in name order, as the I/O
+// Registry would list them, or 0 past the last one.
+IOInterruptController *ShimGetInterruptController(unsigned int index);
+
+// Whether clientHasPrivilege() grants administrator privilege.
+void ShimSetAdministrator(bool administrator);
+
+// Allocation totals, for memory footprint measurements.
+size_t ShimBytesAllocated(void);
+
+// Silence IOLog, for benchmarks.
+void ShimSetLogging(bool enabled);
+
+#endif /* !_HARNESS_IOKITSHIM_H */
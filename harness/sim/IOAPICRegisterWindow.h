@@ -0,0 +1,13 @@
+/*
+ * Included ahead of every driver source in the host build, so that the
+ * driver's IOAPIC_REG() accesses go to the simulated register window.
+ */
+
+#ifndef _HARNESS_IOAPICREGISTERWINDOW_H
+#define _HARNESS_IOAPICREGISTERWINDOW_H
+
+#include <IOAPICSim.h>
+
+#define IOAPIC_REG(reg) (IOAPICRegister(_apicBaseAddr, kOffset##reg))
+
+#endif /* !_HARNESS_IOAPICREGISTERWINDOW_H */
@@ -0,0 +1,199 @@
+/*
+ * Simulated I/O APIC, see IOAPICSim.h.
+ */
+
+#include <IOAPICSim.h>
+
+#include <stdlib.h>
+
+//---------------------------------------------------------------------------
+IOAPICSim::IOAPICSim(UInt32 pins, UInt32 version, UInt32 apicID)
+    : _pins(pins), _version(version), _id(apicID << 24), _index(0),
+      _reads(0), _writes(0), _eoiWrites(0)
+{
+    assert((pins > 0) && (pins <= 256));
+
+    _entries = (UInt32 *)calloc(pins * 2, sizeof(UInt32));
+    reset();
+}
+
+//---------------------------------------------------------------------------
+IOAPICSim::~IOAPICSim()
+{
+    ::free(_entries);
+}
+
+//---------------------------------------------------------------------------
+void IOAPICSim::reset(void)
+{
+    UInt32 pin;
+
+    for (pin = 0; pin < _pins; pin++)
+    {
+        _entries[pin * 2] = kRTLOMasked;
+        _entries[(pin * 2) + 1] = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+UInt32 IOAPICSim::read(UInt32 offset)
+{
+    __atomic_fetch_add(&_reads, 1, __ATOMIC_RELAXED);
+
+    switch (offset)
+    {
+        case kRegIND:
+            return _index;
+
+        case kRegDAT:
+            return readIndirect(_index);
+
+        default:
+            return 0xFFFFFFFF;
+    }
+}
+
+//---------------------------------------------------------------------------
+void IOAPICSim::write(UInt32 offset, UInt32 value)
+{
+    __atomic_fetch_add(&_writes, 1, __ATOMIC_RELAXED);
+
+    switch (offset)
+    {
+        case kRegIND:
+            _index = value;
+            break;
+
+        case kRegDAT:
+            writeIndirect(_index, value);
+            break;
+
+        case kRegIRQPA:
+            if (value < _pins)
+            {
+                assertPin(value);
+            }
+            break;
+
+        case kRegEOIR:
+            // Older parts do not decode the EOI register.
+            if (_version < 0x20)
+            {
+                break;
+            }
+
+            __atomic_fetch_add(&_eoiWrites, 1, __ATOMIC_RELAXED);
+            broadcastEOI(value);
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------
+void IOAPICSim::broadcastEOI(UInt32 vector)
+{
+    UInt32 pin;
+
+    for (pin = 0; pin < _pins; pin++)
+    {
+        if ((_entries[pin * 2] & kRTLOVectorMask) == (vector & kRTLOVectorMask))
+        {
+            __atomic_fetch_and(&_entries[pin * 2], ~(UInt32)kRTLORemoteIRR, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+UInt32 IOAPICSim::readIndirect(UInt32 index)
+{
+    switch (index)
+    {
+        case kIndexID:
+            return _id;
+
+        case kIndexVER:
+            return ((_pins - 1) << 16) | _version;
+
+        case kIndexARB:
+            return _id;
+
+        case kIndexBOOT:
+            return 0;
+    }
+
+    if ((index >= kIndexRT) && ((index - kIndexRT) < (_pins * 2)))
+    {
+        return _entries[index - kIndexRT];
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+void IOAPICSim::writeIndirect(UInt32 index, UInt32 value)
+{
+    UInt32 *entry;
+    UInt32 old;
+
+    if (index == kIndexID)
+    {
+        _id = value & 0x0F000000;
+        return;
+    }
+
+    if ((index < kIndexRT) || ((index - kIndexRT) >= (_pins * 2)))
+    {
+        return;
+    }
+
+    entry = &_entries[index - kIndexRT];
+
+    if ((index - kIndexRT) & 1)
+    {
+        *entry = value;
+        return;
+    }
+
+    // The hardware owns the status bits. Remote IRR is also cleared
+    // when the entry is switched to edge trigger mode.
+    old = *entry;
+    value = (value & ~(UInt32)kRTLOReadOnlyMask) | (old & kRTLOReadOnlyMask);
+    if (0 == (value & kRTLOTriggerLevel))
+    {
+        value &= ~(UInt32)kRTLORemoteIRR;
+    }
+
+    *entry = value;
+}
+
+//---------------------------------------------------------------------------
+void IOAPICSim::pokeEntry(UInt32 pin, UInt32 l32, UInt32 h32)
+{
+    _entries[pin * 2] = l32;
+    _entries[(pin * 2) + 1] = h32;
+}
+
+//---------------------------------------------------------------------------
+bool IOAPICSim::assertPin(UInt32 pin)
+{
+    UInt32 l32;
+
+    assert(pin < _pins);
+
+    l32 = _entries[pin * 2];
+    if (l32 & kRTLOMasked)
+    {
+        return false;
+    }
+
+    if (l32 & kRTLOTriggerLevel)
+    {
+        if (l32 & kRTLORemoteIRR)
+        {
+            return false;
+        }
+
+        __atomic_fetch_or(&_entries[pin * 2], (UInt32)kRTLORemoteIRR, __ATOMIC_SEQ_CST);
+    }
+
+    return true;
+}
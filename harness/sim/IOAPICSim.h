@@ -0,0 +1,117 @@
+/*
+ * Simulated I/O APIC register window. The driver reaches it through the
+ * IND/DAT pair exactly like the hardware: a write to IND selects an
+ * indirect register, and DAT then reads or writes it. Every access is
+ * counted, so the MMIO cost of a driver operation can be measured.
+ *
+ * Redirection entries keep the read-only Delivery Status and Remote IRR
+ * bits. Remote IRR is set when a level triggered entry delivers, and
+ * cleared by a write to the EOI register on parts that have one (version
+ * 0x20 and up), or by switching the entry to edge trigger mode.
+ *
+ * The index register is modeled wider than the 8 bits of real parts, so
+ * that configurations of more than 120 pins can be addressed.
+ */
+
+#ifndef _HARNESS_IOAPICSIM_H
+#define _HARNESS_IOAPICSIM_H
+
+#include <IOKitShim.h>
+
+class IOAPICSim
+{
+public:
+    enum {
+        kRegIND             = 0x00,
+        kRegDAT             = 0x10,
+        kRegIRQPA           = 0x20,
+        kRegEOIR            = 0x40,
+
+        kIndexID            = 0x00,
+        kIndexVER           = 0x01,
+        kIndexARB           = 0x02,
+        kIndexBOOT          = 0x03,
+        kIndexRT            = 0x10,
+
+        kRTLOVectorMask     = 0x000000FF,
+        kRTLODeliveryStatus = 0x00001000,
+        kRTLORemoteIRR      = 0x00004000,
+        kRTLOTriggerLevel   = 0x00008000,
+        kRTLOMasked         = 0x00010000,
+        kRTLOReadOnlyMask   = kRTLODeliveryStatus | kRTLORemoteIRR
+    };
+
+    IOAPICSim(UInt32 pins, UInt32 version = 0x20, UInt32 apicID = 1);
+    ~IOAPICSim();
+
+    // MMIO window, as decoded by the register proxy.
+    UInt32 read(UInt32 offset);
+    void write(UInt32 offset, UInt32 value);
+
+    // Register contents, read without counting an access.
+    UInt32 pins(void) const { return _pins; }
+    UInt32 version(void) const { return _version; }
+    UInt32 entryLow(UInt32 pin) const { return _entries[pin * 2]; }
+    UInt32 entryHigh(UInt32 pin) const { return _entries[(pin * 2) + 1]; }
+    UInt32 id(void) const { return _id; }
+
+    // Change an entry behind the driver's back, as SMM code might.
+    void pokeEntry(UInt32 pin, UInt32 l32, UInt32 h32);
+
+    // Raise a pin. Returns true if the entry sends an interrupt message,
+    // which the harness then delivers to the driver. A level triggered
+    // entry does not deliver again until its Remote IRR is cleared.
+    bool assertPin(UInt32 pin);
+    bool remoteIRR(UInt32 pin) const { return (0 != (entryLow(pin) & kRTLORemoteIRR)); }
+
+    // EOI message broadcast by a local APIC, when EOI broadcasts are on.
+    // Clears Remote IRR like the EOI register, without a register access.
+    void broadcastEOI(UInt32 vector);
+
+    // Register access counters.
+    UInt64 reads(void) const { return _reads; }
+    UInt64 writes(void) const { return _writes; }
+    UInt64 accesses(void) const { return _reads + _writes; }
+    UInt64 eoiWrites(void) const { return _eoiWrites; }
+    void resetCounters(void) { _reads = 0; _writes = 0; _eoiWrites = 0; }
+
+    // Power loss on sleep: every entry comes back masked.
+    void reset(void);
+
+private:
+    UInt32 readIndirect(UInt32 index);
+    void writeIndirect(UInt32 index, UInt32 value);
+
+    UInt32 _pins;
+    UInt32 _version;
+    UInt32 _id;
+    UInt32 _index;
+    UInt32 *_entries;
+
+    // Simulated CPUs may access the window concurrently, the driver is
+    // expected to serialize them, the counters should not need it.
+    volatile UInt64 _reads;
+    volatile UInt64 _writes;
+    volatile UInt64 _eoiWrites;
+};
+
+// What IOAPIC_REG() expands to in the host build. The mapped "virtual
+// address" of the register window is the simulator itself.
+class IOAPICRegister
+{
+    IOAPICSim *_sim;
+    UInt32 _offset;
+
+public:
+    IOAPICRegister(IOVirtualAddress base, UInt32 offset) : _sim((IOAPICSim *)base), _offset(offset) {}
+
+    operator UInt32() const { return _sim->read(_offset); }
+
+    IOAPICRegister &operator=(UInt32 value)
+    {
+        _sim->write(_offset, value);
+        return *this;
+    }
+};
+
+#endif /* !_HARNESS_IOAPICSIM_H */
@@ -0,0 +1,224 @@
+/*
+ * Simulated 8259 PIC pair, see PICSim.h.
+ */
+
+#include <PICSim.h>
+
+enum {
+    kPIC1Command    = 0x20,
+    kPIC1Data       = 0x21,
+    kPIC2Command    = 0xa0,
+    kPIC2Data       = 0xa1,
+    kELCR1          = 0x4d0,
+    kELCR2          = 0x4d1,
+
+    kICW1           = 0x10,
+    kICW1NeedICW4   = 0x01,
+    kICW4AutoEOI    = 0x02,
+    kOCW3           = 0x08,
+    kOCW3ReadISR    = 0x03,
+    kOCW3ReadIRR    = 0x02,
+    kOCW2EOI        = 0x20,
+    kOCW2Specific   = 0x40
+};
+
+static PICSim gPICSim;
+
+//---------------------------------------------------------------------------
+PICSim *PICSim::instance(void)
+{
+    return &gPICSim;
+}
+
+//---------------------------------------------------------------------------
+void PICSim::reset(void)
+{
+    bzero(_chips, sizeof(_chips));
+    bzero(_elcr, sizeof(_elcr));
+    _chips[0].imr = 0xff;
+    _chips[1].imr = 0xff;
+    resetCounters();
+}
+
+//---------------------------------------------------------------------------
+PICSim::Chip *PICSim::chipForPort(UInt16 port, bool *dataPort)
+{
+    switch (port)
+    {
+        case kPIC1Command: *dataPort = false; return &_chips[0];
+        case kPIC1Data:    *dataPort = true;  return &_chips[0];
+        case kPIC2Command: *dataPort = false; return &_chips[1];
+        case kPIC2Data:    *dataPort = true;  return &_chips[1];
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+UInt8 PICSim::portRead(UInt16 port)
+{
+    bool dataPort;
+    Chip *chip;
+
+    __atomic_fetch_add(&_reads, 1, __ATOMIC_RELAXED);
+
+    if (port == kELCR1)
+    {
+        return _elcr[0];
+    }
+
+    if (port == kELCR2)
+    {
+        return _elcr[1];
+    }
+
+    chip = chipForPort(port, &dataPort);
+    if (0 == chip)
+    {
+        return 0xff;
+    }
+
+    if (dataPort)
+    {
+        return chip->imr;
+    }
+
+    // Nothing is ever pending in the request register here.
+    return chip->readISR ? chip->isr : 0;
+}
+
+//---------------------------------------------------------------------------
+void PICSim::portWrite(UInt16 port, UInt8 value)
+{
+    bool dataPort;
+    Chip *chip;
+    int level;
+
+    __atomic_fetch_add(&_writes, 1, __ATOMIC_RELAXED);
+
+    if (port == kELCR1)
+    {
+        _elcr[0] = value;
+        return;
+    }
+
+    if (port == kELCR2)
+    {
+        _elcr[1] = value;
+        return;
+    }
+
+    chip = chipForPort(port, &dataPort);
+    if (0 == chip)
+    {
+        return;
+    }
+
+    if (dataPort)
+    {
+        // ICW2 to ICW4, then OCW1.
+        switch (chip->initStep)
+        {
+            case 2:
+                chip->vectorBase = value & 0xf8;
+                chip->initStep = 3;
+                break;
+
+            case 3:
+                chip->initStep = chip->needICW4 ? 4 : 0;
+                break;
+
+            case 4:
+                chip->autoEOI = (0 != (value & kICW4AutoEOI));
+                chip->initStep = 0;
+                break;
+
+            default:
+                chip->imr = value;
+                break;
+        }
+        return;
+    }
+
+    if (value & kICW1)
+    {
+        chip->imr = 0;
+        chip->isr = 0;
+        chip->readISR = false;
+        chip->autoEOI = false;
+        chip->needICW4 = (0 != (value & kICW1NeedICW4));
+        chip->initStep = 2;
+        return;
+    }
+
+    if (value & kOCW3)
+    {
+        if ((value & kOCW3ReadISR) == kOCW3ReadISR)
+        {
+            chip->readISR = true;
+        } else if ((value & kOCW3ReadISR) == kOCW3ReadIRR) {
+            chip->readISR = false;
+        }
+        return;
+    }
+
+    // OCW2
+    if (value & kOCW2EOI)
+    {
+        if (value & kOCW2Specific)
+        {
+            chip->isr &= ~(1 << (value & 7));
+        } else {
+            // Non-specific, the highest priority in-service level.
+            for (level = 0; level < 8; level++)
+            {
+                if (chip->isr & (1 << level))
+                {
+                    chip->isr &= ~(1 << level);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+bool PICSim::acceptIRQ(UInt32 irq)
+{
+    Chip *chip = &_chips[(irq >> 3) & 1];
+
+    if (chip->imr & (1 << (irq & 7)))
+    {
+        return false;
+    }
+
+    // A slave IRQ also goes in service on the master cascade input.
+    if ((irq & 8) && (_chips[0].imr & (1 << 2)))
+    {
+        return false;
+    }
+
+    if (!chip->autoEOI)
+    {
+        chip->isr |= (1 << (irq & 7));
+    }
+
+    if ((irq & 8) && (!_chips[0].autoEOI))
+    {
+        _chips[0].isr |= (1 << 2);
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+extern "C" void outb(uint16_t port, uint8_t value)
+{
+    gPICSim.portWrite(port, value);
+}
+
+//---------------------------------------------------------------------------
+extern "C" uint8_t inb(uint16_t port)
+{
+    return gPICSim.portRead(port);
+}
@@ -0,0 +1,63 @@
+/*
+ * Simulated pair of cascaded 8259 PICs and their ELCR trigger type
+ * registers, behind the inb() and outb() port accessors. The
+ * initialization sequence, the mask, in-service and trigger registers,
+ * automatic EOI and specific EOI commands are modeled, and every port
+ * access is counted.
+ */
+
+#ifndef _HARNESS_PICSIM_H
+#define _HARNESS_PICSIM_H
+
+#include <IOKitShim.h>
+
+class PICSim
+{
+public:
+    // The instance inb() and outb() go to.
+    static PICSim *instance(void);
+
+    void reset(void);
+
+    // Accept an IRQ, as the CPU acknowledge cycle would. Returns false
+    // if the IRQ is masked. The in-service bit is left set, unless the
+    // PIC it belongs to runs in automatic EOI mode.
+    bool acceptIRQ(UInt32 irq);
+
+    UInt16 mask(void) const { return (UInt16)(_chips[0].imr | (_chips[1].imr << 8)); }
+    UInt16 inService(void) const { return (UInt16)(_chips[0].isr | (_chips[1].isr << 8)); }
+    UInt16 triggerTypes(void) const { return (UInt16)(_elcr[0] | (_elcr[1] << 8)); }
+    bool autoEOI(UInt32 chip) const { return _chips[chip].autoEOI; }
+    UInt8 vectorBase(UInt32 chip) const { return _chips[chip].vectorBase; }
+
+    // Firmware trigger types, seen by the driver on start.
+    void setTriggerTypes(UInt16 types) { _elcr[0] = types & 0xff; _elcr[1] = types >> 8; }
+
+    UInt64 reads(void) const { return _reads; }
+    UInt64 writes(void) const { return _writes; }
+    UInt64 accesses(void) const { return _reads + _writes; }
+    void resetCounters(void) { _reads = 0; _writes = 0; }
+
+    UInt8 portRead(UInt16 port);
+    void portWrite(UInt16 port, UInt8 value);
+
+private:
+    struct Chip {
+        UInt8 imr;
+        UInt8 isr;
+        UInt8 vectorBase;
+        UInt8 initStep;     // next ICW expected on the data port, 0 when done
+        bool needICW4;
+        bool autoEOI;
+        bool readISR;
+    };
+
+    Chip *chipForPort(UInt16 port, bool *dataPort);
+
+    Chip _chips[2];
+    UInt8 _elcr[2];
+    volatile UInt64 _reads;
+    volatile UInt64 _writes;
+};
+
+#endif /* !_HARNESS_PICSIM_H */
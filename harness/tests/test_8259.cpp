@@ -0,0 +1,201 @@
+/*
+ * Port accesses per 8259 PIC operation. Every legacy port access costs
+ * about a microsecond, so the driver only writes the PIC a change is
+ * for, never rewrites a byte that would not change, and issues a single
+ * specific EOI per PIC that has the interrupt in service. In automatic
+ * EOI mode there are no EOIs at all, and level triggered IRQs are held
+ * masked while their handler runs.
+ */
+
+#include "Harness.h"
+
+enum {
+    kMasterIRQ  = 4,
+    kSlaveIRQ   = 11,
+    kLevelIRQ   = 10
+};
+
+// Check the port accesses since the last check.
+#define CHECK_PORTS(fixture, portReads, portWrites)                         \
+    do {                                                                    \
+        CHECK_EQ((fixture).sim->reads(), (portReads));                      \
+        CHECK_EQ((fixture).sim->writes(), (portWrites));                    \
+        (fixture).sim->resetCounters();                                     \
+    } while (0)
+
+static void checkStart(void)
+{
+    PICFixture fixture(false, (1 << kLevelIRQ) | (1 << 0));
+
+    CHECK(fixture.start());
+
+    // Two ELCR reads. Four ICWs per PIC, and one OCW3, OCW1 and ELCR
+    // write per PIC.
+    CHECK_PORTS(fixture, 2, 14);
+
+    CHECK_EQ(fixture.sim->vectorBase(0), kPICDefaultBaseVector);
+    CHECK_EQ(fixture.sim->vectorBase(1), kPICDefaultBaseVector + 8);
+    CHECK(!fixture.sim->autoEOI(0));
+    CHECK_EQ(fixture.sim->mask(), 0xffff & ~(1 << kPICSlaveID));
+
+    // IRQ 0 is always edge triggered, whatever the firmware left.
+    CHECK_EQ(fixture.sim->triggerTypes(), 1 << kLevelIRQ);
+}
+
+static void checkMask(void)
+{
+    PICFixture fixture;
+    UInt32 calls = 0;
+    IOService *master;
+    IOService *slave;
+
+    CHECK(fixture.start());
+
+    master = fixture.attach(kMasterIRQ, kInterruptTriggerModeEdge, countingHandler, &calls);
+    CHECK(master);
+    slave = fixture.attach(kSlaveIRQ, kInterruptTriggerModeEdge, countingHandler, &calls);
+    CHECK(slave);
+    fixture.sim->resetCounters();
+
+    // Masking writes only the OCW1 of the PIC the IRQ is on.
+    fixture.pic->disableVectorHard(kMasterIRQ, &fixture.pic->vectors[kMasterIRQ]);
+    CHECK_PORTS(fixture, 0, 1);
+    CHECK(fixture.sim->mask() & (1 << kMasterIRQ));
+
+    fixture.pic->disableVectorHard(kSlaveIRQ, &fixture.pic->vectors[kSlaveIRQ]);
+    CHECK_PORTS(fixture, 0, 1);
+    CHECK(fixture.sim->mask() & (1 << kSlaveIRQ));
+
+    // A mask that does not change is not written again.
+    fixture.pic->disableVectorHard(kMasterIRQ, &fixture.pic->vectors[kMasterIRQ]);
+    CHECK_PORTS(fixture, 0, 0);
+
+    fixture.pic->enableVector(kMasterIRQ, &fixture.pic->vectors[kMasterIRQ]);
+    fixture.pic->enableVector(kSlaveIRQ, &fixture.pic->vectors[kSlaveIRQ]);
+    CHECK_PORTS(fixture, 0, 2);
+    CHECK_EQ(fixture.sim->mask() & ((1 << kMasterIRQ) | (1 << kSlaveIRQ)), 0);
+
+    // The cascade input is never masked.
+    fixture.pic->disableVectorHard(kPICSlaveID, &fixture.pic->vectors[kPICSlaveID]);
+    CHECK_PORTS(fixture, 0, 0);
+    CHECK(0 == (fixture.sim->mask() & (1 << kPICSlaveID)));
+}
+
+static void checkDispatch(void)
+{
+    PICFixture fixture;
+    UInt32 calls = 0;
+
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kMasterIRQ, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(kSlaveIRQ, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(7, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(15, kInterruptTriggerModeEdge, countingHandler, &calls));
+    fixture.sim->resetCounters();
+
+    // One specific EOI on the master.
+    CHECK(fixture.raise(kMasterIRQ));
+    CHECK_PORTS(fixture, 0, 1);
+    CHECK_EQ(fixture.sim->inService(), 0);
+
+    // One on the slave, and one for the cascade input on the master.
+    CHECK(fixture.raise(kSlaveIRQ));
+    CHECK_PORTS(fixture, 0, 2);
+    CHECK_EQ(fixture.sim->inService(), 0);
+
+    // IRQ 7 and 15 read the in-service register first.
+    CHECK(fixture.raise(7));
+    CHECK_PORTS(fixture, 1, 1);
+    CHECK(fixture.raise(15));
+    CHECK_PORTS(fixture, 1, 2);
+    CHECK_EQ(fixture.sim->inService(), 0);
+    CHECK_EQ(calls, 4);
+
+    // Spurious IRQ 7 is not acknowledged, and spurious IRQ 15 only on
+    // the master cascade input, which did see a request.
+    fixture.dispatch(7);
+    CHECK_PORTS(fixture, 1, 0);
+    fixture.sim->acceptIRQ(kPICSlaveID);
+    fixture.dispatch(15);
+    CHECK_PORTS(fixture, 1, 1);
+    CHECK_EQ(fixture.sim->inService(), 0);
+    CHECK_EQ(calls, 4);
+
+    // The driver's counters agree with the simulator's.
+    CHECK_EQ(fixture.pic->_portReads, 2 + 4);
+    CHECK_EQ(fixture.pic->_portWrites, 14 + 4 + 1 + 2 + 1 + 2 + 1);
+}
+
+struct LevelHandlerState {
+    PICSim *sim;
+    UInt32 calls;
+    UInt32 maskedCalls;
+};
+
+static void levelHandler(void *target, void *refCon, void *nub, int source)
+{
+    LevelHandlerState *state = (LevelHandlerState *)refCon;
+
+    state->calls++;
+    if (state->sim->mask() & (1 << kLevelIRQ))
+    {
+        state->maskedCalls++;
+    }
+}
+
+static void checkAutoEOI(void)
+{
+    PICFixture fixture(true);
+    LevelHandlerState level = { fixture.sim, 0, 0 };
+    UInt32 calls = 0;
+
+    CHECK(fixture.start());
+    CHECK_PORTS(fixture, 2, 14);
+    CHECK(fixture.sim->autoEOI(0));
+    CHECK(fixture.sim->autoEOI(1));
+
+    CHECK(fixture.attach(kMasterIRQ, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(kSlaveIRQ, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(7, kInterruptTriggerModeEdge, countingHandler, &calls));
+    CHECK(fixture.attach(kLevelIRQ, kInterruptTriggerModeLevel | kInterruptPolarityLow, levelHandler, &level));
+    CHECK(fixture.sim->triggerTypes() & (1 << kLevelIRQ));
+    fixture.sim->resetCounters();
+
+    // Edge triggered IRQs cost no port access on either PIC, and IRQ 7
+    // is not looked at.
+    CHECK(fixture.raise(kMasterIRQ));
+    CHECK_PORTS(fixture, 0, 0);
+    CHECK(fixture.raise(kSlaveIRQ));
+    CHECK_PORTS(fixture, 0, 0);
+    CHECK(fixture.raise(7));
+    CHECK_PORTS(fixture, 0, 0);
+    CHECK_EQ(fixture.sim->inService(), 0);
+    CHECK_EQ(calls, 3);
+
+    // A level triggered IRQ is masked around its handler, one OCW1
+    // write each way.
+    CHECK(fixture.raise(kLevelIRQ));
+    CHECK_PORTS(fixture, 0, 2);
+    CHECK_EQ(level.calls, 1);
+    CHECK_EQ(level.maskedCalls, 1);
+    CHECK(0 == (fixture.sim->mask() & (1 << kLevelIRQ)));
+
+    // Masked, it is not delivered, and costs nothing.
+    fixture.pic->disableVectorHard(kLevelIRQ, &fixture.pic->vectors[kLevelIRQ]);
+    fixture.sim->resetCounters();
+    CHECK(!fixture.raise(kLevelIRQ));
+    CHECK_PORTS(fixture, 0, 0);
+    CHECK_EQ(level.calls, 1);
+}
+
+int main(void)
+{
+    ShimSetLogging(false);
+
+    checkStart();
+    checkMask();
+    checkDispatch();
+    checkAutoEOI();
+
+    return harnessResult("test_8259");
+}
@@ -0,0 +1,168 @@
+/*
+ * apicstat maps the statistics region of a running controller through
+ * the user space shim, and copies it under the sequence. A region caught
+ * mid-update is not used, and every copy taken while the kernel keeps
+ * updating it is consistent.
+ */
+
+#include "Harness.h"
+
+#define main apicstatMain
+#include "../../apicstat/apicstat.c"
+#undef main
+
+enum {
+    kPins       = 24,
+    kPin        = 5,
+    kInterval   = 60000000, // us, so only the update on open is timed
+    kUpdates    = 2000
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+struct StatTest {
+    APICFixture *fixture;
+    Controller *controller;
+    volatile bool done;
+    UInt32 snapshots;
+    UInt32 torn;
+};
+
+// An update as the timer makes it.
+static void update(HarnessAPIC *apic)
+{
+    IOLockLock(apic->_statsLock);
+    apic->updateStatisticsExport();
+    IOLockUnlock(apic->_statsLock);
+}
+
+static const APICVectorStatistics *snapshotVectors(Controller *controller)
+{
+    const APICStatistics *stats = (const APICStatistics *)controller->current;
+
+    return (const APICVectorStatistics *)(controller->current + stats->vectorOffset);
+}
+
+// The per-CPU totals are summed after each vector total is read, so in
+// one update they never come to less than the vector totals.
+static bool snapshotConsistent(Controller *controller)
+{
+    const APICStatistics *stats = (const APICStatistics *)controller->current;
+    const APICVectorStatistics *vectors = snapshotVectors(controller);
+    const UInt64 *cpuDelivered = (const UInt64 *)(controller->current + stats->cpuOffset);
+    UInt64 vectorTotal = 0;
+    UInt64 cpuTotal = 0;
+    UInt32 i;
+
+    for (i = 0; i < stats->vectorCount; i++)
+    {
+        vectorTotal += vectors[i].delivered;
+    }
+
+    for (i = 0; i < stats->cpuCount; i++)
+    {
+        cpuTotal += cpuDelivered[i];
+    }
+
+    return (cpuTotal >= vectorTotal);
+}
+
+static void statLoop(UInt32 cpu, void *arg)
+{
+    StatTest *test = (StatTest *)arg;
+    UInt32 i;
+
+    if (cpu == 0)
+    {
+        for (i = 0; i < kUpdates; i++)
+        {
+            test->fixture->dispatch(kPin);
+            update(test->fixture->apic);
+        }
+
+        test->done = true;
+        return;
+    }
+
+    while (!test->done)
+    {
+        if (takeSnapshot(test->controller))
+        {
+            test->snapshots++;
+            if (!snapshotConsistent(test->controller))
+            {
+                test->torn++;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    Controller *controller;
+    StatTest test;
+    UInt64 deadline;
+    int i;
+
+    ShimSetLogging(false);
+
+    fixture.setTunable(kStatisticsIntervalKey, kInterval);
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kPin, kInterruptTriggerModeEdge, nullHandler));
+
+    openControllers();
+    CHECK_EQ(gControllerCount, 1);
+    controller = &gControllers[0];
+    CHECK_EQ(controller->vectorCount, kPins);
+    CHECK(controller->address == (uintptr_t)fixture.apic->_stats);
+
+    // The open makes the first update. Wait here, as apicstat sleeps a
+    // whole interval if it is not there yet.
+    deadline = harnessNanoseconds() + 2000000000ULL;
+    while ((0 == fixture.apic->_stats->updateCount) && (harnessNanoseconds() < deadline))
+    {
+        usleep(100);
+    }
+    CHECK(waitForFirstUpdate(controller));
+
+    for (i = 0; i < 3; i++)
+    {
+        fixture.dispatch(kPin);
+    }
+    update(fixture.apic);
+    CHECK(takeSnapshot(controller));
+    CHECK_EQ(snapshotVectors(controller)[kPin].delivered, 3);
+    CHECK_EQ(((const APICStatistics *)controller->current)->updateCount, 2);
+
+    // Left mid-update, the region is not copied however long it waits.
+    fixture.apic->_stats->sequence++;
+    CHECK(!takeSnapshot(controller));
+    fixture.apic->_stats->sequence++;
+
+    fixture.dispatch(kPin);
+    update(fixture.apic);
+    CHECK(takeSnapshot(controller));
+    CHECK_EQ(snapshotVectors(controller)[kPin].delivered, 4);
+
+    // Read while the kernel keeps updating.
+    bzero(&test, sizeof(test));
+    test.fixture = &fixture;
+    test.controller = controller;
+    harnessRunThreads(2, statLoop, &test);
+    CHECK(test.snapshots > 0);
+    CHECK_EQ(test.torn, 0);
+
+    CHECK(takeSnapshot(controller));
+    CHECK_EQ(snapshotVectors(controller)[kPin].delivered, 4 + kUpdates);
+    CHECK(snapshotConsistent(controller));
+
+    CHECK_EQ(IOConnectUnmapMemory64(controller->connect, kAPICStatisticsMemoryType, mach_task_self(),
+                                    controller->address), KERN_SUCCESS);
+    CHECK_EQ(IOServiceClose(controller->connect), KERN_SUCCESS);
+    CHECK_EQ(fixture.apic->_statsClients, 0);
+
+    return harnessResult("test_apicstat");
+}
@@ -0,0 +1,116 @@
+/*
+ * Balancer decisions from synthetic interrupt rates. Every vector starts
+ * on the first CPU, and each period moves the hottest vector that fits
+ * in the imbalance to the least busy CPU, until the loads are within the
+ * threshold. Moved vectors keep their delivery mode.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kVectors    = 8,
+    kCPUs       = 4
+};
+
+static const UInt32 kRates[kVectors] = { 100, 80, 60, 40, 10, 10, 10, 10 };
+
+static UInt32 destination(APICFixture *fixture, UInt32 pin)
+{
+    return fixture->sim->entryHigh(pin) >> 24;
+}
+
+// Set the rates as sampleVectorRates() would from the counters, and
+// run one balancer period.
+static void period(APICFixture *fixture)
+{
+    UInt32 pin;
+
+    for (pin = 0; pin < kVectors; pin++)
+    {
+        fixture->apic->_vectorState[pin].rate = kRates[pin];
+    }
+
+    fixture->apic->balanceVectors();
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    OSArray *apicIDs;
+    OSNumber *num;
+    UInt32 calls = 0;
+    UInt32 pin;
+    UInt32 i;
+
+    // Lowest priority delivery, with the balancer picking physical
+    // destinations. The interval only has to keep the timer out of
+    // the way, every period is run by hand.
+    apicIDs = OSArray::withCapacity(kCPUs);
+    for (i = 0; i < kCPUs; i++)
+    {
+        num = OSNumber::withNumber(i, 32);
+        apicIDs->setObject(num);
+        num->release();
+    }
+    fixture.provider->setProperty(kBalancerAPICIDsKey, apicIDs);
+    apicIDs->release();
+    fixture.setTunable(kBalancerIntervalKey, 3600000);
+    fixture.setTunable(kLowestPriorityDeliveryKey, 1);
+
+    CHECK(fixture.start());
+    for (pin = 0; pin < kVectors; pin++)
+    {
+        CHECK(fixture.attach(pin, kInterruptTriggerModeEdge, countingHandler, &calls));
+        CHECK_EQ(destination(&fixture, pin), 0);
+    }
+
+    // Rates come from the delivered counters.
+    for (i = 0; i < 5; i++)
+    {
+        fixture.raise(3);
+    }
+    fixture.apic->sampleVectorRates();
+    CHECK_EQ(fixture.apic->_vectorState[3].rate, 5);
+    CHECK_EQ(fixture.apic->_vectorState[2].rate, 0);
+    fixture.apic->sampleVectorRates();
+    CHECK_EQ(fixture.apic->_vectorState[3].rate, 0);
+
+    // Loads 280/0/0/0: the hottest vector goes to the first idle CPU.
+    period(&fixture);
+    CHECK_EQ(destination(&fixture, 0), 1);
+
+    // 180/100/0/0
+    period(&fixture);
+    CHECK_EQ(destination(&fixture, 1), 2);
+
+    // 100/100/80/0
+    period(&fixture);
+    CHECK_EQ(destination(&fixture, 2), 3);
+
+    // 80/100/80/60: vector 0 would only swap the roles of CPUs 1 and 3,
+    // and it is still held off anyway. Nothing moves from here on.
+    for (i = 0; i < 8; i++)
+    {
+        period(&fixture);
+    }
+
+    CHECK_EQ(destination(&fixture, 0), 1);
+    CHECK_EQ(destination(&fixture, 1), 2);
+    CHECK_EQ(destination(&fixture, 2), 3);
+    for (pin = 3; pin < kVectors; pin++)
+    {
+        CHECK_EQ(destination(&fixture, pin), 0);
+    }
+
+    // Moves only change the destination.
+    for (pin = 0; pin < kVectors; pin++)
+    {
+        CHECK_EQ(fixture.sim->entryLow(pin) & kRTLODeliveryModeMask, kRTLODeliveryModeLowestPriority);
+        CHECK_EQ(fixture.sim->entryLow(pin) & kRTLODestinationModeMask, kRTLODestinationModePhysical);
+        CHECK_EQ(fixture.sim->entryLow(pin) & kRTLOMaskMask, kRTLOMaskEnabled);
+        CHECK_EQ(fixture.sim->entryLow(pin) & IOAPICSim::kRTLOVectorMask, pin);
+    }
+
+    return harnessResult("test_balancer");
+}
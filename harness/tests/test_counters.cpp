@@ -0,0 +1,90 @@
+/*
+ * Per-CPU interrupt counters come from pooled slabs, one slot per
+ * registered vector. Counts land on the right vector across slabs and
+ * CPUs, and hits on unregistered vectors, which share slot 0, are still
+ * counted per vector.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 120,
+    kRegistered = 12,       // more than one slab
+    kUnusedPin  = 119,
+    kThreads    = 4
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static UInt32 pinOf(UInt32 i)
+{
+    return i * 9;
+}
+
+static void dispatchLoop(UInt32 cpu, void *arg)
+{
+    APICFixture *fixture = (APICFixture *)arg;
+    UInt32 i, n;
+
+    // Vector i is taken i + 1 times on every CPU.
+    for (i = 0; i < kRegistered; i++)
+    {
+        for (n = 0; n <= i; n++)
+        {
+            fixture->dispatch(pinOf(i));
+        }
+    }
+}
+
+int main(void)
+{
+    APICFixture fixture(kPins);
+    VectorCounters total;
+    UInt32 i, j;
+
+    ShimSetLogging(false);
+
+    CHECK(fixture.start());
+    CHECK_EQ(fixture.apic->_counterSlotsUsed, 1);
+
+    for (i = 0; i < kRegistered; i++)
+    {
+        CHECK(fixture.attach(pinOf(i), kInterruptTriggerModeEdge, nullHandler));
+    }
+
+    // Every registered vector has a slot of its own.
+    CHECK_EQ(fixture.apic->_counterSlotsUsed, kRegistered + 1);
+    for (i = 0; i < kRegistered; i++)
+    {
+        CHECK(fixture.apic->_counterSlot[pinOf(i)] != 0);
+        for (j = 0; j < i; j++)
+        {
+            CHECK(fixture.apic->_counterSlot[pinOf(i)] != fixture.apic->_counterSlot[pinOf(j)]);
+        }
+    }
+    CHECK_EQ(fixture.apic->_counterSlot[kUnusedPin], 0);
+
+    harnessRunThreads(kThreads, dispatchLoop, &fixture);
+
+    for (i = 0; i < kRegistered; i++)
+    {
+        fixture.apic->sumVectorCounters(pinOf(i), &total);
+        CHECK_EQ(total.delivered, (i + 1) * kThreads);
+        CHECK_EQ(total.spurious, 0);
+    }
+
+    // An unregistered vector is counted, and does not count for others.
+    fixture.dispatch(kUnusedPin);
+    fixture.dispatch(kUnusedPin);
+    fixture.apic->sumVectorCounters(kUnusedPin, &total);
+    CHECK_EQ(total.spurious, 2);
+    CHECK_EQ(total.delivered, 0);
+    CHECK_EQ(total.hardDisabled, 0);
+
+    fixture.apic->sumVectorCounters(kUnusedPin - 1, &total);
+    CHECK_EQ(total.spurious, 0);
+
+    return harnessResult("test_counters");
+}
@@ -0,0 +1,129 @@
+/*
+ * With EOI broadcasts off, a level triggered entry only delivers again
+ * once the driver clears its Remote IRR: through the EOI register on
+ * version 0x20 parts, and by toggling the trigger mode on older ones.
+ * Edge triggered entries are left alone.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kLevelPin   = 9,
+    kEdgePin    = 4,
+    kRaises     = 100,
+    kThreads    = 4
+};
+
+static void checkDirectedEOI(UInt32 version)
+{
+    APICFixture fixture(kPins, 0, version);
+    UInt32 levelCalls = 0;
+    UInt32 edgeCalls = 0;
+    UInt32 l32;
+    int i;
+
+    fixture.setTunable(kDirectedEOIKey, 1);
+
+    CHECK(fixture.start());
+    CHECK(fixture.apic->_directedEOI);
+    CHECK(fixture.attach(kLevelPin, kInterruptTriggerModeLevel | kInterruptPolarityLow, countingHandler, &levelCalls));
+    CHECK(fixture.attach(kEdgePin, kInterruptTriggerModeEdge, countingHandler, &edgeCalls));
+
+    l32 = fixture.sim->entryLow(kLevelPin);
+    fixture.sim->resetCounters();
+
+    for (i = 0; i < kRaises; i++)
+    {
+        CHECK(fixture.raise(kLevelPin));
+        CHECK(!fixture.sim->remoteIRR(kLevelPin));
+        CHECK(fixture.raise(kEdgePin));
+    }
+
+    CHECK_EQ(levelCalls, kRaises);
+    CHECK_EQ(edgeCalls, kRaises);
+
+    // The entry is back to what it was, level triggered and unmasked.
+    CHECK_EQ(fixture.sim->entryLow(kLevelPin), l32);
+
+    if (version >= 0x20)
+    {
+        CHECK_EQ(fixture.sim->eoiWrites(), kRaises);
+        CHECK_EQ(fixture.sim->writes(), kRaises);
+    } else {
+        CHECK_EQ(fixture.sim->eoiWrites(), 0);
+        // Two entry writes per EOI, and selecting the entry once.
+        CHECK_EQ(fixture.sim->writes(), (kRaises * 2) + 1);
+    }
+}
+
+static void checkBroadcastEOI(void)
+{
+    APICFixture fixture(kPins);
+    UInt32 calls = 0;
+
+    CHECK(fixture.start());
+    CHECK(!fixture.apic->_directedEOI);
+    CHECK(fixture.attach(kLevelPin, kInterruptTriggerModeLevel | kInterruptPolarityLow, countingHandler, &calls));
+
+    // Without the EOI the entry stays blocked.
+    CHECK(fixture.sim->assertPin(kLevelPin));
+    fixture.dispatch(kLevelPin);
+    CHECK(fixture.sim->remoteIRR(kLevelPin));
+    CHECK(!fixture.sim->assertPin(kLevelPin));
+    CHECK_EQ(fixture.sim->eoiWrites(), 0);
+    CHECK_EQ(calls, 1);
+}
+
+struct CounterTest {
+    APICFixture *fixture;
+};
+
+static void raiseLevelPins(UInt32 cpu, void *arg)
+{
+    CounterTest *test = (CounterTest *)arg;
+    int i;
+
+    for (i = 0; i < 10000; i++)
+    {
+        test->fixture->raise(cpu);
+    }
+}
+
+// EOI register writes race with entry writes on other CPUs, and must
+// still be counted exactly.
+static void checkWriteCounter(void)
+{
+    APICFixture fixture(kPins);
+    CounterTest test;
+    UInt32 calls = 0;
+    UInt64 writes;
+    UInt32 pin;
+
+    fixture.setTunable(kDirectedEOIKey, 1);
+    CHECK(fixture.start());
+
+    for (pin = 0; pin < kThreads; pin++)
+    {
+        CHECK(fixture.attach(pin, kInterruptTriggerModeLevel | kInterruptPolarityLow, countingHandler, &calls));
+    }
+
+    test.fixture = &fixture;
+    writes = fixture.apic->_mmioWrites + fixture.apic->_eoiWrites;
+    fixture.sim->resetCounters();
+
+    harnessRunThreads(kThreads, raiseLevelPins, &test);
+
+    CHECK_EQ(calls, kThreads * 10000);
+    CHECK_EQ((fixture.apic->_mmioWrites + fixture.apic->_eoiWrites) - writes, fixture.sim->writes());
+}
+
+int main(int argc, char **argv)
+{
+    checkDirectedEOI(0x20);
+    checkDirectedEOI(0x11);
+    checkBroadcastEOI();
+    checkWriteCounter();
+
+    return harnessResult("test_directed_eoi");
+}
@@ -0,0 +1,59 @@
+/*
+ * Global system interrupts resolve to the I/O APIC that owns them. The
+ * LookupGlobalSystemInterrupt platform function hands out a retained
+ * controller, and a stopped controller is gone from the map.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24
+};
+
+static IOReturn platformLookup(APICFixture &fixture, UInt32 gsi, IOInterruptController **found, UInt32 *pin)
+{
+    return fixture.apic->callPlatformFunction(OSSymbol::withCString(kLookupGlobalSystemInterrupt),
+                                              false, (void *)(uintptr_t)gsi, found, pin, 0);
+}
+
+int main(void)
+{
+    APICFixture first(kPins, 0);
+    APICFixture second(kPins, kPins);
+    IOInterruptController *found = 0;
+    IOInterruptVectorNumber vectorPin = 0;
+    UInt32 pin = 0;
+    int retainCount;
+
+    ShimSetLogging(false);
+
+    CHECK(first.start());
+    CHECK(second.start());
+
+    CHECK(first.apic == AppleAPIC::lookupGlobalSystemInterrupt(5, &vectorPin));
+    CHECK_EQ(vectorPin, 5);
+    CHECK(second.apic == AppleAPIC::lookupGlobalSystemInterrupt(kPins + 7, &vectorPin));
+    CHECK_EQ(vectorPin, 7);
+    CHECK(0 == AppleAPIC::lookupGlobalSystemInterrupt(2 * kPins, &vectorPin));
+
+    // Asked of one controller, answered for the other, and retained.
+    retainCount = second.apic->getRetainCount();
+    CHECK_EQ(kIOReturnSuccess, platformLookup(first, kPins + 7, &found, &pin));
+    CHECK(found == second.apic);
+    CHECK_EQ(pin, 7);
+    CHECK_EQ(second.apic->getRetainCount(), retainCount + 1);
+    if (found)
+    {
+        found->release();
+    }
+
+    CHECK_EQ(kIOReturnNotFound, platformLookup(first, 2 * kPins, &found, &pin));
+
+    // Stopped, the controller leaves the map while still retained.
+    second.apic->stop(second.provider);
+    CHECK(0 == AppleAPIC::lookupGlobalSystemInterrupt(kPins + 7, &vectorPin));
+    CHECK_EQ(kIOReturnNotFound, platformLookup(first, kPins + 7, &found, &pin));
+    CHECK(first.apic == AppleAPIC::lookupGlobalSystemInterrupt(5, &vectorPin));
+
+    return harnessResult("test_gsi");
+}
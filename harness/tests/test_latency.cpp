@@ -0,0 +1,163 @@
+/*
+ * Handler time histograms: every time lands in a bucket whose limit is
+ * at most 1 / kLatencySubBuckets above it, the published percentiles
+ * are never under the exact ones and within a bucket of them, and
+ * ResetInterruptLatency empties the histograms.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kPin        = 5,
+    kSamples    = 100000
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+    UInt64 timeA = *(const UInt64 *)a;
+    UInt64 timeB = *(const UInt64 *)b;
+
+    return (timeA < timeB) ? -1 : ((timeA > timeB) ? 1 : 0);
+}
+
+static void checkBuckets(void)
+{
+    UInt64 cycles;
+    UInt64 limit;
+    UInt32 bucket;
+    UInt32 previous = kLatencySubBuckets - 1;
+    int shift;
+
+    for (bucket = 0; bucket < kLatencySubBuckets; bucket++)
+    {
+        CHECK_EQ(latencyBucket(bucket), bucket);
+        CHECK_EQ(latencyBucketLimit(bucket), bucket);
+    }
+
+    // Both edges of every bucket, and every bucket in order. The last
+    // one also takes every longer time.
+    for (shift = kLatencySubBucketShift; shift < kLatencyMaxShift; shift++)
+    {
+        for (cycles = 1ULL << shift; cycles < (2ULL << shift); cycles += (1ULL << (shift - kLatencySubBucketShift)))
+        {
+            bucket = latencyBucket(cycles);
+            limit = latencyBucketLimit(bucket);
+
+            CHECK_EQ(bucket, previous + 1);
+            CHECK(limit >= cycles);
+            CHECK((limit - cycles) < (cycles / kLatencySubBuckets));
+            CHECK_EQ(latencyBucket(limit), bucket);
+            if (bucket < (kLatencyBucketCount - 1))
+            {
+                CHECK_EQ(latencyBucket(limit + 1), bucket + 1);
+            }
+            previous = bucket;
+        }
+    }
+
+    CHECK_EQ(latencyBucket(1ULL << kLatencyMaxShift), kLatencyBucketCount - 1);
+    CHECK_EQ(latencyBucket(~0ULL), kLatencyBucketCount - 1);
+}
+
+static UInt64 getLatency(OSDictionary *dict, const char *key)
+{
+    OSDictionary *latency = OSDynamicCast(OSDictionary, dict->getObject(kStatisticsLatencyKey));
+    OSNumber *num;
+
+    if (0 == latency)
+    {
+        return 0;
+    }
+
+    num = OSDynamicCast(OSNumber, latency->getObject(key));
+    return num ? num->unsigned64BitValue() : 0;
+}
+
+static void checkPercentile(OSDictionary *dict, const char *key, const UInt64 *sorted, UInt32 permille)
+{
+    UInt64 exact = sorted[(((UInt64)kSamples * permille) + 999) / 1000 - 1];
+    UInt64 published = getLatency(dict, key);
+
+    CHECK(published >= exact);
+    CHECK((published - exact) <= (exact / kLatencySubBuckets));
+}
+
+static void checkPercentiles(void)
+{
+    APICFixture fixture(kPins);
+    LatencyHistogram *histogram;
+    OSDictionary *dict;
+    UInt64 *times;
+    UInt32 i;
+
+    fixture.setTunable(kLatencyHistogramKey, 1);
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kPin, kInterruptTriggerModeEdge, nullHandler));
+
+    histogram = fixture.apic->_vectorState[kPin].latency;
+    CHECK(histogram);
+    if (0 == histogram)
+    {
+        return;
+    }
+
+    // A body around 2000 cycles, and a long tail up to a few million.
+    times = new UInt64[kSamples];
+    srandom(1);
+    for (i = 0; i < kSamples; i++)
+    {
+        times[i] = 1500 + (random() % 1000);
+        if (0 == (i % 50))
+        {
+            times[i] = 10000 + (random() % 100000);
+        }
+        if (0 == (i % 997))
+        {
+            times[i] = 1000000 + (random() % 4000000);
+        }
+    }
+
+    fixture.apic->resetLatencyHistograms();
+    for (i = 0; i < kSamples; i++)
+    {
+        recordLatency(histogram, times[i]);
+    }
+
+    qsort(times, kSamples, sizeof(UInt64), compareTimes);
+
+    dict = OSDictionary::withCapacity(4);
+    fixture.apic->publishLatency(kPin, dict);
+
+    CHECK_EQ(getLatency(dict, kLatencyCountKey), kSamples);
+    CHECK_EQ(getLatency(dict, kLatencyMaxKey), times[kSamples - 1]);
+    checkPercentile(dict, kLatencyP50Key, times, 500);
+    checkPercentile(dict, kLatencyP99Key, times, 990);
+    checkPercentile(dict, kLatencyP999Key, times, 999);
+    dict->release();
+
+    // Reset through the platform function.
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->callPlatformFunction(OSSymbol::withCString(kResetInterruptLatency),
+                                                                  false, 0, 0, 0, 0));
+    dict = OSDictionary::withCapacity(4);
+    fixture.apic->publishLatency(kPin, dict);
+    CHECK(0 == dict->getObject(kStatisticsLatencyKey));
+    CHECK_EQ(histogram->maximum, 0);
+    dict->release();
+
+    delete [] times;
+}
+
+int main(void)
+{
+    ShimSetLogging(false);
+
+    checkBuckets();
+    checkPercentiles();
+
+    return harnessResult("test_latency");
+}
@@ -0,0 +1,117 @@
+/*
+ * Mask bit flips from many CPUs at once, on their own vectors and racing
+ * a retarget of the same vector, must always leave the hardware entry
+ * equal to the vector table, with the mask state of the last flip.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 48,
+    kThreads    = 8,
+    kFlips      = 20000
+};
+
+struct MaskTest {
+    APICFixture *fixture;
+    volatile bool retargetDone;
+    bool masked[kPins];
+};
+
+static void maskOrUnmask(HarnessAPIC *apic, UInt32 pin, bool mask)
+{
+    if (mask)
+    {
+        apic->disableVectorHard(pin, &apic->vectors[pin]);
+    } else {
+        apic->enableVector(pin, &apic->vectors[pin]);
+    }
+}
+
+// Each CPU flips its own pins at random, and leaves them in a random state.
+static void flipOwnPins(UInt32 cpu, void *arg)
+{
+    MaskTest *test = (MaskTest *)arg;
+    unsigned int seed = cpu + 1;
+    UInt32 pin;
+    bool mask;
+    int i;
+
+    for (i = 0; i < kFlips; i++)
+    {
+        pin = cpu + (kThreads * (rand_r(&seed) % (kPins / kThreads)));
+        mask = rand_r(&seed) & 1;
+        maskOrUnmask(test->fixture->apic, pin, mask);
+        test->masked[pin] = mask;
+    }
+}
+
+// CPU 0 flips the mask of pin 0 while CPU 1 retargets it.
+static void flipAndRetarget(UInt32 cpu, void *arg)
+{
+    MaskTest *test = (MaskTest *)arg;
+    HarnessAPIC *apic = test->fixture->apic;
+    int i;
+
+    if (cpu == 0)
+    {
+        for (i = 0; !test->retargetDone; i++)
+        {
+            maskOrUnmask(apic, 0, i & 1);
+        }
+        maskOrUnmask(apic, 0, false);
+    } else {
+        for (i = 0; i < kFlips; i++)
+        {
+            apic->setVectorPhysicalDestination(0, i & 0xF);
+        }
+        test->retargetDone = true;
+    }
+}
+
+static void checkEntries(APICFixture *fixture)
+{
+    UInt32 pin;
+
+    for (pin = 0; pin < kPins; pin++)
+    {
+        CHECK_EQ(fixture->sim->entryLow(pin) & ~(UInt32)IOAPICSim::kRTLOReadOnlyMask,
+                 fixture->apic->_vectorTable[pin].l32);
+        CHECK_EQ(fixture->sim->entryHigh(pin), fixture->apic->_vectorTable[pin].h32);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    MaskTest test;
+    UInt32 calls = 0;
+    UInt32 pin;
+
+    bzero(&test, sizeof(test));
+    test.fixture = &fixture;
+
+    CHECK(fixture.start());
+    for (pin = 0; pin < kPins; pin++)
+    {
+        CHECK(fixture.attach(pin, kInterruptTriggerModeEdge, countingHandler, &calls));
+    }
+
+    harnessRunThreads(kThreads, flipOwnPins, &test);
+
+    for (pin = 0; pin < kPins; pin++)
+    {
+        CHECK_EQ(!!(fixture.sim->entryLow(pin) & IOAPICSim::kRTLOMasked), test.masked[pin]);
+    }
+    checkEntries(&fixture);
+
+    harnessRunThreads(2, flipAndRetarget, &test);
+
+    CHECK(0 == (fixture.sim->entryLow(0) & IOAPICSim::kRTLOMasked));
+    CHECK_EQ(fixture.sim->entryHigh(0) >> 24, (kFlips - 1) & 0xF);
+    CHECK_EQ(fixture.sim->entryLow(0) & IOAPICSim::kRTLOVectorMask, 0);
+    checkEntries(&fixture);
+    CHECK_EQ(calls, 0);
+
+    return harnessResult("test_mask");
+}
@@ -0,0 +1,153 @@
+/*
+ * With an interrupt remapping index, every redirection entry is in
+ * remappable format and points at its own remapping table entry. The
+ * table entries carry the vector, modes and destination, in the format
+ * of the remapping mode, and every change is reported to the remapping
+ * hardware driver for invalidation.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins           = 24,
+    kIndexBase      = 0x7FF8,   // pins from 8 on set index bit 15
+    kEdgePin        = 3,
+    kLevelPin       = 9
+};
+
+struct InvalidateLog {
+    UInt32 calls;
+    UInt32 lastIndex;
+};
+
+static void invalidateEntry(void *refCon, UInt32 index)
+{
+    InvalidateLog *log = (InvalidateLog *)refCon;
+
+    log->calls++;
+    log->lastIndex = index;
+}
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+static IOReturn getTable(APICFixture &fixture, RemapEntry **entries, InvalidateLog *log)
+{
+    IOBufferMemoryDescriptor *table = 0;
+    UInt32 indexBase = 0;
+    IOReturn result;
+
+    result = fixture.apic->callPlatformFunction(OSSymbol::withCString(kGetInterruptRemapTable), false,
+                                                &table, &indexBase, (void *)invalidateEntry, log);
+    if (kIOReturnSuccess == result)
+    {
+        CHECK_EQ(indexBase, kIndexBase);
+        *entries = (RemapEntry *)table->getBytesNoCopy();
+        table->release();
+    }
+
+    return result;
+}
+
+static void checkRemap(bool x2APIC)
+{
+    APICFixture fixture(kPins);
+    InvalidateLog log = { 0, 0 };
+    RemapEntry *entries = 0;
+    UInt32 index;
+    UInt32 calls;
+    UInt32 pin;
+    UInt32 l32;
+    UInt32 h32;
+    int i;
+
+    fixture.setTunable(kInterruptRemapIndexKey, kIndexBase);
+    fixture.setTunable(kInterruptRemapX2APICKey, x2APIC);
+
+    CHECK(fixture.start());
+    CHECK_EQ(kIOReturnSuccess, getTable(fixture, &entries, &log));
+    if (0 == entries)
+    {
+        return;
+    }
+
+    CHECK(fixture.attach(kEdgePin, kInterruptTriggerModeEdge, nullHandler));
+    CHECK(fixture.attach(kLevelPin, kInterruptTriggerModeLevel | kInterruptPolarityLow, nullHandler));
+    CHECK(log.calls > 0);
+
+    // Redirection entries: remappable format, the index split between
+    // bits 31:17 of the high half and bit 11 of the low half. The two
+    // pins are on either side of index bit 15.
+    for (i = 0; i < 2; i++)
+    {
+        pin = i ? kLevelPin : kEdgePin;
+        index = kIndexBase + pin;
+        h32 = fixture.sim->entryHigh(pin);
+        l32 = fixture.sim->entryLow(pin);
+
+        CHECK(h32 & kRTHIInterruptFormatRemappable);
+        CHECK_EQ((h32 & kRTHIInterruptIndexMask) >> kRTHIInterruptIndexShift, index & 0x7FFF);
+        CHECK_EQ(0 != (l32 & kRTLOInterruptIndex15Mask), 0 != (index & 0x8000));
+    }
+
+    l32 = entries[kLevelPin].l32;
+    CHECK(l32 & kIRTEPresent);
+    CHECK(l32 & kIRTETriggerModeLevel);
+    CHECK(0 == (l32 & kIRTEDestinationModeLogical));
+    CHECK_EQ((l32 >> kIRTEVectorShift) & 0xFF, fixture.sim->entryLow(kLevelPin) & IOAPICSim::kRTLOVectorMask);
+    CHECK(0 == (entries[kEdgePin].l32 & kIRTETriggerModeLevel));
+
+    // Retarget: the destination is in the format of the remapping mode,
+    // and the hardware hears about the entry that changed.
+    calls = log.calls;
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->setVectorPhysicalDestination(kLevelPin, 0x12));
+    CHECK_EQ(entries[kLevelPin].destination, x2APIC ? 0x12 : (0x12 << kIRTEDestinationXAPICShift));
+    CHECK(log.calls > calls);
+    CHECK_EQ(log.lastIndex, kIndexBase + kLevelPin);
+
+    // The same destination again leaves the entry, and the cache, alone.
+    calls = log.calls;
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->setVectorPhysicalDestination(kLevelPin, 0x12));
+    CHECK_EQ(log.calls, calls);
+
+    // Only x2APIC mode takes destinations past 8 bits.
+    if (x2APIC)
+    {
+        CHECK_EQ(kIOReturnSuccess, fixture.apic->setVectorPhysicalDestination(kEdgePin, 0x12345));
+        CHECK_EQ(entries[kEdgePin].destination, 0x12345);
+        CHECK_EQ(log.lastIndex, kIndexBase + kEdgePin);
+    } else {
+        CHECK_EQ(kIOReturnBadArgument, fixture.apic->setVectorPhysicalDestination(kEdgePin, 0x100));
+        CHECK_EQ(kIOReturnBadArgument, fixture.apic->setVectorLogicalDestination(kEdgePin, 0x100, false));
+    }
+
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->setVectorLogicalDestination(kEdgePin, 0x0F, true));
+    CHECK(entries[kEdgePin].l32 & kIRTEDestinationModeLogical);
+    CHECK(entries[kEdgePin].l32 & kIRTERedirectionHint);
+    CHECK_EQ(entries[kEdgePin].destination, x2APIC ? 0x0F : (0x0F << kIRTEDestinationXAPICShift));
+}
+
+static void checkWithoutRemap(void)
+{
+    APICFixture fixture(kPins);
+    InvalidateLog log = { 0, 0 };
+    RemapEntry *entries = 0;
+
+    CHECK(fixture.start());
+    CHECK_EQ(kIOReturnUnsupported, getTable(fixture, &entries, &log));
+}
+
+int main(void)
+{
+    ShimSetLogging(false);
+
+    // The hardware reads 128-bit entries.
+    CHECK_EQ(sizeof(RemapEntry), 16);
+
+    checkRemap(false);
+    checkRemap(true);
+    checkWithoutRemap();
+
+    return harnessResult("test_remap");
+}
@@ -0,0 +1,174 @@
+/*
+ * Chained handlers added to and removed from a shared vector while other
+ * CPUs keep taking its interrupt. Removal must not wait on the stream of
+ * new dispatches, and a removed handler must never run once
+ * unregisterInterrupt() has returned. A chained handler enabled while
+ * the primary handler goes away stays enabled once promoted.
+ */
+
+#include "Harness.h"
+
+#include <sched.h>
+
+enum {
+    kPins       = 24,
+    kPin        = 11,
+    kRacePin    = 14,
+    kReaders    = 3,
+    kRounds     = 200,
+    kRaceRounds = 100
+};
+
+struct ChainedHandler {
+    volatile bool removed;
+    volatile UInt32 calls;
+    volatile UInt32 lateCalls;
+};
+
+struct SharedTest {
+    APICFixture *fixture;
+    IOService *nubs[2];
+    ChainedHandler chained[2];
+    volatile bool done;
+    UInt32 primaryCalls;
+};
+
+static void chainedHandler(void *target, void *refCon, void *nub, int source)
+{
+    ChainedHandler *chained = (ChainedHandler *)refCon;
+
+    __atomic_fetch_add(&chained->calls, 1, __ATOMIC_RELAXED);
+    if (chained->removed)
+    {
+        __atomic_fetch_add(&chained->lateCalls, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void sharedLoop(UInt32 cpu, void *arg)
+{
+    SharedTest *test = (SharedTest *)arg;
+    HarnessAPIC *apic = test->fixture->apic;
+    ChainedHandler *chained;
+    IOService *nub;
+    int i;
+
+    if (cpu != 0)
+    {
+        while (!test->done)
+        {
+            test->fixture->raise(kPin);
+        }
+        return;
+    }
+
+    while (0 == __atomic_load_n(&test->primaryCalls, __ATOMIC_RELAXED))
+    {
+        sched_yield();
+    }
+
+    for (i = 0; i < kRounds; i++)
+    {
+        nub = test->nubs[i & 1];
+        chained = &test->chained[i & 1];
+
+        chained->removed = false;
+        CHECK_EQ(apic->registerInterrupt(nub, 0, test->fixture, chainedHandler, chained), kIOReturnSuccess);
+        CHECK_EQ(apic->enableInterrupt(nub, 0), kIOReturnSuccess);
+        sched_yield();
+        CHECK_EQ(apic->unregisterInterrupt(nub, 0), kIOReturnSuccess);
+        chained->removed = true;
+    }
+
+    test->done = true;
+}
+
+struct RaceTest {
+    APICFixture *fixture;
+    IOService *primary;
+    IOService *chained;
+};
+
+static void raceLoop(UInt32 cpu, void *arg)
+{
+    RaceTest *test = (RaceTest *)arg;
+
+    if (cpu == 0)
+    {
+        CHECK_EQ(test->fixture->apic->enableInterrupt(test->chained, 0), kIOReturnSuccess);
+    } else {
+        CHECK_EQ(test->fixture->apic->unregisterInterrupt(test->primary, 0), kIOReturnSuccess);
+    }
+}
+
+static void checkEnableRace(APICFixture &fixture, UInt32 flags)
+{
+    ChainedHandler chained;
+    RaceTest test;
+    UInt32 primaryCalls = 0;
+    int i;
+
+    test.fixture = &fixture;
+
+    for (i = 0; i < kRaceRounds; i++)
+    {
+        bzero(&chained, sizeof(chained));
+
+        test.primary = fixture.attach(kRacePin, flags, countingHandler, &primaryCalls);
+        test.chained = fixture.addNub(kRacePin, flags);
+        CHECK(test.primary);
+        CHECK_EQ(fixture.apic->registerInterrupt(test.chained, 0, &fixture, chainedHandler, &chained),
+                 kIOReturnSuccess);
+
+        harnessRunThreads(2, raceLoop, &test);
+
+        // Promoted and enabled, whichever came first.
+        CHECK(fixture.apic->vectors[kRacePin].nub == test.chained);
+        CHECK(fixture.raise(kRacePin));
+        CHECK_EQ(chained.calls, 1);
+
+        // With no handler left, the entry is masked.
+        CHECK_EQ(fixture.apic->unregisterInterrupt(test.chained, 0), kIOReturnSuccess);
+        CHECK(!fixture.raise(kRacePin));
+    }
+
+    CHECK_EQ(primaryCalls, 0);
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    SharedTest test;
+    UInt32 flags = kInterruptTriggerModeLevel | kInterruptPolarityLow | kInterruptIsShareable;
+
+    bzero(&test, sizeof(test));
+    test.fixture = &fixture;
+
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kPin, flags, countingHandler, &test.primaryCalls));
+    test.nubs[0] = fixture.addNub(kPin, flags);
+    test.nubs[1] = fixture.addNub(kPin, flags);
+
+    harnessRunThreads(1 + kReaders, sharedLoop, &test);
+
+    CHECK(test.chained[0].calls + test.chained[1].calls > 0);
+    CHECK_EQ(test.chained[0].lateCalls, 0);
+    CHECK_EQ(test.chained[1].lateCalls, 0);
+    CHECK(0 == fixture.apic->_vectorState[kPin].sharedHandlers);
+    CHECK_EQ(fixture.apic->_vectorState[kPin].sharedReaders[0], 0);
+    CHECK_EQ(fixture.apic->_vectorState[kPin].sharedReaders[1], 0);
+
+    // Promote a chained handler to primary, and keep taking interrupts.
+    test.chained[0].removed = false;
+    test.chained[0].calls = 0;
+    CHECK_EQ(fixture.apic->registerInterrupt(test.nubs[0], 0, &fixture, chainedHandler, &test.chained[0]),
+             kIOReturnSuccess);
+    CHECK_EQ(fixture.apic->enableInterrupt(test.nubs[0], 0), kIOReturnSuccess);
+    CHECK_EQ(fixture.apic->unregisterInterrupt(fixture.apic->vectors[kPin].nub, 0), kIOReturnSuccess);
+    CHECK(fixture.apic->vectors[kPin].nub == test.nubs[0]);
+    CHECK(fixture.raise(kPin));
+    CHECK_EQ(test.chained[0].calls, 1);
+
+    checkEnableRace(fixture, flags);
+
+    return harnessResult("test_shared");
+}
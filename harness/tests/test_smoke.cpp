@@ -0,0 +1,38 @@
+/*
+ * Start the driver on the simulated I/O APIC, and take an interrupt
+ * through the whole register path.
+ */
+
+#include "Harness.h"
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(24);
+    UInt32 calls = 0;
+    UInt32 pin;
+
+    CHECK(fixture.start());
+    CHECK_EQ(fixture.apic->_vectorCount, 24);
+    CHECK_EQ(fixture.apic->_apicVersion, 0x20);
+
+    // Every entry comes out of start masked.
+    for (pin = 0; pin < 24; pin++)
+    {
+        CHECK(fixture.sim->entryLow(pin) & IOAPICSim::kRTLOMasked);
+    }
+
+    CHECK(fixture.attach(9, kInterruptTriggerModeLevel | kInterruptPolarityLow, countingHandler, &calls));
+    CHECK(0 == (fixture.sim->entryLow(9) & IOAPICSim::kRTLOMasked));
+    CHECK(fixture.sim->entryLow(9) & IOAPICSim::kRTLOTriggerLevel);
+    CHECK_EQ(fixture.sim->entryLow(9) & IOAPICSim::kRTLOVectorMask, 9);
+
+    CHECK(fixture.raise(9));
+    CHECK(fixture.raise(9));
+    CHECK_EQ(calls, 2);
+    CHECK(!fixture.sim->remoteIRR(9));
+
+    // A pin nobody registered stays masked.
+    CHECK(!fixture.raise(3));
+
+    return harnessResult("test_smoke");
+}
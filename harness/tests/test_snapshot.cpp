@@ -0,0 +1,89 @@
+/*
+ * Register drift: an entry changed behind the driver's back shows up in
+ * CompareRegisterSnapshot, whether its contents are known or not. The
+ * status bits the hardware owns, and halves of unknown contents that
+ * cannot deliver, do not.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kPin        = 6,
+    kUnusedPin  = 17
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+// Take a snapshot and compare it, through the platform functions.
+static UInt32 drift(APICFixture &fixture, UInt32 *driftMap)
+{
+    APICRegisterSnapshot *snapshot = new APICRegisterSnapshot;
+    UInt32 count = ~0U;
+
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->callPlatformFunction(OSSymbol::withCString(kGetRegisterSnapshot),
+                                                                  false, snapshot, 0, 0, 0));
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->callPlatformFunction(OSSymbol::withCString(kCompareRegisterSnapshot),
+                                                                  false, snapshot, &count, driftMap, 0));
+    delete snapshot;
+
+    return count;
+}
+
+int main(void)
+{
+    APICFixture fixture(kPins);
+    UInt32 driftMap[kAPICSnapshotMapWords];
+    UInt32 l32;
+    UInt32 h32;
+
+    ShimSetLogging(false);
+
+    fixture.setTunable(kDeferredProgrammingKey, 1);
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kPin, kInterruptTriggerModeLevel | kInterruptPolarityLow, nullHandler));
+    CHECK_EQ(drift(fixture, driftMap), 0);
+
+    l32 = fixture.sim->entryLow(kPin);
+    h32 = fixture.sim->entryHigh(kPin);
+
+    // Remote IRR and delivery status are the hardware's.
+    CHECK(fixture.sim->assertPin(kPin));
+    CHECK_EQ(drift(fixture, driftMap), 0);
+    fixture.sim->broadcastEOI(l32);
+
+    // A written entry is held to what was written, both halves.
+    fixture.sim->pokeEntry(kPin, l32 | IOAPICSim::kRTLOMasked, h32);
+    CHECK_EQ(drift(fixture, driftMap), 1);
+    CHECK_EQ(driftMap[kPin >> 5], 1 << (kPin & 31));
+
+    fixture.sim->pokeEntry(kPin, l32, h32 ^ 0x01000000);
+    CHECK_EQ(drift(fixture, driftMap), 1);
+    fixture.sim->pokeEntry(kPin, l32, h32);
+
+    // With deferred programming, unused entries are only written masked
+    // on start, their upper half is left for when they are used.
+    fixture.sim->pokeEntry(kUnusedPin, fixture.sim->entryLow(kUnusedPin), 0x05000000);
+    CHECK_EQ(drift(fixture, driftMap), 0);
+
+    fixture.sim->pokeEntry(kUnusedPin, fixture.sim->entryLow(kUnusedPin) & ~IOAPICSim::kRTLOMasked, 0);
+    CHECK_EQ(drift(fixture, driftMap), 1);
+    CHECK_EQ(driftMap[kUnusedPin >> 5], 1 << (kUnusedPin & 31));
+
+    // Once the contents are unknown, as on wake, a masked entry may hold
+    // anything, but an unmasked one has to route as the table says.
+    fixture.apic->invalidateRegisterShadow();
+    fixture.sim->pokeEntry(kUnusedPin, IOAPICSim::kRTLOMasked | 0x42, 0);
+    CHECK_EQ(drift(fixture, driftMap), 0);
+
+    fixture.sim->pokeEntry(kPin, (l32 & ~IOAPICSim::kRTLOVectorMask) | 0x42, h32);
+    CHECK_EQ(drift(fixture, driftMap), 1);
+    CHECK_EQ(driftMap[kPin >> 5], 1 << (kPin & 31));
+
+    fixture.sim->pokeEntry(kPin, l32, 0);
+    CHECK_EQ(drift(fixture, driftMap), 0);
+
+    return harnessResult("test_snapshot");
+}
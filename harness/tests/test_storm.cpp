@@ -0,0 +1,71 @@
+/*
+ * The storm detector throttles a vector on the second time it reaches
+ * the threshold within the window, and not before, however many CPUs
+ * take the vector at once.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kPin        = 7,
+    kThreshold  = 4000,
+    kWindow     = 1000000,  // ms, every crossing is within it
+    kThreads    = 4
+};
+
+static void nullHandler(void *target, void *refCon, void *nub, int source)
+{
+}
+
+struct StormTest {
+    APICFixture *fixture;
+    UInt32 perThread;
+};
+
+static void dispatchLoop(UInt32 cpu, void *arg)
+{
+    StormTest *test = (StormTest *)arg;
+    UInt32 i;
+
+    for (i = 0; i < test->perThread; i++)
+    {
+        test->fixture->dispatch(kPin);
+    }
+}
+
+int main(void)
+{
+    APICFixture fixture(kPins);
+    StormTest test;
+    VectorState *state;
+
+    ShimSetLogging(false);
+
+    fixture.setTunable(kStormThresholdKey, kThreshold);
+    fixture.setTunable(kStormWindowKey, kWindow);
+    CHECK(fixture.start());
+    CHECK(fixture.attach(kPin, kInterruptTriggerModeEdge, nullHandler));
+
+    state = &fixture.apic->_vectorState[kPin];
+    test.fixture = &fixture;
+
+    // The first crossing opens the window, one short of the second one
+    // the vector still delivers.
+    test.perThread = ((2 * kThreshold) / kThreads) - 1;
+    harnessRunThreads(kThreads, dispatchLoop, &test);
+    CHECK(!state->stormThrottled);
+    CHECK_EQ(state->stormCount, kThreshold - kThreads);
+
+    // Every interrupt counts, so the last few reach the threshold.
+    fixture.dispatch(kPin);
+    fixture.dispatch(kPin);
+    fixture.dispatch(kPin);
+    CHECK(!state->stormThrottled);
+    fixture.dispatch(kPin);
+    CHECK(state->stormThrottled);
+    CHECK_EQ(state->stormCount, 0);
+    CHECK(fixture.sim->entryLow(kPin) & IOAPICSim::kRTLOMasked);
+
+    return harnessResult("test_storm");
+}
@@ -0,0 +1,181 @@
+/*
+ * disableInterrupt() on a threaded vector must wait for the worker to
+ * leave the handler, even when the top half ran again meanwhile and
+ * cleared interruptActive. A handler disabling its own vector from the
+ * worker must not wait on itself. unregisterInterrupt() likewise returns
+ * only once the worker has left the handler, and no queued interrupt
+ * runs it afterwards.
+ */
+
+#include "Harness.h"
+
+#include <unistd.h>
+
+enum {
+    kPins       = 24,
+    kSlowPin    = 6,
+    kSelfPin    = 7,
+    kGonePin    = 8
+};
+
+struct SlowHandler {
+    volatile bool running;
+    volatile bool release;
+    volatile UInt32 calls;
+};
+
+static void slowHandler(void *target, void *refCon, void *nub, int source)
+{
+    SlowHandler *slow = (SlowHandler *)refCon;
+
+    slow->running = true;
+    __atomic_fetch_add(&slow->calls, 1, __ATOMIC_RELAXED);
+
+    while (!slow->release)
+    {
+        usleep(100);
+    }
+
+    // Stay in the handler a while after the release.
+    usleep(20000);
+    slow->running = false;
+}
+
+struct SelfDisable {
+    APICFixture *fixture;
+    IOService *nub;
+    volatile bool returned;
+};
+
+static void selfDisablingHandler(void *target, void *refCon, void *nub, int source)
+{
+    SelfDisable *self = (SelfDisable *)refCon;
+
+    self->fixture->apic->disableInterrupt(self->nub, 0);
+    self->returned = true;
+}
+
+struct UnregisterTest {
+    SlowHandler slow;
+    IOInterruptVector *vector;
+    volatile bool unregistered;
+    volatile bool lateCall;
+    volatile bool torn;
+};
+
+static void unregisteringHandler(void *target, void *refCon, void *nub, int source)
+{
+    UnregisterTest *test = (UnregisterTest *)refCon;
+
+    slowHandler(target, &test->slow, nub, source);
+
+    // The vector is only torn down once the handler has returned.
+    if ((0 == test->vector->handler) || (test->vector->nub != nub))
+    {
+        test->torn = true;
+    }
+    if (test->unregistered)
+    {
+        test->lateCall = true;
+    }
+}
+
+static IOService *attachThreaded(APICFixture *fixture, UInt32 pin, IOInterruptHandler handler, void *refCon)
+{
+    IOService *nub = fixture->addNub(pin, kInterruptTriggerModeEdge);
+
+    nub->setProperty(kThreadedInterruptKey, true);
+    if ((kIOReturnSuccess != fixture->apic->registerInterrupt(nub, 0, fixture, handler, refCon)) ||
+        (kIOReturnSuccess != fixture->apic->enableInterrupt(nub, 0)))
+    {
+        return 0;
+    }
+
+    return nub;
+}
+
+int main(int argc, char **argv)
+{
+    APICFixture fixture(kPins);
+    SlowHandler slow;
+    SelfDisable self;
+    UnregisterTest gone;
+    IOService *nub;
+    UInt32 calls;
+    int i;
+
+    bzero(&slow, sizeof(slow));
+    bzero(&self, sizeof(self));
+    bzero(&gone, sizeof(gone));
+
+    CHECK(fixture.start());
+
+    nub = attachThreaded(&fixture, kSlowPin, slowHandler, &slow);
+    CHECK(nub);
+    CHECK(fixture.apic->_vectorState[kSlowPin].threadCall);
+
+    // The worker takes the first interrupt, and the top half runs again
+    // while it is still in the handler.
+    CHECK(fixture.raise(kSlowPin));
+    while (!slow.running)
+    {
+        usleep(100);
+    }
+    CHECK(fixture.raise(kSlowPin));
+    CHECK_EQ(fixture.apic->vectors[kSlowPin].interruptActive, 0);
+
+    slow.release = true;
+    CHECK_EQ(fixture.apic->disableInterrupt(nub, 0), kIOReturnSuccess);
+    CHECK(!slow.running);
+
+    // The queued interrupt is dropped once the vector is disabled.
+    calls = slow.calls;
+    usleep(50000);
+    CHECK_EQ(slow.calls, calls);
+    CHECK(0 == fixture.apic->_vectorState[kSlowPin].threadActive);
+
+    self.fixture = &fixture;
+    self.nub = attachThreaded(&fixture, kSelfPin, selfDisablingHandler, &self);
+    CHECK(self.nub);
+    CHECK(fixture.raise(kSelfPin));
+    for (i = 0; (i < 10000) && (!self.returned); i++)
+    {
+        usleep(100);
+    }
+    CHECK(self.returned);
+
+    CHECK_EQ(fixture.apic->unregisterInterrupt(nub, 0), kIOReturnSuccess);
+    CHECK_EQ(fixture.apic->unregisterInterrupt(self.nub, 0), kIOReturnSuccess);
+    CHECK(0 == fixture.apic->_vectorState[kSlowPin].threadCall);
+
+    // Unregistered with the handler in flight on the worker and another
+    // interrupt queued behind it.
+    gone.vector = &fixture.apic->vectors[kGonePin];
+    nub = attachThreaded(&fixture, kGonePin, unregisteringHandler, &gone);
+    CHECK(nub);
+    CHECK(fixture.raise(kGonePin));
+    while (!gone.slow.running)
+    {
+        usleep(100);
+    }
+    CHECK(fixture.raise(kGonePin));
+    CHECK_EQ(fixture.apic->_vectorState[kGonePin].threadPending, 2);
+
+    gone.slow.release = true;
+    CHECK_EQ(fixture.apic->unregisterInterrupt(nub, 0), kIOReturnSuccess);
+    gone.unregistered = true;
+    CHECK(!gone.slow.running);
+    CHECK_EQ(gone.slow.calls, 1);
+    CHECK(0 == fixture.apic->_vectorState[kGonePin].threadActive);
+    CHECK(0 == fixture.apic->_vectorState[kGonePin].threadCall);
+    CHECK(0 == fixture.apic->vectors[kGonePin].handler);
+
+    CHECK(!gone.torn);
+
+    usleep(50000);
+    CHECK(!gone.lateCall);
+    CHECK_EQ(gone.slow.calls, 1);
+    CHECK(!fixture.raise(kGonePin));
+
+    return harnessResult("test_threaded");
+}
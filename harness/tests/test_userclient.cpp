@@ -0,0 +1,117 @@
+/*
+ * The statistics user client is only for administrators, and keeps the
+ * shared statistics updated while it is open. Clients coming and going
+ * while the update timer runs leave one consistent writer behind.
+ */
+
+#include "Harness.h"
+#include "AppleAPICUserClient.h"
+
+enum {
+    kPins       = 24,
+    kInterval   = 100,      // us
+    kReopens    = 200
+};
+
+static AppleAPICUserClient *newClient(UInt32 type)
+{
+    AppleAPICUserClient *client = new AppleAPICUserClient;
+
+    if (!client->initWithTask(current_task(), current_task(), type))
+    {
+        client->release();
+        return 0;
+    }
+
+    return client;
+}
+
+// Wait up to the timeout for an update past the given count.
+static bool waitForUpdate(HarnessAPIC *apic, UInt32 count, UInt64 timeoutUS = 2000000)
+{
+    UInt64 deadline = harnessNanoseconds() + (timeoutUS * 1000);
+
+    while (harnessNanoseconds() < deadline)
+    {
+        if (((volatile APICStatistics *)apic->_stats)->updateCount > count)
+        {
+            return true;
+        }
+
+        usleep(kInterval);
+    }
+
+    return false;
+}
+
+static void checkPrivilege(void)
+{
+    AppleAPICUserClient *client;
+
+    ShimSetAdministrator(false);
+    client = newClient(kAPICStatisticsMemoryType);
+    CHECK(0 == client);
+
+    ShimSetAdministrator(true);
+    client = newClient(kAPICStatisticsMemoryType + 1);
+    CHECK(0 == client);
+
+    client = newClient(kAPICStatisticsMemoryType);
+    CHECK(client);
+    if (client)
+    {
+        client->release();
+    }
+}
+
+static void checkUpdates(void)
+{
+    APICFixture fixture(kPins);
+    AppleAPICUserClient *client;
+    UInt32 count;
+    int i;
+
+    fixture.setTunable(kStatisticsIntervalKey, kInterval);
+    CHECK(fixture.start());
+
+    client = newClient(kAPICStatisticsMemoryType);
+    CHECK(client);
+    if (0 == client)
+    {
+        return;
+    }
+
+    CHECK(client->start(fixture.apic));
+    CHECK(waitForUpdate(fixture.apic, 0));
+
+    // Close and open again, each time racing the running timer.
+    for (i = 0; i < kReopens; i++)
+    {
+        client->stop(fixture.apic);
+        CHECK(client->start(fixture.apic));
+    }
+
+    CHECK_EQ(fixture.apic->_statsClients, 1);
+    count = fixture.apic->_stats->updateCount;
+    CHECK(waitForUpdate(fixture.apic, count));
+
+    // Closed, the updates stop, and the region is left consistent.
+    client->stop(fixture.apic);
+    CHECK_EQ(fixture.apic->_statsClients, 0);
+    usleep(kInterval * 10);
+    count = fixture.apic->_stats->updateCount;
+    CHECK(!waitForUpdate(fixture.apic, count, kInterval * 20));
+    CHECK_EQ(fixture.apic->_stats->sequence & 1, 0);
+
+    client->release();
+}
+
+int main(void)
+{
+    ShimSetLogging(false);
+
+    checkPrivilege();
+    checkUpdates();
+
+    return harnessResult("test_userclient");
+}
@@ -0,0 +1,118 @@
+/*
+ * Sleep and wake, with deferred programming on and off. The entries come
+ * out of sleep reset, and afterwards the used ones match the vector
+ * table and deliver, the unused ones are masked, and a pin first used
+ * after wake is programmed in full.
+ */
+
+#include "Harness.h"
+
+enum {
+    kPins       = 24,
+    kLevelPin   = 3,
+    kEdgePin    = 9,
+    kMaskedPin  = 12,
+    kLaterPin   = 20
+};
+
+static UInt32 gCount[kPins];
+
+static void countHandler(void *target, void *refCon, void *nub, int source)
+{
+    gCount[(uintptr_t)refCon]++;
+}
+
+// The entry in the simulator holds what the vector table says.
+static void checkEntry(APICFixture &fixture, UInt32 pin)
+{
+    CHECK_EQ(fixture.sim->entryLow(pin) & ~IOAPICSim::kRTLOReadOnlyMask, fixture.apic->_vectorTable[pin].l32);
+    CHECK_EQ(fixture.sim->entryHigh(pin), fixture.apic->_vectorTable[pin].h32);
+}
+
+static void checkDelivery(APICFixture &fixture, UInt32 pin)
+{
+    UInt32 count = gCount[pin];
+
+    CHECK(fixture.raise(pin));
+    CHECK_EQ(gCount[pin], count + 1);
+}
+
+static void checkWake(bool deferred)
+{
+    APICFixture fixture(kPins);
+    IOService *nub;
+    UInt32 pin;
+
+    bzero(gCount, sizeof(gCount));
+
+    fixture.setTunable(kDeferredProgrammingKey, deferred);
+    CHECK(fixture.start());
+    CHECK_EQ(fixture.apic->_deferredProgramming, deferred);
+
+    CHECK(fixture.attach(kLevelPin, kInterruptTriggerModeLevel | kInterruptPolarityLow, countHandler,
+                         (void *)(uintptr_t)kLevelPin));
+    CHECK(fixture.attach(kEdgePin, kInterruptTriggerModeEdge, countHandler, (void *)(uintptr_t)kEdgePin));
+    nub = fixture.attach(kMaskedPin, kInterruptTriggerModeEdge, countHandler, (void *)(uintptr_t)kMaskedPin);
+    CHECK(nub);
+    if (0 == nub)
+    {
+        return;
+    }
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->disableInterrupt(nub, 0));
+
+    // Disabling is lazy, the entry is masked when the pin next fires.
+    CHECK(fixture.raise(kMaskedPin));
+    CHECK_EQ(gCount[kMaskedPin], 0);
+    CHECK(fixture.sim->entryLow(kMaskedPin) & IOAPICSim::kRTLOMasked);
+
+    checkDelivery(fixture, kLevelPin);
+    checkDelivery(fixture, kEdgePin);
+
+    // Everything is masked for sleep.
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->prepareForSleep());
+    for (pin = 0; pin < kPins; pin++)
+    {
+        CHECK(fixture.sim->entryLow(pin) & IOAPICSim::kRTLOMasked);
+    }
+
+    // The I/O APIC loses its state, and a masked unused entry may hold
+    // anything in its upper half.
+    fixture.sim->reset();
+    fixture.sim->pokeEntry(kLaterPin, IOAPICSim::kRTLOMasked, 0x05000000);
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->resumeFromSleep());
+
+    checkEntry(fixture, kLevelPin);
+    checkEntry(fixture, kEdgePin);
+    checkEntry(fixture, kMaskedPin);
+    for (pin = 0; pin < kPins; pin++)
+    {
+        if ((pin != kLevelPin) && (pin != kEdgePin))
+        {
+            CHECK(fixture.sim->entryLow(pin) & IOAPICSim::kRTLOMasked);
+        }
+    }
+
+    checkDelivery(fixture, kLevelPin);
+    checkDelivery(fixture, kEdgePin);
+    CHECK(!fixture.raise(kMaskedPin));
+    CHECK(!fixture.raise(kLaterPin));
+
+    // A pin first used after wake is written in full.
+    CHECK(fixture.attach(kLaterPin, kInterruptTriggerModeEdge, countHandler, (void *)(uintptr_t)kLaterPin));
+    checkEntry(fixture, kLaterPin);
+    checkDelivery(fixture, kLaterPin);
+
+    CHECK_EQ(kIOReturnSuccess, fixture.apic->enableInterrupt(nub, 0));
+    checkEntry(fixture, kMaskedPin);
+    checkDelivery(fixture, kMaskedPin);
+}
+
+int main(void)
+{
+    ShimSetLogging(false);
+
+    checkWake(false);
+    checkWake(true);
+
+    return harnessResult("test_wake");
+}
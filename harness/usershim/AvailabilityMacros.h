@@ -0,0 +1 @@
+/* Host shim, see IOKit/IOKitLib.h. No macOS version is targeted. */
@@ -0,0 +1,50 @@
+/* Host shim, see IOKit/IOKitLib.h. Only strings and numbers. */
+
+#ifndef _HARNESS_COREFOUNDATION_H
+#define _HARNESS_COREFOUNDATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t  UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int32_t  SInt32;
+typedef int64_t  SInt64;
+typedef unsigned char Boolean;
+
+typedef const struct __CFType *CFTypeRef;
+typedef const struct __CFType *CFStringRef;
+typedef const struct __CFType *CFNumberRef;
+typedef const struct __CFType *CFDictionaryRef;
+typedef struct __CFType *CFMutableDictionaryRef;
+typedef const struct __CFType *CFAllocatorRef;
+typedef unsigned long CFTypeID;
+
+#define kCFAllocatorDefault     ((CFAllocatorRef)0)
+
+typedef enum {
+    kCFStringEncodingUTF8       = 0x08000100
+} CFStringEncoding;
+
+typedef enum {
+    kCFNumberSInt32Type         = 3,
+    kCFNumberSInt64Type         = 4
+} CFNumberType;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CFStringRef CFStringCreateWithCString(CFAllocatorRef allocator, const char *string, CFStringEncoding encoding);
+CFTypeID CFGetTypeID(CFTypeRef object);
+CFTypeID CFNumberGetTypeID(void);
+Boolean CFNumberGetValue(CFNumberRef number, CFNumberType type, void *value);
+void CFRelease(CFTypeRef object);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_HARNESS_COREFOUNDATION_H */
@@ -0,0 +1,66 @@
+/*
+ * User space side of the host shim: the IOKitLib calls made by apicstat,
+ * answered by the controllers running in the same process. Services are
+ * the registered interrupt controllers, and IOServiceOpen() creates an
+ * AppleAPICUserClient on them, so a tool maps the real statistics region.
+ */
+
+#ifndef _HARNESS_IOKITLIB_H
+#define _HARNESS_IOKITLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <mach/mach.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+typedef mach_port_t io_object_t;
+typedef io_object_t io_service_t;
+typedef io_object_t io_iterator_t;
+typedef io_object_t io_connect_t;
+typedef io_object_t io_registry_entry_t;
+
+typedef int IOReturn;
+typedef UInt32 IOOptionBits;
+
+#define kIOMasterPortDefault    MACH_PORT_NULL
+#define kIOMainPortDefault      MACH_PORT_NULL
+
+/* The kernel shim has these already, when both are in one test. */
+#ifndef _HARNESS_IOKITSHIM_H
+enum {
+    kIOMapReadOnly              = 0x00001000
+};
+#endif
+
+enum {
+    kIOMapAnywhere              = 0x00000001
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CFMutableDictionaryRef IOServiceMatching(const char *name);
+kern_return_t IOServiceGetMatchingServices(mach_port_t mainPort, CFDictionaryRef matching,
+                                           io_iterator_t *existing);
+io_object_t IOIteratorNext(io_iterator_t iterator);
+kern_return_t IOObjectRelease(io_object_t object);
+
+CFTypeRef IORegistryEntryCreateCFProperty(io_registry_entry_t entry, CFStringRef key,
+                                          CFAllocatorRef allocator, IOOptionBits options);
+
+kern_return_t IOServiceOpen(io_service_t service, task_port_t owningTask, uint32_t type,
+                            io_connect_t *connect);
+kern_return_t IOServiceClose(io_connect_t connect);
+kern_return_t IOConnectMapMemory64(io_connect_t connect, uint32_t memoryType, task_port_t intoTask,
+                                   mach_vm_address_t *atAddress, mach_vm_size_t *ofSize,
+                                   IOOptionBits options);
+kern_return_t IOConnectUnmapMemory64(io_connect_t connect, uint32_t memoryType, task_port_t fromTask,
+                                     mach_vm_address_t atAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_HARNESS_IOKITLIB_H */
@@ -0,0 +1,396 @@
+/*
+ * Host implementation of the user space interfaces declared in the
+ * usershim headers, on top of the kernel shim. Objects handed to the
+ * tool are small integer handles into one table.
+ */
+
+#include <IOKitShim.h>
+
+#include "AppleAPICUserClient.h"
+
+#include <IOKit/IOKitLib.h>
+#include <mach/mach_time.h>
+#include <sys/sysctl.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+//---------------------------------------------------------------------------
+// CoreFoundation
+//---------------------------------------------------------------------------
+
+enum {
+    kCFTypeString       = 1,
+    kCFTypeNumber       = 2,
+    kCFTypeMatching     = 3
+};
+
+struct __CFType {
+    CFTypeID type;
+    char *string;                   // string, or class name to match
+    SInt64 number;
+};
+
+static struct __CFType *newCFObject(CFTypeID type)
+{
+    struct __CFType *object = (struct __CFType *)calloc(1, sizeof(struct __CFType));
+
+    if (object)
+    {
+        object->type = type;
+    }
+
+    return object;
+}
+
+CFStringRef CFStringCreateWithCString(CFAllocatorRef allocator, const char *string, CFStringEncoding encoding)
+{
+    struct __CFType *object = newCFObject(kCFTypeString);
+
+    if (object)
+    {
+        object->string = strdup(string);
+    }
+
+    return object;
+}
+
+CFTypeID CFGetTypeID(CFTypeRef object)
+{
+    return object->type;
+}
+
+CFTypeID CFNumberGetTypeID(void)
+{
+    return kCFTypeNumber;
+}
+
+Boolean CFNumberGetValue(CFNumberRef number, CFNumberType type, void *value)
+{
+    switch (type)
+    {
+        case kCFNumberSInt32Type:
+            *(SInt32 *)value = (SInt32)number->number;
+            return (number->number == *(SInt32 *)value);
+
+        case kCFNumberSInt64Type:
+            *(SInt64 *)value = number->number;
+            return true;
+    }
+
+    return false;
+}
+
+void CFRelease(CFTypeRef object)
+{
+    free(object->string);
+    free((void *)object);
+}
+
+//---------------------------------------------------------------------------
+// Handles
+//---------------------------------------------------------------------------
+
+enum {
+    kHandleService      = 1,
+    kHandleIterator     = 2,
+    kHandleConnect      = 3,
+    kMaxHandles         = 64
+};
+
+struct Handle {
+    int kind;
+    IOService *service;             // service, or provider of the connect
+    char *matching;                 // iterator class name
+    unsigned int next;              // iterator position
+    AppleAPICUserClient *client;
+    IOMemoryDescriptor *memory;
+    IOMemoryMap *map;
+};
+
+static pthread_mutex_t gHandleLock = PTHREAD_MUTEX_INITIALIZER;
+static Handle gHandles[kMaxHandles];
+
+static io_object_t newHandle(int kind)
+{
+    io_object_t object = 0;
+    unsigned int i;
+
+    pthread_mutex_lock(&gHandleLock);
+
+    for (i = 0; i < kMaxHandles; i++)
+    {
+        if (0 == gHandles[i].kind)
+        {
+            bzero(&gHandles[i], sizeof(Handle));
+            gHandles[i].kind = kind;
+            object = i + 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&gHandleLock);
+
+    return object;
+}
+
+static Handle *getHandle(io_object_t object, int kind)
+{
+    if ((0 == object) || (object > kMaxHandles) || (gHandles[object - 1].kind != kind))
+    {
+        return 0;
+    }
+
+    return &gHandles[object - 1];
+}
+
+//---------------------------------------------------------------------------
+// Services. Only AppleAPIC controllers are matched, under the class name
+// of the kext.
+//---------------------------------------------------------------------------
+
+CFMutableDictionaryRef IOServiceMatching(const char *name)
+{
+    struct __CFType *matching = newCFObject(kCFTypeMatching);
+
+    if (matching)
+    {
+        matching->string = strdup(name);
+    }
+
+    return matching;
+}
+
+kern_return_t IOServiceGetMatchingServices(mach_port_t mainPort, CFDictionaryRef matching,
+                                           io_iterator_t *existing)
+{
+    Handle *iterator;
+
+    *existing = newHandle(kHandleIterator);
+    iterator = getHandle(*existing, kHandleIterator);
+    if (0 == iterator)
+    {
+        CFRelease(matching);
+        return kIOReturnNoResources;
+    }
+
+    // The matching dictionary is consumed.
+    iterator->matching = matching->string;
+    free((void *)matching);
+
+    return KERN_SUCCESS;
+}
+
+io_object_t IOIteratorNext(io_iterator_t object)
+{
+    Handle *iterator = getHandle(object, kHandleIterator);
+    IOInterruptController *controller;
+    io_object_t service;
+
+    if ((0 == iterator) || (0 != strcmp(iterator->matching, "AppleAPICInterruptController")))
+    {
+        return 0;
+    }
+
+    while ((controller = ShimGetInterruptController(iterator->next)))
+    {
+        iterator->next++;
+
+        if (0 == OSDynamicCast(AppleAPIC, controller))
+        {
+            continue;
+        }
+
+        service = newHandle(kHandleService);
+        if (service)
+        {
+            controller->retain();
+            getHandle(service, kHandleService)->service = controller;
+        }
+
+        return service;
+    }
+
+    return 0;
+}
+
+kern_return_t IOObjectRelease(io_object_t object)
+{
+    Handle *handle;
+
+    if ((handle = getHandle(object, kHandleService)))
+    {
+        handle->service->release();
+    } else if ((handle = getHandle(object, kHandleIterator))) {
+        free(handle->matching);
+    } else {
+        return kIOReturnBadArgument;
+    }
+
+    handle->kind = 0;
+
+    return KERN_SUCCESS;
+}
+
+CFTypeRef IORegistryEntryCreateCFProperty(io_registry_entry_t entry, CFStringRef key,
+                                          CFAllocatorRef allocator, IOOptionBits options)
+{
+    Handle *service = getHandle(entry, kHandleService);
+    struct __CFType *property;
+    OSNumber *number;
+
+    if (0 == service)
+    {
+        return 0;
+    }
+
+    number = OSDynamicCast(OSNumber, service->service->getProperty(key->string));
+    if (0 == number)
+    {
+        return 0;
+    }
+
+    property = newCFObject(kCFTypeNumber);
+    if (property)
+    {
+        property->number = (SInt64)number->unsigned64BitValue();
+    }
+
+    return property;
+}
+
+//---------------------------------------------------------------------------
+// Connections, each an AppleAPICUserClient on the service
+//---------------------------------------------------------------------------
+
+kern_return_t IOServiceOpen(io_service_t object, task_port_t owningTask, uint32_t type, io_connect_t *connect)
+{
+    Handle *service = getHandle(object, kHandleService);
+    AppleAPICUserClient *client;
+    Handle *handle;
+
+    if (0 == service)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    client = new AppleAPICUserClient;
+    if (!client->initWithTask(current_task(), current_task(), type))
+    {
+        client->release();
+        return kIOReturnNotPrivileged;
+    }
+
+    if (!client->start(service->service))
+    {
+        client->release();
+        return kIOReturnNotReady;
+    }
+
+    *connect = newHandle(kHandleConnect);
+    handle = getHandle(*connect, kHandleConnect);
+    if (0 == handle)
+    {
+        client->stop(service->service);
+        client->release();
+        return kIOReturnNoResources;
+    }
+
+    service->service->retain();
+    handle->service = service->service;
+    handle->client = client;
+
+    return KERN_SUCCESS;
+}
+
+kern_return_t IOServiceClose(io_connect_t connect)
+{
+    Handle *handle = getHandle(connect, kHandleConnect);
+
+    if (0 == handle)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    handle->client->clientClose();
+    handle->client->stop(handle->service);
+    handle->client->release();
+    handle->service->release();
+    handle->kind = 0;
+
+    return KERN_SUCCESS;
+}
+
+kern_return_t IOConnectMapMemory64(io_connect_t connect, uint32_t memoryType, task_port_t intoTask,
+                                   mach_vm_address_t *atAddress, mach_vm_size_t *ofSize, IOOptionBits options)
+{
+    Handle *handle = getHandle(connect, kHandleConnect);
+    IOOptionBits clientOptions;
+    IOReturn result;
+
+    if ((0 == handle) || (0 != handle->map))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    result = handle->client->clientMemoryForType(memoryType, &clientOptions, &handle->memory);
+    if (kIOReturnSuccess != result)
+    {
+        return result;
+    }
+
+    handle->map = handle->memory->map(options | clientOptions);
+    if (0 == handle->map)
+    {
+        handle->memory->release();
+        handle->memory = 0;
+        return kIOReturnNoMemory;
+    }
+
+    *atAddress = handle->map->getVirtualAddress();
+    *ofSize = handle->memory->getLength();
+
+    return KERN_SUCCESS;
+}
+
+kern_return_t IOConnectUnmapMemory64(io_connect_t connect, uint32_t memoryType, task_port_t fromTask,
+                                     mach_vm_address_t atAddress)
+{
+    Handle *handle = getHandle(connect, kHandleConnect);
+
+    if ((0 == handle) || (0 == handle->map) || (handle->map->getVirtualAddress() != atAddress))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    handle->map->release();
+    handle->memory->release();
+    handle->map = 0;
+    handle->memory = 0;
+
+    return KERN_SUCCESS;
+}
+
+//---------------------------------------------------------------------------
+// Mach and BSD
+//---------------------------------------------------------------------------
+
+mach_port_t mach_task_self(void)
+{
+    return 1;
+}
+
+kern_return_t mach_timebase_info(mach_timebase_info_t info)
+{
+    info->numer = 1;
+    info->denom = 1;
+
+    return KERN_SUCCESS;
+}
+
+int sysctlbyname(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    errno = ENOENT;
+    return -1;
+}
@@ -0,0 +1,27 @@
+/* Host shim, see IOKit/IOKitLib.h */
+
+#ifndef _HARNESS_MACH_H
+#define _HARNESS_MACH_H
+
+#include <stdint.h>
+
+typedef int kern_return_t;
+typedef unsigned int mach_port_t;
+typedef mach_port_t task_port_t;
+typedef uint64_t mach_vm_address_t;
+typedef uint64_t mach_vm_size_t;
+
+#define KERN_SUCCESS            0
+#define MACH_PORT_NULL          ((mach_port_t)0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+mach_port_t mach_task_self(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_HARNESS_MACH_H */
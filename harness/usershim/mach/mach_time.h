@@ -0,0 +1,24 @@
+/* Host shim, see IOKit/IOKitLib.h. Absolute time is in nanoseconds. */
+
+#ifndef _HARNESS_MACH_TIME_H
+#define _HARNESS_MACH_TIME_H
+
+#include <mach/mach.h>
+
+typedef struct mach_timebase_info {
+    uint32_t numer;
+    uint32_t denom;
+} mach_timebase_info_data_t, *mach_timebase_info_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+kern_return_t mach_timebase_info(mach_timebase_info_t info);
+uint64_t mach_absolute_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_HARNESS_MACH_TIME_H */
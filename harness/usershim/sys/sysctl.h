@@ -0,0 +1,18 @@
+/* Host shim, see IOKit/IOKitLib.h. No names are known, so every lookup fails. */
+
+#ifndef _HARNESS_SYS_SYSCTL_H
+#define _HARNESS_SYS_SYSCTL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int sysctlbyname(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_HARNESS_SYS_SYSCTL_H */